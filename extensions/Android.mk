@@ -74,6 +74,14 @@ spine/spine-cocos2dx.cpp \
 ./dfont/dfont_utility.cpp \
 ./dfont/dfont_render.cpp \
 ./dfont/dfont_manager.cpp \
+./dfont/dfont_packer.cpp \
+./dfont/dfont_async.cpp \
+./dfont/dfont_span.cpp \
+./dfont/dfont_diskcache.cpp \
+./dfont/dfont_face.cpp \
+./dfont/dfont_index.cpp \
+./dfont/dfont_atlas.cpp \
+./dfont/dfont_utf8.cpp \
 ./RichControls/CCHTMLLabel.cpp \
 ./RichControls/CCRichAtlas.cpp \
 ./RichControls/CCRichCache.cpp \
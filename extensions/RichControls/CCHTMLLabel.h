@@ -187,6 +187,12 @@ public:
 	CCNODE_UTILITY_GETTER(getDefaultSpacing,		short);
 	CCNODE_UTILITY_GETTER(getDefaultPadding,		short);
 
+	// chat log: every appended string is a block, scrolled windows set the visible rect
+	CCNODE_UTILITY_SETTER(setLogMaxBlocks,			size_t);
+	CCNODE_UTILITY_SETTER(setLogViewport,			RRect);
+	CCNODE_UTILITY_GETTER(getLogMaxBlocks,			size_t);
+	CCNODE_UTILITY_GETTER(getLogViewport,			RRect);
+
 
 	CCHTMLLabel();
 	virtual ~CCHTMLLabel();
@@ -23,9 +23,103 @@
  THE SOFTWARE.
  ****************************************************************************/
 #include "CCRichAtlas.h"
+#include "CCEventType.h"
 
 NS_CC_EXT_BEGIN;
 
+#define CCRICH_SDF_SHADER_KEY "CCRichAtlas_SDF"
+
+// premultiplied output: fill over outline over shadow
+static const GLchar* s_sdf_frag = 
+	"#ifdef GL_ES\n"
+	"precision mediump float;\n"
+	"#endif\n"
+	"varying vec4 v_fragmentColor;\n"
+	"varying vec2 v_texCoord;\n"
+	"uniform sampler2D CC_Texture0;\n"
+	"uniform float u_smoothing;\n"
+	"uniform float u_outline_edge;\n"
+	"uniform vec4 u_outline_color;\n"
+	"uniform vec2 u_shadow_offset;\n"
+	"uniform vec4 u_shadow_color;\n"
+	"void main()\n"
+	"{\n"
+	"	float dist = texture2D(CC_Texture0, v_texCoord).a;\n"
+	"	float fill = smoothstep(0.5 - u_smoothing, 0.5 + u_smoothing, dist) * v_fragmentColor.a;\n"
+	"	float outline = smoothstep(u_outline_edge - u_smoothing, u_outline_edge + u_smoothing, dist) * u_outline_color.a;\n"
+	"	vec4 color = vec4(v_fragmentColor.rgb * fill, fill);\n"
+	"	color += vec4(u_outline_color.rgb * outline, outline) * (1.0 - color.a);\n"
+	"	float shadow_dist = texture2D(CC_Texture0, v_texCoord - u_shadow_offset).a;\n"
+	"	float shadow = smoothstep(u_outline_edge - u_smoothing, u_outline_edge + u_smoothing, shadow_dist) * u_shadow_color.a;\n"
+	"	color += vec4(u_shadow_color.rgb * shadow, shadow) * (1.0 - color.a);\n"
+	"	gl_FragColor = color;\n"
+	"}\n";
+
+static void sdf_shader_init(CCGLProgram* program)
+{
+	program->initWithVertexShaderByteArray(ccPositionTextureA8Color_vert, s_sdf_frag);
+	program->addAttribute(kCCAttributeNamePosition, kCCVertexAttrib_Position);
+	program->addAttribute(kCCAttributeNameColor, kCCVertexAttrib_Color);
+	program->addAttribute(kCCAttributeNameTexCoord, kCCVertexAttrib_TexCoords);
+	program->link();
+	program->updateUniforms();
+}
+
+#if CC_ENABLE_CACHE_TEXTURE_DATA
+// shader cache reloads only the default programs when the GL context is recreated,
+// registered before any atlas so the program is rebuilt before atlases look it up
+class CCRichSDFShaderReloader : public CCObject
+{
+public:
+	CCRichSDFShaderReloader()
+	{
+		CCNotificationCenter::sharedNotificationCenter()->addObserver(this, 
+			callfuncO_selector(CCRichSDFShaderReloader::listenBackToForeground), 
+			EVENT_COME_TO_FOREGROUND, NULL);
+	}
+
+	void listenBackToForeground(CCObject* obj)
+	{
+		CCGLProgram* program = CCShaderCache::sharedShaderCache()->programForKey(CCRICH_SDF_SHADER_KEY);
+		if ( program )
+		{
+			program->reset();
+			sdf_shader_init(program);
+		}
+	}
+};
+#endif
+
+static CCGLProgram* sdf_shader_program()
+{
+	CCGLProgram* program = CCShaderCache::sharedShaderCache()->programForKey(CCRICH_SDF_SHADER_KEY);
+	if ( !program )
+	{
+		program = new CCGLProgram();
+		sdf_shader_init(program);
+		CCShaderCache::sharedShaderCache()->addProgram(program, CCRICH_SDF_SHADER_KEY);
+		program->release();
+
+#if CC_ENABLE_CACHE_TEXTURE_DATA
+		// lives as long as the app, observers are not retained
+		static CCRichSDFShaderReloader* s_reloader = NULL;
+		if ( !s_reloader )
+		{
+			s_reloader = new CCRichSDFShaderReloader();
+		}
+#endif
+	}
+	return program;
+}
+
+// 0xAABBGGRR to uniform
+static void sdf_set_color(CCGLProgram* program, GLint location, unsigned int color)
+{
+	program->setUniformLocationWith4f(location, 
+		(color & 0xff) / 255.0f, (color >> 8 & 0xff) / 255.0f, 
+		(color >> 16 & 0xff) / 255.0f, (color >> 24 & 0xff) / 255.0f);
+}
+
 CCRichAtlas* CCRichAtlas::create(class IRichNode* container, CCTexture2D* texture, size_t capacity)
 {
 	CCRichAtlas* atlas = new CCRichAtlas(container);
@@ -43,11 +137,77 @@ bool CCRichAtlas::initWithTexture(CCTexture2D* texture, size_t capacity)
 {
 	CCAtlasNode::initWithTexture(texture, 0, 0, capacity);
 
+	// colors of the elements come from vertices
+	if ( texture->getPixelFormat() == kCCTexture2DPixelFormat_A8 )
+	{
+		setShaderProgram(CCShaderCache::sharedShaderCache()->programForKey(kCCShader_PositionTextureA8Color));
+	}
+	else
+	{
+		setShaderProgram(CCShaderCache::sharedShaderCache()->programForKey(kCCShader_PositionTextureColor));
+	}
+
 	return true;
 }
 
+void CCRichAtlas::setSDFEffect(const dfont::SDFEffect* effect)
+{
+	m_sdfEffect = effect;
+	if ( !effect )
+	{
+		return;
+	}
+
+	CCGLProgram* program = sdf_shader_program();
+	setShaderProgram(program);
+
+#if CC_ENABLE_CACHE_TEXTURE_DATA
+	// uniform locations are looked up again after the program is rebuilt,
+	// after the reloader which is registered by sdf_shader_program
+	if ( !m_listening )
+	{
+		CCNotificationCenter::sharedNotificationCenter()->addObserver(this, 
+			callfuncO_selector(CCRichAtlas::listenBackToForeground), 
+			EVENT_COME_TO_FOREGROUND, NULL);
+		m_listening = true;
+	}
+#endif
+
+	m_uSmoothing = glGetUniformLocation(program->getProgram(), "u_smoothing");
+	m_uOutlineEdge = glGetUniformLocation(program->getProgram(), "u_outline_edge");
+	m_uOutlineColor = glGetUniformLocation(program->getProgram(), "u_outline_color");
+	m_uShadowOffset = glGetUniformLocation(program->getProgram(), "u_shadow_offset");
+	m_uShadowColor = glGetUniformLocation(program->getProgram(), "u_shadow_color");
+
+	// shader outputs premultiplied color
+	ccBlendFunc blend = { GL_ONE, GL_ONE_MINUS_SRC_ALPHA };
+	setBlendFunc(blend);
+}
+
+void CCRichAtlas::listenBackToForeground(CCObject* obj)
+{
+	if ( m_sdfEffect )
+	{
+		setSDFEffect(m_sdfEffect);
+	}
+}
+
+#if CCRICH_DEBUG
+RAtlasStats& CCRichAtlas::stats()
+{
+	static RAtlasStats s_stats;
+	return s_stats;
+}
+#endif
+
 void CCRichAtlas::appendRichElement(IRichElement* element)
 {
+	// transparent elements are not batched
+	if ( element->getColor() == 0 )
+	{
+		return;
+	}
+
 	m_elements.push_back(element);
 	setQuadsToDraw(getQuadsToDraw()+1);
 	m_dirty = true;
@@ -72,61 +232,111 @@ void CCRichAtlas::resizeCapacity(size_t ns)
 void CCRichAtlas::reset()
 {
 	m_elements.clear();
+	m_builtQuads = 0;
 	setQuadsToDraw(0);
 	m_dirty = true;
 
 	m_pTextureAtlas->removeAllQuads();
 }
 
+void CCRichAtlas::removeRichElements(const std::set<IRichElement*>& elements)
+{
+	// written quads are a prefix of the elements, compacting keeps it a prefix
+	ccV3F_C4B_T2F_Quad* quads = m_pTextureAtlas->getQuads();
+	size_t kept = 0;
+	size_t built = 0;
+	for ( size_t i = 0; i < m_elements.size(); i++ )
+	{
+		if ( elements.find(m_elements[i]) != elements.end() )
+			continue;
+
+		if ( i < m_builtQuads )
+		{
+			if ( kept != i )
+			{
+				m_pTextureAtlas->updateQuad(&quads[i], (unsigned int)kept);
+#if CCRICH_DEBUG
+				stats().quad_moves++;
+#endif
+			}
+			built++;
+		}
+		m_elements[kept++] = m_elements[i];
+	}
+
+	if ( kept == m_elements.size() )
+		return;
+
+	m_elements.resize(kept);
+	m_builtQuads = built;
+	setQuadsToDraw(kept);
+}
+
 void CCRichAtlas::updateAtlasValues()
 {
+	// node color is multiplied into the vertices, write all of them again
+	if ( m_builtQuads > 0 && ( _displayedOpacity != m_builtOpacity 
+		|| _displayedColor.r != m_builtColor.r || _displayedColor.g != m_builtColor.g || _displayedColor.b != m_builtColor.b ) )
+	{
+		m_builtQuads = 0;
+		m_dirty = true;
+	}
+
 	if ( !m_dirty )
 	{
 		return;
 	}
 	m_dirty = false;
 
-	if ( m_pTextureAtlas->getCapacity() < getQuadsToDraw() )
+#if CCRICH_DEBUG
+	if ( m_builtQuads == 0 && !m_elements.empty() )
+	{
+		stats().rebuilds++;
+	}
+#endif
+
+	// appended elements only write their own quads
+	if ( m_pTextureAtlas->getCapacity() < m_elements.size() )
 	{
-		m_pTextureAtlas->resizeCapacity( getQuadsToDraw() );
+		size_t capacity = m_pTextureAtlas->getCapacity() * 2;
+		m_pTextureAtlas->resizeCapacity( RMAX(capacity, m_elements.size()) );
 	}
 
 	ccV3F_C4B_T2F_Quad quad;
 
 	CCTexture2D *texture = m_pTextureAtlas->getTexture();
-	float textureWide = (float) texture->getPixelsWide();
-	float textureHigh = (float) texture->getPixelsHigh();
+	float inv_wide = 1.0f / texture->getPixelsWide();
+	float inv_high = 1.0f / texture->getPixelsHigh();
+	bool premultiplied = isOpacityModifyRGB();
 
-	int i = 0;
-	for(std::list<IRichElement*>::iterator it = m_elements.begin(); 
-		it != m_elements.end(); it++, i++) {
-			IRichElement* ele = *it;
+	for(size_t i = m_builtQuads; i < m_elements.size(); i++) {
+			IRichElement* ele = m_elements[i];
 			RTexture* rtex = ele->getTexture();
 
 #if CC_FIX_ARTIFACTS_BY_STRECHING_TEXEL
-			float left   = (rtex->rect.pos.x + 0.5f)/textureWide;
-			float right  = left + (rtex->rect.size.w - 1.0f)/textureWide;
-			float top    = (rtex->rect.pos.y + 0.5f)/textureHigh;
-			float bottom = top + (rtex->rect.size.h - 1.0f)/textureHigh;
+			float left   = (rtex->rect.pos.x + 0.5f) * inv_wide;
+			float right  = left + (rtex->rect.size.w - 1.0f) * inv_wide;
+			float top    = (rtex->rect.pos.y + 0.5f) * inv_high;
+			float bottom = top + (rtex->rect.size.h - 1.0f) * inv_high;
 
 			float ele_pos_left = ele->getGlobalPosition().x;
 			float ele_pos_top = ele->getGlobalPosition().y;
 			float ele_width = ele->scaleToElementSize() ? 
-				ele->getMetrics()->rect.size.w : rtex->rect.size.w;
+				ele->getMetrics()->rect.size.w : rtex->rect.size.w * ele->getTextureScale();
 			float ele_height = ele->scaleToElementSize() ? 
-				ele->getMetrics()->rect.size.h : rtex->rect.size.h;
+				ele->getMetrics()->rect.size.h : rtex->rect.size.h * ele->getTextureScale();
 #else
-			float left   = rtex->rect.pos.x/textureWide;
-			float right  = left + rtex->rect.size.w/textureWide;
-			float top    = rtex->rect.pos.y/textureHigh;
-			float bottom = top + rtex->rect.size.h/textureHigh;
+			float left   = rtex->rect.pos.x * inv_wide;
+			float right  = left + rtex->rect.size.w * inv_wide;
+			float top    = rtex->rect.pos.y * inv_high;
+			float bottom = top + rtex->rect.size.h * inv_high;
 
 			float ele_pos_left = ele->getGlobalPosition().x;
 			float ele_pos_top = ele->getGlobalPosition().y;
 			float ele_width = ele->scaleToElementSize() ? 
-				ele->getMetrics()->rect.size.w : rtex->rect.size.w;
+				ele->getMetrics()->rect.size.w : rtex->rect.size.w * ele->getTextureScale();
 			float ele_height = ele->scaleToElementSize() ? 
-				ele->getMetrics()->rect.size.h : rtex->rect.size.h;
+				ele->getMetrics()->rect.size.h : rtex->rect.size.h * ele->getTextureScale();
 #endif // ! CC_FIX_ARTIFACTS_BY_STRECHING_TEXEL
 
 			quad.tl.texCoords.u = left;
@@ -151,23 +361,70 @@ void CCRichAtlas::updateAtlasValues()
 			quad.tr.vertices.y = ele_pos_top;
 			quad.tr.vertices.z = 0.0f;
 
-			ccColor4B c = { _displayedColor.r, _displayedColor.g, _displayedColor.b, _displayedOpacity };
+			// 0xAABBGGRR element color, premultiplied like CCAtlasNode::setOpacity did
+			unsigned int color = ele->getColor();
+			unsigned int alpha = color >> 24 & 0xff;
+			unsigned int r = (color & 0xff) * _displayedColor.r / 255;
+			unsigned int g = (color >> 8 & 0xff) * _displayedColor.g / 255;
+			unsigned int b = (color >> 16 & 0xff) * _displayedColor.b / 255;
+			if ( premultiplied )
+			{
+				r = r * alpha / 255;
+				g = g * alpha / 255;
+				b = b * alpha / 255;
+			}
+			ccColor4B c = { (GLubyte)r, (GLubyte)g, (GLubyte)b, (GLubyte)(alpha * _displayedOpacity / 255) };
 			quad.tl.colors = c;
 			quad.tr.colors = c;
 			quad.bl.colors = c;
 			quad.br.colors = c;
-			m_pTextureAtlas->updateQuad(&quad, i);
+			m_pTextureAtlas->updateQuad(&quad, (unsigned int)i);
 	}
+
+#if CCRICH_DEBUG
+	stats().quad_writes += m_elements.size() - m_builtQuads;
+#endif
+	m_builtQuads = m_elements.size();
+	m_builtColor = _displayedColor;
+	m_builtOpacity = _displayedOpacity;
 }
 
 void CCRichAtlas::draw()
 {
-	if ( m_dirty )
+	this->updateRichRenderData();
+
+	if ( getQuadsToDraw() == 0 )
 	{
-		this->updateRichRenderData();
+		return;
 	}
+#if CCRICH_DEBUG
+	stats().draw_calls++;
+#endif
+
+	if ( m_sdfEffect )
+	{
+		CC_NODE_DRAW_SETUP();
 
-	CCAtlasNode::draw();
+		CCTexture2D* texture = m_pTextureAtlas->getTexture();
+		CCGLProgram* program = getShaderProgram();
+		program->setUniformLocationWith1f(m_uSmoothing, m_sdfEffect->smoothing);
+		program->setUniformLocationWith1f(m_uOutlineEdge, m_sdfEffect->outline_edge);
+		sdf_set_color(program, m_uOutlineColor, m_sdfEffect->outline_color);
+		program->setUniformLocationWith2f(m_uShadowOffset, 
+			m_sdfEffect->shadow_offset_x / texture->getPixelsWide(), 
+			m_sdfEffect->shadow_offset_y / texture->getPixelsHigh());
+		sdf_set_color(program, m_uShadowColor, m_sdfEffect->shadow_color);
+
+		ccGLBlendFunc( m_tBlendFunc.src, m_tBlendFunc.dst );
+		m_pTextureAtlas->drawNumberOfQuads(getQuadsToDraw(), 0);
+	}
+	else
+	{
+		// vertex colors, not the uniform color of CCAtlasNode::draw
+		CC_NODE_DRAW_SETUP();
+		ccGLBlendFunc( m_tBlendFunc.src, m_tBlendFunc.dst );
+		m_pTextureAtlas->drawNumberOfQuads(getQuadsToDraw(), 0);
+	}
 
 #if CCRICH_DEBUG
 	// atlas bounding box
@@ -184,11 +441,26 @@ void CCRichAtlas::draw()
 CCRichAtlas::CCRichAtlas(class IRichNode* container)
 : m_container(container)
 , m_dirty(true)
+, m_builtQuads(0)
+, m_builtOpacity(0)
+, m_sdfEffect(NULL)
+, m_uSmoothing(-1)
+, m_uOutlineEdge(-1)
+, m_uOutlineColor(-1)
+, m_uShadowOffset(-1)
+, m_uShadowColor(-1)
+, m_listening(false)
 {
 }
 
 CCRichAtlas::~CCRichAtlas()
 { 
+#if CC_ENABLE_CACHE_TEXTURE_DATA
+	if ( m_listening )
+	{
+		CCNotificationCenter::sharedNotificationCenter()->removeObserver(this, EVENT_COME_TO_FOREGROUND);
+	}
+#endif
 	m_elements.clear();
 }
 
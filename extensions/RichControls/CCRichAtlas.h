@@ -27,13 +27,27 @@
 
 #include "CCRichProtocols.h"
 
-#include <list>
+#include <set>
 
 
 NS_CC_EXT_BEGIN;
 
+#if CCRICH_DEBUG
+// counters of all rich atlases, for benchmarks
+struct RAtlasStats
+{
+	size_t draw_calls;
+	size_t quad_writes;	// quads written by updateAtlasValues
+	size_t quad_moves;	// quads moved down by removeRichElements
+	size_t rebuilds;	// atlases written from the first quad
+
+	RAtlasStats() : draw_calls(0), quad_writes(0), quad_moves(0), rebuilds(0) {}
+};
+#endif
+
 //
 // a atlas node for rendering batched rich elements
+//	- one atlas per texture, colors of the elements are in the vertices
 //
 class CCRichAtlas : public CCAtlasNode, public IRichAtlas
 {
@@ -49,6 +63,19 @@ public:
 
 	void resizeCapacity(size_t ns);
 	void reset();
+
+	// remove the elements and their quads, quads of the others are kept
+	void removeRichElements(const std::set<IRichElement*>& elements);
+
+	// draw distance field glyphs with the effect, NULL to draw as normal texture
+	void setSDFEffect(const dfont::SDFEffect* effect);
+
+	// the SDF program is rebuilt when the GL context is recreated
+	void listenBackToForeground(CCObject* obj);
+
+#if CCRICH_DEBUG
+	static RAtlasStats& stats();
+#endif
     
     // super methods
     virtual void updateAtlasValues();
@@ -60,7 +87,18 @@ public:
 protected:
 	class IRichNode* m_container;
 	bool m_dirty;
-	std::list<IRichElement*> m_elements;
+	element_list_t m_elements;
+	size_t m_builtQuads;	// elements with written quads
+	ccColor3B m_builtColor;	// node color of the written quads
+	GLubyte m_builtOpacity;
+
+	const dfont::SDFEffect* m_sdfEffect;
+	GLint m_uSmoothing;
+	GLint m_uOutlineEdge;
+	GLint m_uOutlineColor;
+	GLint m_uShadowOffset;
+	GLint m_uShadowColor;
+	bool m_listening;	// to EVENT_COME_TO_FOREGROUND
 };
 
 NS_CC_EXT_END;
@@ -63,6 +63,7 @@ RRect RLineCache::flush(class IRichCompositor* compositor)
 	RMetricsState* mstate = compositor->getMetricsState();
 
 	RPos pen;
+	int pen_frac = 0;	// pen x below a pixel in 26.6, left by subpixel advances
 	RRect temp_linerect;
 	short base_line_pos_y = 0;
 	element_list_t::iterator inner_start_it = line->begin();
@@ -81,11 +82,22 @@ RRect RLineCache::flush(class IRichCompositor* compositor)
 			baseline_correct = m_rBaselinePos;
 		}
 
+		// glyph variant for the pen fraction, metrics may change
+		if ( pen.x == 0 )
+		{
+			pen_frac = 0;
+		}
+		(*it)->setSubpixelOffset(pen_frac);
+
 		// first element
 		if ( pen.x == 0 )
 		{
 			pen.x -= metrics->rect.min_x();
 		}
+		else
+		{
+			pen.x += (*it)->getKerning(*(it - 1));
+		}
 		
 		// set position
 		(*it)->setLocalPositionX(pen.x);
@@ -128,6 +140,12 @@ RRect RLineCache::flush(class IRichCompositor* compositor)
 			inner_start_it = next_it;
 			temp_linerect = RRect();
 		}
+		else if ( metrics->advance_26dot6 )
+		{
+			int pen_26dot6 = pen_frac + metrics->advance_26dot6;
+			pen.x += (short)(pen_26dot6 >> 6);
+			pen_frac = pen_26dot6 & 63;
+		}
 		else
 		{
 			pen.x += metrics->advance.x;
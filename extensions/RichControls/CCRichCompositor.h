@@ -37,6 +37,7 @@ class RBaseCompositor : public IRichCompositor
 public:
 	// get rect
 	virtual const RRect& getRect() const { return m_rRect; }
+	virtual void setRect(const RRect& rect) { m_rRect = rect; }
 	// get current composit state
 	virtual RMetricsState* getMetricsState();
 	// return new top state
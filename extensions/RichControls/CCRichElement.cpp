@@ -25,6 +25,7 @@
 #include "CCRichElement.h"
 
 #include <cocos-ext.h>
+#include <stddef.h>
 
 using namespace dfont;
 
@@ -233,6 +234,52 @@ void REleBase::render(RRichCanvas canvas)
 #endif
 }
 
+void REleBase::resetComposit()
+{
+	m_rPos = RPos();
+	m_rGlobalPos = RPos();
+	m_rMetrics = RMetrics();
+
+	onRenderReset();
+
+	element_list_t* children = getChildren();
+	if ( children )
+	{
+		for ( element_list_t::iterator it = children->begin(); it != children->end(); it++ )
+		{
+			(*it)->resetComposit();
+		}
+	}
+}
+
+void REleBase::resetRender(bool materialized)
+{
+	onRenderReset();
+
+	element_list_t* children = getChildren();
+	if ( children )
+	{
+		for ( element_list_t::iterator it = children->begin(); it != children->end(); it++ )
+		{
+			(*it)->resetRender(materialized);
+		}
+	}
+}
+
+void REleBase::resetColor(unsigned int default_color)
+{
+	onRenderReset();
+
+	element_list_t* children = getChildren();
+	if ( children )
+	{
+		for ( element_list_t::iterator it = children->begin(); it != children->end(); it++ )
+		{
+			(*it)->resetColor(default_color);
+		}
+	}
+}
+
 // children
 element_list_t* REleBase::getChildren()
 {
@@ -368,7 +415,7 @@ void REleBatchedDrawable::onRenderPrev(RRichCanvas canvas)
 		if ( NULL != this->getTexture() 
 			&& NULL != (ob_texture = this->getTexture()->getTexture()) )
 		{
-			IRichAtlas* atlas = canvas.root->findAtlas(ob_texture, getColor());
+			IRichAtlas* atlas = canvas.root->findAtlas(ob_texture);
 
 			if (atlas)
 			{
@@ -394,7 +441,7 @@ void RAtlasHelper::onRenderPrev(RRichCanvas canvas)
 		if ( NULL != this->getTexture() 
 			&& NULL != (ob_texture = this->getTexture()->getTexture()) )
 		{
-			IRichAtlas* atlas = canvas.root->findAtlas(ob_texture, getColor(), ZORDER_BACKGROUND);
+			IRichAtlas* atlas = canvas.root->findAtlas(ob_texture, ZORDER_BACKGROUND);
 
 			if (atlas)
 			{
@@ -404,32 +451,328 @@ void RAtlasHelper::onRenderPrev(RRichCanvas canvas)
 	}
 }
 
+// multiply two 0xAABBGGRR colors
+static unsigned int cc_modulate_color(unsigned int c1, unsigned int c2)
+{
+	unsigned int color = 0;
+	for ( int shift = 0; shift < 32; shift += 8 )
+	{
+		unsigned int v = ((c1 >> shift) & 0xff) * ((c2 >> shift) & 0xff) / 0xff;
+		color |= v << shift;
+	}
+	return color;
+}
+
 void REleGlyph::onCompositStart(class IRichCompositor* compositor)
 {
-	if ( !compositor->getFont() )
+	m_font = compositor->getFont();
+	if ( !m_font )
 		return;
 
-	m_slot = compositor->getFont()->require_char(m_charcode);
+	CC_SAFE_RELEASE(m_slot);
+	m_slot = m_font->require_char(m_charcode);
+	m_phase = 0;
 
 	if ( m_slot )
 	{
-		m_rMetrics.rect.pos = RPos((short)m_slot->metrics.left, (short)m_slot->metrics.top);
-		m_rMetrics.rect.size = RSize((short)m_slot->metrics.width, (short)m_slot->metrics.height);
-		m_rMetrics.advance.x = m_slot->metrics.advance_x;
-		m_rMetrics.advance.y = 0;//m_slot->metrics.advance_y;
-
-		m_rTexture.setTexture(m_slot->texture->user_texture<CCTexture2D>());
-		m_rTexture.rect.pos = RPos((short)m_slot->padding_rect.origin_x, (short)m_slot->padding_rect.origin_y);
-		m_rTexture.rect.size = RSize((short)m_slot->padding_rect.width, (short)m_slot->padding_rect.height);
+		applySlot();
 
 		RRenderState* state = compositor->getRenderState();
 		m_font_alias = state->font_alias;
-		m_rColor = state->color;
+		m_rColor = cc_modulate_color(state->color, m_font->tint());
+		m_rDefaultColor = state->default_color;
+	}
+}
+
+void REleGlyph::resetColor(unsigned int default_color)
+{
+	if ( m_font && m_rDefaultColor )
+	{
+		m_rColor = cc_modulate_color(default_color, m_font->tint());
+	}
+
+	REleBatchedDrawable::resetColor(default_color);
+}
+
+void REleGlyph::resetRender(bool materialized)
+{
+	if ( !materialized )
+	{
+		// metrics are kept for the layout
+		CC_SAFE_RELEASE_NULL(m_slot);
+		m_rTexture.setTexture(NULL);
+	}
+	else if ( !m_slot && m_font )
+	{
+		m_slot = m_font->require_char(m_charcode, m_phase);
+		if ( m_slot )
+		{
+			applySlotTexture();
+		}
+	}
+
+	REleBatchedDrawable::resetRender(materialized);
+}
+
+bool REleGlyph::updateTexture()
+{
+	if ( isTexturePending() )
+		return false;
+
+	if ( m_slot )
+	{
+		applySlotTexture();
+	}
+	m_rDirty = true;
+	return true;
+}
+
+void REleGlyph::onRenderPrev(RRichCanvas canvas)
+{
+	if ( m_rDirty )
+	{
+		m_rDirty = false;
+
+		// add to batch
+		CCTexture2D* ob_texture = NULL;
+		if ( NULL != this->getTexture() 
+			&& NULL != (ob_texture = this->getTexture()->getTexture()) )
+		{
+			IRichAtlas* atlas = canvas.root->findGlyphAtlas(ob_texture, m_font);
+
+			if (atlas)
+			{
+				atlas->appendRichElement(this);
+			}
+		}
+	}
+}
+
+void REleGlyph::setSubpixelOffset(int offset)
+{
+	if ( !m_slot || !m_font )
+		return;
+
+	int phases = m_font->subpixel_phases(m_charcode);
+	if ( phases <= 1 )
+		return;
+
+	// nearest variant, rounding up to the last one is the next pixel
+	int phase = (offset * phases + 32) >> 6;
+	short carry = 0;
+	if ( phase >= phases )
+	{
+		phase = 0;
+		carry = 1;
+	}
+
+	if ( phase != m_phase )
+	{
+		dfont::GlyphSlot* slot = m_font->require_char(m_charcode, phase);
+		if ( slot )
+		{
+			m_slot->release();
+			m_slot = slot;
+			m_phase = phase;
+		}
+	}
+
+	applySlot();
+	m_rMetrics.rect.pos.x += carry;
+}
+
+void REleGlyph::applySlot()
+{
+	// distance field glyphs are shared by sizes
+	float scale = m_font->scale();
+	m_rTextureScale = scale;
+
+	m_rMetrics.rect.pos = RPos((short)(m_slot->metrics.left * scale), (short)(m_slot->metrics.top * scale));
+	m_rMetrics.rect.size = RSize((short)(m_slot->metrics.width * scale), (short)(m_slot->metrics.height * scale));
+	m_rMetrics.advance.x = (short)(m_slot->metrics.advance_x * scale + 0.5f);
+	m_rMetrics.advance.y = 0;//m_slot->metrics.advance_y;
+	m_rMetrics.advance_26dot6 = m_font->subpixel_phases(m_charcode) > 1 ? m_slot->metrics.advance_x_26dot6 : 0;
+
+	applySlotTexture();
+}
+
+void REleGlyph::applySlotTexture()
+{
+	// pending glyph has no texture yet, node will relayout when it's ready
+	m_rTexture.setTexture(m_slot->texture ? m_slot->texture->user_texture<CCTexture2D>() : NULL);
+	m_rTexture.rect.pos = RPos((short)m_slot->padding_rect.origin_x, (short)m_slot->padding_rect.origin_y);
+	m_rTexture.rect.size = RSize((short)m_slot->padding_rect.width, (short)m_slot->padding_rect.height);
+}
+
+short REleGlyph::getKerning(IRichElement* prev)
+{
+	// only between glyphs of the same font
+	REleGlyph* prev_glyph = dynamic_cast<REleGlyph*>(prev);
+	if ( !m_font || !prev_glyph || prev_glyph->m_font != m_font )
+		return 0;
+
+	return (short)m_font->kerning(prev_glyph->m_charcode, m_charcode);
+}
+
+// free lists of glyph sized cells in blocks, a block is released with its last glyph
+//	- one empty block is kept, a glyph created and deleted at a block boundary doesn't thrash
+//	- no constructor, zero initialized before any static constructor runs
+class RGlyphPool
+{
+public:
+	void* alloc()
+	{
+		if ( !m_open )
+			grow();
+
+		Block* block = m_open;
+		Cell* cell = block->free;
+		block->free = cell->next;
+		block->live++;
+
+		// full blocks leave the open list until a glyph is freed
+		if ( !block->free )
+			unlink(block);
+
+		return cell->data;
+	}
+
+	void free(void* p)
+	{
+		Cell* cell = (Cell*)((char*)p - offsetof(Cell, data));
+		Block* block = cell->block;
+
+		if ( !block->free )
+			append(block);
+
+		cell->next = block->free;
+		block->free = cell;
+
+		if ( --block->live == 0 )
+		{
+			unlink(block);
+			if ( m_spare )
+				::operator delete(block);
+			else
+				m_spare = block;
+		}
+	}
+
+private:
+	enum { c_block_cells = 256 };
+
+	struct Block;
+
+	struct Cell
+	{
+		Block* block;
+		union
+		{
+			Cell* next;
+			char data[sizeof(REleGlyph)];
+		};
+	};
+
+	struct Block
+	{
+		Block* prev;
+		Block* next;
+		Cell* free;
+		size_t live;
+		Cell cells[c_block_cells];
+	};
+
+	void grow()
+	{
+		Block* block = m_spare;
+		if ( block )
+		{
+			// all cells were freed, the free list is whole
+			m_spare = NULL;
+		}
+		else
+		{
+			block = (Block*)::operator new(sizeof(Block));
+			block->free = NULL;
+			block->live = 0;
+
+			// first cell on top, a document fills a block in order
+			for ( int i = c_block_cells - 1; i >= 0; i-- )
+			{
+				block->cells[i].block = block;
+				block->cells[i].next = block->free;
+				block->free = block->cells + i;
+			}
+		}
+
+		block->prev = NULL;
+		block->next = m_open;
+		if ( m_open )
+			m_open->prev = block;
+		else
+			m_open_tail = block;
+		m_open = block;
+	}
+
+	// blocks with a few free cells are used after the new ones, mostly empty blocks can drain
+	void append(Block* block)
+	{
+		block->prev = m_open_tail;
+		block->next = NULL;
+		if ( m_open_tail )
+			m_open_tail->next = block;
+		else
+			m_open = block;
+		m_open_tail = block;
 	}
+
+	void unlink(Block* block)
+	{
+		if ( block->prev )
+			block->prev->next = block->next;
+		else
+			m_open = block->next;
+
+		if ( block->next )
+			block->next->prev = block->prev;
+		else
+			m_open_tail = block->prev;
+	}
+
+	// blocks with free cells, alloc takes the head
+	Block* m_open;
+	Block* m_open_tail;
+	Block* m_spare;	// empty, not in the open list
+};
+
+static RGlyphPool s_glyph_pool;
+
+void* REleGlyph::operator new(size_t size)
+{
+	// subclasses are not pooled
+	if ( size != sizeof(REleGlyph) )
+		return ::operator new(size);
+
+	return s_glyph_pool.alloc();
+}
+
+void REleGlyph::operator delete(void* p, size_t size)
+{
+	if ( !p )
+		return;
+
+	if ( size != sizeof(REleGlyph) )
+	{
+		::operator delete(p);
+		return;
+	}
+
+	s_glyph_pool.free(p);
 }
 
 REleGlyph::REleGlyph(unsigned int charcode)
-	: m_charcode(charcode), m_slot(NULL)
+	: m_charcode(charcode), m_phase(0), m_slot(NULL), m_font(NULL), m_rTextureScale(1.0f), m_rDefaultColor(false)
+	, m_font_alias("")
 {
 
 }
@@ -714,6 +1057,7 @@ void REleHTMLP::onCompositStatePushed(class IRichCompositor* compositor)
 	if ( m_rColor )
 	{
 		compositor->getRenderState()->color = m_rColor;
+		compositor->getRenderState()->default_color = false;
 	}
 
 	if ( !m_rFontAlias.empty() )
@@ -761,7 +1105,10 @@ void REleHTMLFont::onCompositStatePushed(class IRichCompositor* compositor)
 		compositor->getRenderState()->font_alias = m_rFont.c_str();
 
 	if ( m_rColor != 0 )
+	{
 		compositor->getRenderState()->color = m_rColor;
+		compositor->getRenderState()->default_color = false;
+	}
 }
 
 
@@ -1053,8 +1400,36 @@ void REleHTMLHR::onCompositStart(class IRichCompositor* compositor)
 	m_rMetrics.rect.size.h = m_rSize;
 	m_rMetrics.rect.pos.y = m_rMetrics.rect.size.h;
 
-	if ( m_rColor == 0 )
-		m_rColor = compositor->getRenderState()->color;
+	if ( m_rColor == 0 || m_rInheritColor )
+	{
+		RRenderState* state = compositor->getRenderState();
+		m_rColor = state->color;
+		m_rInheritColor = true;
+		m_rDefaultColor = state->default_color;
+	}
+}
+
+void REleHTMLHR::resetComposit()
+{
+	// the render state may differ in the next composit
+	if ( m_rInheritColor )
+	{
+		m_rColor = 0;
+		m_rInheritColor = false;
+		m_rDefaultColor = false;
+	}
+
+	REleBase::resetComposit();
+}
+
+void REleHTMLHR::resetColor(unsigned int default_color)
+{
+	if ( m_rDefaultColor )
+	{
+		m_rColor = default_color;
+	}
+
+	REleBase::resetColor(default_color);
 }
 
 bool REleHTMLHR::onCompositFinish(class IRichCompositor* compositor)
@@ -1106,7 +1481,7 @@ void REleHTMLHR::onRenderPost(RRichCanvas canvas)
 }
 
 REleHTMLHR::REleHTMLHR()
-	: m_rSize(1), m_rTempPadding(0)
+	: m_rSize(1), m_rTempPadding(0), m_rInheritColor(false), m_rDefaultColor(false)
 {
 
 }
@@ -1218,6 +1593,12 @@ void REleHTMLCell::onCompositChildrenEnd(class IRichCompositor* compositor)
 	m_rMetrics.rect.extend(m_rContentSize);
 }
 
+void REleHTMLCell::onRenderReset()
+{
+	REleHTMLNode::onRenderReset();
+	m_rBGTexture.setDirty(m_rBGTexture.getTexture()->getTexture() != NULL);
+}
+
 REleHTMLCell::REleHTMLCell(class REleHTMLRow* row)
 	: m_rRow(row), m_rHAlignSpecified(false), m_rVAlignSpecified(false), m_rIndexNumber(0),
 	m_rHAlignment(e_align_left), m_rVAlignment(e_align_bottom)
@@ -1851,18 +2232,13 @@ bool REleCCBNode::onParseAttributes(class IRichParser* parser, attrs_t* attrs )
 			m_ccbNode->retain();
 			m_ccbNode->setAnchorPoint(ccp(0.0f, 1.0f));
 			m_ccbNode->ignoreAnchorPointForPosition(true);
-			m_rMetrics.rect.size.w = (short)m_ccbNode->getContentSize().width;
-			m_rMetrics.rect.size.h = (short)m_ccbNode->getContentSize().height;
-			m_rMetrics.advance.x = m_rMetrics.rect.size.w;
-			m_rMetrics.rect.pos.y = m_rMetrics.rect.size.w;
+			applyNodeSize();
 			m_dirty = true;
 
-			CCBAnimationManager* anim_manager = dynamic_cast<CCBAnimationManager*>(m_ccbNode->getUserObject());
-			if ( anim_manager && strcmp((*attrs)["play"].c_str(), "auto") == 0 )
+			// played when added to the overlays
+			if ( strcmp((*attrs)["play"].c_str(), "auto") == 0 )
 			{
 				m_sequence = (*attrs)["anim"];
-				if ( !m_sequence.empty() )
-					anim_manager->runAnimations(m_sequence.c_str());
 			}
 
 			return true;
@@ -1885,11 +2261,38 @@ void REleCCBNode::onRenderPost(RRichCanvas canvas)
 		m_ccbNode->setPosition(ccp(pos.x, pos.y - m_rMetrics.rect.size.h /*+ canvas.root->getActualSize().h*/));
 		canvas.root->addCCNode(m_ccbNode);
 		m_dirty = false;
+
+		// overlays cleanup stops the animations on every relayout
+		CCBAnimationManager* anim_manager = dynamic_cast<CCBAnimationManager*>(m_ccbNode->getUserObject());
+		if ( anim_manager && !m_sequence.empty() )
+			anim_manager->runAnimations(m_sequence.c_str());
 	}
 
 	REleBase::onRenderPost(canvas);
 }
 
+void REleCCBNode::resetComposit()
+{
+	REleBase::resetComposit();
+
+	if ( m_ccbNode )
+		applyNodeSize();
+}
+
+void REleCCBNode::onRenderReset()
+{
+	REleBase::onRenderReset();
+	m_dirty = m_ccbNode != NULL;
+}
+
+void REleCCBNode::applyNodeSize()
+{
+	m_rMetrics.rect.size.w = (short)m_ccbNode->getContentSize().width;
+	m_rMetrics.rect.size.h = (short)m_ccbNode->getContentSize().height;
+	m_rMetrics.advance.x = m_rMetrics.rect.size.w;
+	m_rMetrics.rect.pos.y = m_rMetrics.rect.size.w;
+}
+
 REleCCBNode::REleCCBNode()
 	: m_ccbNode(NULL), m_dirty(false)
 {
@@ -51,6 +51,9 @@ public:
 	virtual bool parse(class IRichParser* parser, const char** attr = NULL);
 	virtual bool composit(class IRichCompositor* compositor);
 	virtual void render(RRichCanvas canvas);
+	virtual void resetComposit();
+	virtual void resetColor(unsigned int default_color);
+	virtual void resetRender(bool materialized);
 
 	virtual bool pushMetricsState() { return false; }
 	virtual bool pushRenderState() { return false; }
@@ -77,6 +80,7 @@ public:
 	
 	virtual RTexture* getTexture() { return &m_rTexture; }
 	virtual bool scaleToElementSize() { return false; }
+	virtual float getTextureScale() { return 1.0f; }
 	virtual void setRColor(unsigned int color) { m_rColor = color; }
 	virtual unsigned int getColor() { return m_rColor; }
 	virtual const char* getFontAlias() { return NULL; }
@@ -87,6 +91,8 @@ public:
 	virtual bool isNewlineFollow() { return false;}
 	virtual bool isCachedComposit() { return false;}
 	virtual short getBaseline() { return 0; }
+	virtual short getKerning(IRichElement* prev) { return 0; }
+	virtual void setSubpixelOffset(int offset) {}
 	virtual bool needBaselineCorrect() { return false;}
 
 	virtual void onCachedCompositBegin(class ICompositCache* cache, RPos& pen){}
@@ -120,6 +126,8 @@ protected:
 	virtual void onRenderPrev(RRichCanvas canvas) {}
 	// call after render children
 	virtual void onRenderPost(RRichCanvas canvas) {}
+	// drawables are cleared, draw again at next render
+	virtual void onRenderReset() { m_rDirty = true; }
 
 	int m_rID;
 
@@ -190,19 +198,42 @@ class REleGlyph : public REleBatchedDrawable
 public:
 	virtual bool canLinewrap() { return true; }
 	virtual short getBaseline() { return m_rMetrics.rect.min_y(); }
-	virtual const char* getFontAlias() { return m_font_alias.c_str(); }
+	virtual short getKerning(IRichElement* prev);
+	virtual void setSubpixelOffset(int offset);
+	virtual const char* getFontAlias() { return m_font_alias; }
+	virtual float getTextureScale() { return m_rTextureScale; }
+	virtual void resetColor(unsigned int default_color);
+	virtual void resetRender(bool materialized);
+
+	// materialized again while its slot is rasterizing, metrics are kept
+	bool isTexturePending() { return m_slot && !m_slot->texture; }
+	// apply the rasterized texture to be batched again, false while pending
+	bool updateTexture();
+
+	// glyphs of a document are allocated together from pooled blocks
+	static void* operator new(size_t size);
+	static void operator delete(void* p, size_t size);
 
 	REleGlyph(unsigned int charcode);
 	virtual ~REleGlyph();
 
 protected:
 	virtual void onCompositStart(class IRichCompositor* compositor);
+	virtual void onRenderPrev(RRichCanvas canvas);
 
 private:
+	// metrics and texture rect from m_slot
+	void applySlot();
+	void applySlotTexture();
+
 	unsigned int m_charcode;
+	int m_phase;	// subpixel variant of m_slot
 	struct dfont::GlyphSlot* m_slot;
+	class dfont::FontCatalog* m_font;
+	float m_rTextureScale;
+	bool m_rDefaultColor;	// color follows the node default
 
-	std::string m_font_alias;
+	const char* m_font_alias;	// owned by the render state source, lives with the tree
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -389,6 +420,10 @@ public:
 
 	virtual void onCachedCompositBegin(class ICompositCache* cache, RPos& pen);
 	virtual void onCachedCompositEnd(class ICompositCache* cache, RPos& pen);
+
+	virtual void resetComposit();
+	virtual void resetColor(unsigned int default_color);
+
 	REleHTMLHR();
 
 protected:
@@ -400,6 +435,8 @@ protected:
 	short m_rSize;
 	ROptSize m_rWidth;
 	short m_rTempPadding;
+	bool m_rInheritColor;	// no style color, color is taken from the render state
+	bool m_rDefaultColor;	// color follows the node default
 };
 
 //
@@ -433,6 +470,7 @@ protected:
 	virtual bool onParseAttributes(class IRichParser* parser, attrs_t* attrs );
 	virtual void onCompositStatePushed(class IRichCompositor* compositor);
 	virtual void onCompositChildrenEnd(class IRichCompositor* compositor);
+	virtual void onRenderReset();
 
 private:
 	class REleHTMLRow* m_rRow;
@@ -690,6 +728,7 @@ public:
 	virtual bool isCachedComposit() { return true; }
 	virtual bool canLinewrap() { return true; }
 	virtual bool needBaselineCorrect() { return true;  }
+	virtual void resetComposit();
 
 	REleCCBNode();
 	virtual ~REleCCBNode();
@@ -698,8 +737,12 @@ protected:
 	virtual bool onParseAttributes(class IRichParser* parser, attrs_t* attrs );
 	virtual bool onCompositFinish(class IRichCompositor* compositor);
 	virtual void onRenderPost(RRichCanvas canvas);
+	virtual void onRenderReset();
 
 private:
+	// metrics from the ccb node content size
+	void applyNodeSize();
+
 	std::string m_filename;
 	std::string m_sequence;
 	CCNode* m_ccbNode;
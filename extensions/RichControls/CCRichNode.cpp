@@ -27,9 +27,17 @@
 #include "CCRichParser.h"
 #include "CCRichCompositor.h"
 #include "CCRichOverlay.h"
+#include "CCRichElement.h"
+#include "dfont/dfont_atlas.h"
+
+#include <set>
+#include <algorithm>
 
 NS_CC_EXT_BEGIN;
 
+// dropped log height before the blocks are moved up, positions are shorts
+static const short c_log_rebase_height = 8192;
+
 IRichParser* CCRichNode::getParser()
 {
 	return m_rParser;
@@ -42,7 +50,10 @@ IRichCompositor* CCRichNode::getCompositor()
 
 RSize CCRichNode::getActualSize()
 {
-	return getCompositor()->getRect().size;
+	// dropped log blocks are above the top
+	RSize size = getCompositor()->getRect().size;
+	size.h -= m_rLogShift;
+	return size;
 }
 
 RSize CCRichNode::getPreferredSize()
@@ -55,7 +66,7 @@ void CCRichNode::setPreferredSize(RSize size)
 	if ( size.w != m_rPreferedSize.w || size.h != m_rPreferedSize.h )
 	{
 		m_rPreferedSize = size; 
-		updateAll();
+		updateLayout();
 	}
 }
 
@@ -69,7 +80,7 @@ void CCRichNode::setDefaultFontAlias(const char* font_alias)
 	if ( getCompositor()->getRenderState()->font_alias != font_alias )
 	{
 		getCompositor()->getRenderState()->font_alias = font_alias;
-		updateAll();
+		updateLayout();
 	}
 }
 
@@ -80,7 +91,7 @@ void CCRichNode::setDefaultColor(unsigned int color)
 	if ( getCompositor()->getRenderState()->color != color )
 	{
 		getCompositor()->getRenderState()->color = color;
-		updateAll();
+		updateColor();
 	}
 }
 
@@ -99,7 +110,7 @@ void CCRichNode::setDefaultAlignment(EAlignment align)
 	if ( getCompositor()->getRootCache()->getHAlign() != align )
 	{
 		getCompositor()->getRootCache()->setHAlign(align);
-		updateAll();
+		updateLayout();
 	}
 }
 
@@ -113,7 +124,7 @@ void CCRichNode::setDefaultWrapline(bool wrapline)
 	if ( getCompositor()->getRootCache()->isWrapline() != wrapline )
 	{
 		getCompositor()->getRootCache()->setWrapline(wrapline);
-		updateAll();
+		updateLayout();
 	}
 }
 
@@ -127,7 +138,7 @@ void CCRichNode::setDefaultSpacing(short spacing)
 	if ( getCompositor()->getRootCache()->getSpacing() != spacing )
 	{
 		getCompositor()->getRootCache()->setSpacing(spacing);
-		updateAll();
+		updateLayout();
 	}
 }
 
@@ -141,12 +152,13 @@ void CCRichNode::setDefaultPadding(short padding)
 	if ( getCompositor()->getRootCache()->getPadding() != padding )
 	{
 		getCompositor()->getRootCache()->setPadding(padding);
-		updateAll();
+		updateLayout();
 	}
 }
 
 void CCRichNode::setStringUTF8(const char* utf8_str)
 {
+	clearStates();
 	m_rRichString = utf8_str;
 	updateAll();
 }
@@ -162,9 +174,18 @@ const char* CCRichNode::getStringUTF8()
 	return m_rRichString.c_str();
 }
 
-IRichAtlas* CCRichNode::findAtlas(class CCTexture2D* texture, unsigned int color_rgba, int zorder /*= 0*/)
+IRichAtlas* CCRichNode::findAtlas(class CCTexture2D* texture, int zorder /*= 0*/)
 {
-	return findColoredTextureAtlas(texture, color_rgba, zorder);
+	return findTextureAtlas(texture, zorder);
+}
+
+IRichAtlas* CCRichNode::findGlyphAtlas(class CCTexture2D* texture, class dfont::FontCatalog* font)
+{
+	if ( font && font->sdf_effect() )
+	{
+		return findTextureAtlas(texture, ZORDER_CONTEXT, font);
+	}
+	return findTextureAtlas(texture, ZORDER_CONTEXT);
 }
 
 void CCRichNode::addOverlay(IRichElement* overlay)
@@ -175,6 +196,12 @@ void CCRichNode::addOverlay(IRichElement* overlay)
 void CCRichNode::addCCNode(class CCNode* node)
 {
 	getOverlay()->addChild(node);
+
+	// removed with the block when it is dropped from the log
+	if ( m_rRenderBlock )
+	{
+		m_rRenderBlock->nodes.push_back(node);
+	}
 }
 
 void CCRichNode::removeCCNode(class CCNode* node)
@@ -208,22 +235,356 @@ void CCRichNode::processRichString(const char* utf8_str)
 	if ( !eles )
 		return;
 
+	RLogBlock block;
+	block.elements = eles->size();
+	block.length = strlen(utf8_str);
+	block.top = getCompositor()->getMetricsState()->pen_y;
+	block.visible = true;
+
 	for ( element_list_t::iterator it = eles->begin(); it != eles->end(); it++ )
 	{
 		getCompositor()->composit(*it);
 	}
 
 	m_rElements.insert(m_rElements.end(), eles->begin(), eles->end());
+	m_rLogBlocks.push_back(block);
 	CC_SAFE_DELETE(eles);
 
+	m_rPendingGlyphs = dfont::FontFactory::instance()->pending_count() > 0;
+	m_rRenderDirty = true;
+
+	if ( m_rLogMaxBlocks > 0 && m_rLogBlocks.size() > m_rLogMaxBlocks )
+	{
+		dropLogBlocks(m_rLogBlocks.size() - m_rLogMaxBlocks);
+	}
+	else if ( m_rLogViewport.size.h != 0 )
+	{
+		updateViewport(false);
+	}
+
 	updateContentSize();
 }
 
 void CCRichNode::updateAll()
 {
+	// a log is parsed again block by block, a set string is one block
+	std::vector<size_t> lengths;
+	for ( std::deque<RLogBlock>::iterator bit = m_rLogBlocks.begin(); bit != m_rLogBlocks.end(); bit++ )
+	{
+		lengths.push_back(bit->length);
+	}
+	if ( lengths.empty() )
+	{
+		lengths.push_back(m_rRichString.size());
+	}
+
+	std::string rich_string = m_rRichString;
 	clearStates();
-	if ( !m_rRichString.empty() )
-		processRichString(m_rRichString.c_str());
+
+	size_t pos = 0;
+	for ( size_t i = 0; i < lengths.size() && pos < rich_string.size(); i++ )
+	{
+		processRichString(rich_string.substr(pos, lengths[i]).c_str());
+		pos += lengths[i];
+	}
+}
+
+void CCRichNode::updateLayout()
+{
+	m_rPendingGlyphs = false;
+	getCompositor()->reset();
+	m_rLogShift = 0;
+	clearAtlasMap();
+
+	// touchables are added again by composit
+	if (m_rOverlays)
+	{
+		m_rOverlays->reset();
+	}
+	clearLogNodes();
+
+	size_t index = 0;
+	for ( std::deque<RLogBlock>::iterator bit = m_rLogBlocks.begin(); bit != m_rLogBlocks.end(); bit++ )
+	{
+		bit->top = getCompositor()->getMetricsState()->pen_y;
+		bit->pending.clear();
+
+		for ( size_t i = index; i < index + bit->elements; i++ )
+		{
+			m_rElements[i]->resetComposit();
+			getCompositor()->composit(m_rElements[i]);
+
+			// blocks out of the viewport only keep the metrics
+			if ( !bit->visible )
+			{
+				m_rElements[i]->resetRender(false);
+			}
+		}
+		index += bit->elements;
+	}
+
+	m_rPendingGlyphs = dfont::FontFactory::instance()->pending_count() > 0;
+	m_rRenderDirty = true;
+
+	// blocks moved in or out by the new layout
+	if ( m_rLogViewport.size.h != 0 )
+	{
+		updateViewport(false);
+	}
+
+	updateContentSize();
+}
+
+void CCRichNode::updateColor()
+{
+	clearAtlasMap();
+
+	// keep touchables, layout is not changed
+	if (m_rOverlays)
+	{
+		m_rOverlays->removeAllChildren();
+	}
+	clearLogNodes();
+
+	unsigned int color = getDefaultColor();
+	for ( element_list_t::iterator it = m_rElements.begin(); it != m_rElements.end(); it++ )
+	{
+		(*it)->resetColor(color);
+	}
+
+	m_rRenderDirty = true;
+}
+
+static void collectPendingGlyphs(IRichElement* element, std::vector<REleGlyph*>* glyphs)
+{
+	REleGlyph* glyph = dynamic_cast<REleGlyph*>(element);
+	if ( glyph && glyph->isTexturePending() )
+	{
+		glyphs->push_back(glyph);
+	}
+
+	element_list_t* children = element->getChildren();
+	if ( children )
+	{
+		for ( element_list_t::iterator it = children->begin(); it != children->end(); it++ )
+		{
+			collectPendingGlyphs(*it, glyphs);
+		}
+	}
+}
+
+void CCRichNode::updateViewport(bool rebuild)
+{
+	// viewport in element space, y is 0 at the content top
+	short content_h = getCompositor()->getRect().size.h;
+	short view_top = m_rLogViewport.max_y() - content_h;
+	short view_bottom = m_rLogViewport.min_y() - content_h;
+
+	std::vector<bool> visible(m_rLogBlocks.size());
+	std::vector<bool> leaving(m_rLogBlocks.size());
+	bool left = false;
+	for ( size_t i = 0; i < m_rLogBlocks.size(); i++ )
+	{
+		short bottom = i + 1 < m_rLogBlocks.size() ? m_rLogBlocks[i + 1].top : -content_h;
+		visible[i] = m_rLogViewport.size.h == 0 
+			|| ( m_rLogBlocks[i].top > view_bottom && bottom < view_top );
+
+		leaving[i] = m_rLogBlocks[i].visible && !visible[i];
+		left = left || leaving[i];
+	}
+
+	// a rebuild writes every visible block again, otherwise only the leaving blocks are removed
+	if ( rebuild )
+	{
+		clearAtlasMap();
+		if (m_rOverlays)
+		{
+			m_rOverlays->removeAllChildren();
+		}
+		clearLogNodes();
+	}
+	else if ( left )
+	{
+		unrenderLogBlocks(leaving);
+	}
+
+	size_t index = 0;
+	for ( size_t i = 0; i < m_rLogBlocks.size(); i++ )
+	{
+		RLogBlock& block = m_rLogBlocks[i];
+		if ( block.visible != visible[i] || ( rebuild && visible[i] ) )
+		{
+			block.pending.clear();
+			for ( size_t j = index; j < index + block.elements; j++ )
+			{
+				m_rElements[j]->resetRender(visible[i]);
+
+				// metrics are kept, glyphs still rasterizing only wait for their textures
+				if ( visible[i] )
+				{
+					collectPendingGlyphs(m_rElements[j], &block.pending);
+				}
+			}
+			block.visible = visible[i];
+		}
+		index += block.elements;
+	}
+
+	// materialized glyphs may be rasterized now
+	dfont::FontFactory::instance()->atlas()->flush();
+	m_rRenderDirty = true;
+}
+
+static void collectElements(IRichElement* element, std::set<IRichElement*>* elements)
+{
+	elements->insert(element);
+
+	element_list_t* children = element->getChildren();
+	if ( children )
+	{
+		for ( element_list_t::iterator it = children->begin(); it != children->end(); it++ )
+		{
+			collectElements(*it, elements);
+		}
+	}
+}
+
+void CCRichNode::dropLogBlocks(size_t count)
+{
+	size_t elements = 0;
+	size_t length = 0;
+	for ( size_t i = 0; i < count; i++ )
+	{
+		elements += m_rLogBlocks[i].elements;
+		length += m_rLogBlocks[i].length;
+	}
+
+	// left elements keep their positions, the node is moved up by updateContentSize
+	short bottom = count < m_rLogBlocks.size() ? m_rLogBlocks[count].top : getCompositor()->getMetricsState()->pen_y;
+	m_rLogShift += m_rLogBlocks.front().top - bottom;
+
+	// only the quads, nodes and touchables of the dropped elements are removed
+	std::vector<bool> dropped(m_rLogBlocks.size(), false);
+	std::fill(dropped.begin(), dropped.begin() + count, true);
+	unrenderLogBlocks(dropped);
+
+	for ( size_t i = 0; i < elements; i++ )
+	{
+		if (m_rOverlays)
+		{
+			m_rOverlays->remove(m_rElements[i]);
+		}
+		delete m_rElements[i];
+	}
+	m_rElements.erase(m_rElements.begin(), m_rElements.begin() + elements);
+	m_rLogBlocks.erase(m_rLogBlocks.begin(), m_rLogBlocks.begin() + count);
+	m_rRichString.erase(0, length);
+	m_rRenderDirty = true;
+
+	// positions are shorts, move the blocks up once in a while
+	if ( m_rLogShift > c_log_rebase_height )
+	{
+		rebaseLog();
+	}
+	else if ( m_rLogViewport.size.h != 0 )
+	{
+		updateViewport(false);
+	}
+}
+
+void CCRichNode::rebaseLog()
+{
+	short shift = m_rLogShift;
+	m_rLogShift = 0;
+
+	for ( element_list_t::iterator it = m_rElements.begin(); it != m_rElements.end(); it++ )
+	{
+		(*it)->setLocalPositionY((*it)->getLocalPosition().y + shift);
+	}
+	for ( std::deque<RLogBlock>::iterator bit = m_rLogBlocks.begin(); bit != m_rLogBlocks.end(); bit++ )
+	{
+		bit->top += shift;
+	}
+	getCompositor()->getMetricsState()->pen_y += shift;
+
+	RRect rect = getCompositor()->getRect();
+	rect.size.h = RMAX(0, rect.size.h - shift);
+	getCompositor()->setRect(rect);
+
+	// quads and nodes are written at the new positions
+	updateViewport(true);
+}
+
+void CCRichNode::unrenderLogBlocks(const std::vector<bool>& blocks)
+{
+	std::set<IRichElement*> elements;
+	size_t index = 0;
+	for ( size_t i = 0; i < m_rLogBlocks.size(); i++ )
+	{
+		RLogBlock& block = m_rLogBlocks[i];
+		if ( blocks[i] )
+		{
+			for ( size_t j = index; j < index + block.elements; j++ )
+			{
+				collectElements(m_rElements[j], &elements);
+			}
+			for ( size_t j = 0; j < block.nodes.size(); j++ )
+			{
+				removeCCNode(block.nodes[j]);
+			}
+			block.nodes.clear();
+			block.pending.clear();
+		}
+		index += block.elements;
+	}
+
+	// quads of the other elements are kept
+	if ( !elements.empty() )
+	{
+		for ( std::vector<CCRichAtlas*>::iterator it = m_rAtlasList.begin(); it != m_rAtlasList.end(); it++ )
+		{
+			(*it)->removeRichElements(elements);
+		}
+	}
+}
+
+void CCRichNode::clearLogNodes()
+{
+	for ( std::deque<RLogBlock>::iterator bit = m_rLogBlocks.begin(); bit != m_rLogBlocks.end(); bit++ )
+	{
+		bit->nodes.clear();
+	}
+}
+
+void CCRichNode::setLogMaxBlocks(size_t max_blocks)
+{
+	m_rLogMaxBlocks = max_blocks;
+
+	if ( m_rLogMaxBlocks > 0 && m_rLogBlocks.size() > m_rLogMaxBlocks )
+	{
+		dropLogBlocks(m_rLogBlocks.size() - m_rLogMaxBlocks);
+		updateContentSize();
+	}
+}
+
+size_t CCRichNode::getLogMaxBlocks()
+{
+	return m_rLogMaxBlocks;
+}
+
+void CCRichNode::setLogViewport(RRect viewport)
+{
+	if ( viewport.pos.x != m_rLogViewport.pos.x || viewport.pos.y != m_rLogViewport.pos.y
+		|| viewport.size.w != m_rLogViewport.size.w || viewport.size.h != m_rLogViewport.size.h )
+	{
+		m_rLogViewport = viewport;
+		updateViewport(false);
+	}
+}
+
+RRect CCRichNode::getLogViewport()
+{
+	return m_rLogViewport;
 }
 
 void CCRichNode::updateContentSize()
@@ -231,15 +592,18 @@ void CCRichNode::updateContentSize()
 	if ( m_rContainer )
 	{
 		RRect rect = getCompositor()->getRect();
-		m_rContainer->setContentSize(CCSize(/*m_rPreferedSize.w*/rect.size.w, rect.size.h));
+		m_rContainer->setContentSize(CCSize(/*m_rPreferedSize.w*/rect.size.w, rect.size.h - m_rLogShift));
 		setPositionY(rect.size.h);
 	}
 }
 
 void CCRichNode::clearStates()
 {
+	m_rPendingGlyphs = false;
 	getCompositor()->reset();
 	clearRichElements();
+	m_rLogBlocks.clear();
+	m_rLogShift = 0;
 
 	// clear atlas
 	clearAtlasMap();
@@ -263,18 +627,23 @@ void CCRichNode::clearRichElements()
 	m_rElements.clear();
 }
 
+void CCRichNode::clearAtlasMap(atlas_map_t& atlas_map)
+{
+	for ( atlas_map_t::iterator atlas_it = atlas_map.begin(); atlas_it != atlas_map.end(); atlas_it++ )
+	{
+		CC_SAFE_RELEASE(atlas_it->second);
+	}
+	atlas_map.clear();
+}
+
 void CCRichNode::clearAtlasMap()
 {
-	for ( color_map_t::iterator color_it = m_rAtlasMap.begin(); color_it != m_rAtlasMap.end(); color_it++ )
+	clearAtlasMap(m_rAtlasMap);
+	for ( sdf_font_map_t::iterator font_it = m_rSDFAtlasMap.begin(); font_it != m_rSDFAtlasMap.end(); font_it++ )
 	{
-		for ( atlas_map_t::iterator atlas_it = color_it->second->begin(); atlas_it != color_it->second->end(); atlas_it++ )
-		{
-			CC_SAFE_RELEASE(atlas_it->second);
-		}
-		color_it->second->clear();
-		delete color_it->second;
+		clearAtlasMap(font_it->second);
 	}
-	m_rAtlasMap.clear();
+	m_rSDFAtlasMap.clear();
 
 	for ( std::vector<CCRichAtlas*>::iterator it = m_rAtlasList.begin(); it != m_rAtlasList.end(); it++ )
 	{
@@ -285,33 +654,24 @@ void CCRichNode::clearAtlasMap()
 	m_rAtlasList.clear();
 }
 
-CCRichAtlas* CCRichNode::findColoredTextureAtlas(CCTexture2D* texture, unsigned int color_rgba, int zorder)
+CCRichAtlas* CCRichNode::findTextureAtlas(CCTexture2D* texture, int zorder, dfont::FontCatalog* sdf_font /*= NULL*/)
 {
-	if ( texture == NULL || color_rgba == 0 )
+	if ( texture == NULL )
 	{
-		return false;
+		return NULL;
 	}
 
-	atlas_map_t* atlas_map = NULL;
-	color_map_t::iterator cit = m_rAtlasMap.find(color_rgba);
-	if ( cit == m_rAtlasMap.end() )
-	{
-		atlas_map = new atlas_map_t;
-		m_rAtlasMap.insert(std::make_pair(color_rgba, atlas_map));
-	}
-	else
-	{
-		atlas_map = cit->second;
-	}
+	atlas_map_t* atlas_map = sdf_font ? &m_rSDFAtlasMap[sdf_font] : &m_rAtlasMap;
 
 	CCRichAtlas* atlas = NULL;
 	atlas_map_t::iterator ait = atlas_map->find(texture);
 	if ( ait == atlas_map->end() )
 	{
 		atlas = CCRichAtlas::create(this, texture, m_rElements.size());
-		cocos2d::ccColor3B color = ccc3( color_rgba & 0xff, color_rgba >> 8 & 0xff, color_rgba >> 16 & 0xff);
-		atlas->setColor(color);
-		atlas->setOpacity(color_rgba >> 24 & 0xff);
+		if ( sdf_font )
+		{
+			atlas->setSDFEffect(sdf_font->sdf_effect());
+		}
 
 		atlas->retain();
 		atlas_map->insert(std::make_pair(texture, atlas));
@@ -330,14 +690,57 @@ CCRichAtlas* CCRichNode::findColoredTextureAtlas(CCTexture2D* texture, unsigned
 
 void CCRichNode::draw()
 {
+	// async glyphs are ready, composit again with their metrics
+	if ( m_rPendingGlyphs && dfont::FontFactory::instance()->pending_count() == 0 )
+	{
+		updateLayout();
+	}
+
+	// glyphs shown again by the viewport, failed ones are left out when rasterizing is done
+	bool rasterizing = dfont::FontFactory::instance()->pending_count() > 0;
+	for ( std::deque<RLogBlock>::iterator bit = m_rLogBlocks.begin(); bit != m_rLogBlocks.end(); bit++ )
+	{
+		for ( size_t i = 0; i < bit->pending.size(); )
+		{
+			if ( bit->pending[i]->updateTexture() || !rasterizing )
+			{
+				bit->pending[i] = bit->pending.back();
+				bit->pending.pop_back();
+				m_rRenderDirty = true;
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	// atlases and overlay nodes keep the rendered elements until the next change
+#if !CCRICH_DEBUG
+	if ( !m_rRenderDirty )
+		return;
+#endif
+	m_rRenderDirty = false;
+
 	RRichCanvas canvas;
 	canvas.root = this;
 	canvas.rect/*.size*/ = getCompositor()->getRect()/*.size*/;
 
-	for ( element_list_t::iterator it = m_rElements.begin(); it != m_rElements.end(); it++ )
+	// blocks out of the log viewport hold no glyphs
+	size_t index = 0;
+	for ( std::deque<RLogBlock>::iterator bit = m_rLogBlocks.begin(); bit != m_rLogBlocks.end(); bit++ )
 	{
-		(*it)->render(canvas);
+		if ( bit->visible )
+		{
+			m_rRenderBlock = &(*bit);
+			for ( size_t i = index; i < index + bit->elements; i++ )
+			{
+				m_rElements[i]->render(canvas);
+			}
+		}
+		index += bit->elements;
 	}
+	m_rRenderBlock = NULL;
 }
 
 void CCRichNode::setPlainMode(bool on) 
@@ -356,6 +759,12 @@ CCRichNode::CCRichNode(class CCNode* container)
 , m_rParser(NULL)
 , m_rCompositor(NULL)
 , m_rOverlays(NULL)
+, m_rPendingGlyphs(false)
+, m_rRenderDirty(false)
+, m_rLogMaxBlocks(0)
+, m_rLogViewport()
+, m_rLogShift(0)
+, m_rRenderBlock(NULL)
 {
 }
 
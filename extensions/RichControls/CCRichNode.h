@@ -27,6 +27,8 @@
 
 #include "CCRichProtocols.h"
 
+#include <deque>
+
 NS_CC_EXT_BEGIN;
 
 //
@@ -37,8 +39,19 @@ class CCRichNode: public CCNode, public IRichNode
 public:
 	// map: texture - rich atlas
 	typedef std::map<CCTexture2D*, class CCRichAtlas*> atlas_map_t;
-	// map: color - atlas_map_t
-	typedef std::map<unsigned int, atlas_map_t*> color_map_t;
+	// map: distance field font - atlas_map_t
+	typedef std::map<dfont::FontCatalog*, atlas_map_t> sdf_font_map_t;
+
+	// a parsed string, appended strings are blocks of a log
+	struct RLogBlock
+	{
+		size_t elements;	// top level elements in m_rElements
+		size_t length;		// bytes in m_rRichString
+		short top;			// pen y before composit
+		bool visible;		// in the viewport, holds glyph slots and quads
+		std::vector<class CCNode*> nodes;	// overlay nodes added by its elements
+		std::vector<class REleGlyph*> pending;	// materialized glyphs waiting for their textures
+	};
 
 public:
 	//
@@ -54,7 +67,8 @@ public:
 	virtual void setStringUTF8(const char* utf8_str);
 	virtual void appendStringUTF8(const char* utf8_str);
 	virtual const char* getStringUTF8();
-	virtual IRichAtlas* findAtlas(class CCTexture2D* texture, unsigned int color_rgba, int zorder = ZORDER_CONTEXT);
+	virtual IRichAtlas* findAtlas(class CCTexture2D* texture, int zorder = ZORDER_CONTEXT);
+	virtual IRichAtlas* findGlyphAtlas(class CCTexture2D* texture, class dfont::FontCatalog* font);
 	virtual void addOverlay(IRichElement* overlay);
 	virtual void addCCNode(class CCNode* node);
 	virtual void removeCCNode(class CCNode* node);
@@ -84,6 +98,13 @@ public:
 	virtual short getDefaultPadding();
 	virtual void setDefaultPadding(short padding);
 
+	// log mode: blocks over the max are dropped from the top, 0 keeps all
+	virtual void setLogMaxBlocks(size_t max_blocks);
+	virtual size_t getLogMaxBlocks();
+	// log mode: container rect, only blocks inside hold glyphs, zero height for all
+	virtual void setLogViewport(RRect viewport);
+	virtual RRect getLogViewport();
+
 	virtual bool initialize() = 0;
 
 	CCRichNode(class CCNode* container);
@@ -91,12 +112,20 @@ public:
 
 private:
 	void processRichString(const char* utf8_str);
-	void updateAll();
+	void updateAll();		// parse and composit the rich string again
+	void updateLayout();	// composit the parsed elements again
+	void updateColor();		// render the composited elements again
+	void updateViewport(bool rebuild);	// materialize blocks in the viewport
+	void dropLogBlocks(size_t count);
+	void rebaseLog();		// move the blocks to the top after drops
+	void unrenderLogBlocks(const std::vector<bool>& blocks);	// quads and overlay nodes of the blocks
+	void clearLogNodes();	// overlay children are removed
 	void updateContentSize();
 	void clearStates();
 	void clearRichElements();
 	void clearAtlasMap();
-	class CCRichAtlas* findColoredTextureAtlas(CCTexture2D* texture, unsigned int color_rgba, int zorder);
+	void clearAtlasMap(atlas_map_t& atlas_map);
+	class CCRichAtlas* findTextureAtlas(CCTexture2D* texture, int zorder, dfont::FontCatalog* sdf_font = NULL);
 
 protected:
 	class CCNode* m_rContainer;
@@ -109,9 +138,19 @@ protected:
 
 	RSize m_rPreferedSize;
 
-	color_map_t m_rAtlasMap;
+	atlas_map_t m_rAtlasMap;
+	sdf_font_map_t m_rSDFAtlasMap;
 	std::vector<class CCRichAtlas*> m_rAtlasList;
 	class CCRichOverlay* m_rOverlays;
+
+	bool m_rPendingGlyphs;	// composited with glyphs still rasterizing
+	bool m_rRenderDirty;	// elements need render to atlases and overlays
+
+	std::deque<RLogBlock> m_rLogBlocks;
+	size_t m_rLogMaxBlocks;
+	RRect m_rLogViewport;
+	short m_rLogShift;			// height of the dropped blocks above the first one
+	RLogBlock* m_rRenderBlock;	// block being rendered, its overlay nodes are recorded
 };
 
 //
@@ -82,6 +82,32 @@ void CCRichOverlay::reset()
 	m_touched = NULL;
 }
 
+void CCRichOverlay::remove(IRichElement* root)
+{
+	std::list<REleHTMLTouchable*>::iterator it = m_touchables.begin();
+	while ( it != m_touchables.end() )
+	{
+		IRichElement* top = *it;
+		while ( top->getParent() )
+		{
+			top = top->getParent();
+		}
+
+		if ( top == root )
+		{
+			if ( m_touched == *it )
+			{
+				m_touched = NULL;
+			}
+			it = m_touchables.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
 IRichNode* CCRichOverlay::getContainer()
 {
 	CCAssert(getParent(), "");
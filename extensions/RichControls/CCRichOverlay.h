@@ -37,6 +37,8 @@ public:
 	virtual bool init();
 	virtual void append(class IRichElement* ele);
 	virtual void reset();
+	// remove touchables in the tree of a top level element
+	virtual void remove(class IRichElement* root);
 
 	// from CCLayer
 	virtual void draw();
@@ -24,6 +24,7 @@
  ****************************************************************************/
 #include "CCRichParser.h"
 #include "CCRichElement.h"
+#include "dfont/dfont_utf8.h"
 
 #include <stack>
 
@@ -204,15 +205,12 @@ void RSimpleHTMLParser::textHandler(void *ctx, const char *s, int len)
 
 	CCAssert(m_rCurrentElement, "[CCRich]: must specify a parent element!");
 
-	unsigned short* utf16str = cc_utf8_to_utf16(s);
-	size_t utf16size = cc_wcslen(utf16str);
-
-	if ( utf16size == 0 )
-		return;
-
-	for ( size_t i = 0; i < utf16size; i++ )
+	// s is not terminated, decode [s, s+len) in place
+	dfont::Utf8Decoder decoder(s, s + len);
+	unsigned long code;
+	while ( decoder.next(&code) )
 	{
-		REleGlyph* ele = new REleGlyph(utf16str[i]);
+		REleGlyph* ele = new REleGlyph(code);
 		if ( ele->parse(this) )
 		{
 			m_rCurrentElement->addChildren(ele);
@@ -222,8 +220,6 @@ void RSimpleHTMLParser::textHandler(void *ctx, const char *s, int len)
 			CC_SAFE_DELETE(ele);
 		}
 	}
-
-	CC_SAFE_DELETE_ARRAY(utf16str);
 }
 
 RSimpleHTMLParser::RSimpleHTMLParser(IRichNode* container)
@@ -595,7 +591,7 @@ int cc_transfer_phrase(unsigned short* start, unsigned short* end, IRichElement*
 		if ( cnt > 0 )
 		{
 			consumed += cnt;
-			element = new REleGlyph( (unsigned short)integer );
+			element = new REleGlyph( (unsigned int)integer );
 		}
 		else
 		{
@@ -165,6 +165,9 @@ struct RMetrics
 {
 	RRect rect;
 	RPos advance;
+	int advance_26dot6;	// advance.x before rounding, 0 if not positioned at subpixels
+
+	RMetrics(): advance_26dot6(0) {}
 };
 
 // metrics of textures
@@ -181,8 +184,9 @@ struct RTexture
 
 	inline void setTexture(CCTexture2D* _texture)
 	{
+		CC_SAFE_RETAIN(_texture);
+		CC_SAFE_RELEASE(texture);
 		texture = _texture;
-		texture->retain();
 	}
 
 	inline CCTexture2D* getTexture()
@@ -242,6 +246,12 @@ public:
 	virtual bool composit(class IRichCompositor* compositor) = 0;
 	// for renderer
 	virtual void render(RRichCanvas canvas) = 0;
+	// drop composit results, parsed attributes are kept to composit again
+	virtual void resetComposit() = 0;
+	// default color changed, render again without composit
+	virtual void resetColor(unsigned int default_color) = 0;
+	// render again, glyph slots are released if not materialized and required again if materialized
+	virtual void resetRender(bool materialized) = 0;
 
 	/**
 	 * state stack control
@@ -262,6 +272,7 @@ public:
 	
 	virtual RMetrics* getMetrics() = 0;		// element metrics
 	virtual bool scaleToElementSize() = 0;  // if texture is scale to element size
+	virtual float getTextureScale() = 0;	// texture size scale if not scale to element size
 
 
 	/**
@@ -280,6 +291,8 @@ public:
 	virtual bool isNewlineBefore() = 0;
 	virtual bool isNewlineFollow() = 0;
 	virtual short getBaseline() = 0;		// position of baseline, min y
+	virtual short getKerning(IRichElement* prev) = 0; // pen offset after the previous element in line
+	virtual void setSubpixelOffset(int offset) = 0; // pen x below a pixel in 26.6, before metrics are read
 	virtual bool needBaselineCorrect() = 0; // for line cached composit, TODO: according to alignment
 
 	virtual void onCachedCompositBegin(class ICompositCache* cache, RPos& pen) = 0;
@@ -345,10 +358,11 @@ struct RMetricsState
 struct RRenderState
 {
 	unsigned int color;
+	bool default_color;	// color is not specified by elements
 	const char* font_alias;
 
 	RRenderState()
-		: color(0xffffffff), font_alias(DFONT_DEFAULT_FONTALIAS)
+		: color(0xffffffff), default_color(true), font_alias(DFONT_DEFAULT_FONTALIAS)
 	{
 
 	}
@@ -368,6 +382,7 @@ public:
 
 	// get rect
 	virtual const RRect& getRect() const = 0;
+	virtual void setRect(const RRect& rect) = 0;
 
 	// reset all state & cached data
 	virtual void reset() = 0;
@@ -469,8 +484,10 @@ public:
 	virtual void addCCNode(class CCNode* node) = 0;
 	virtual void removeCCNode(class CCNode* node) = 0;
 
-	// batch utility
-	virtual IRichAtlas* findAtlas(class CCTexture2D* texture, unsigned int color_rgba, int zorder = ZORDER_CONTEXT) = 0;
+	// batch utility, one atlas per texture, colors are per element
+	virtual IRichAtlas* findAtlas(class CCTexture2D* texture, int zorder = ZORDER_CONTEXT) = 0;
+	// distance field fonts draw in their own atlases
+	virtual IRichAtlas* findGlyphAtlas(class CCTexture2D* texture, class dfont::FontCatalog* font) = 0;
 };
 
 //
@@ -0,0 +1,791 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+//
+// headless dfont benchmark, textures go to a RecordingTextureBackend
+//	- every font, size and style runs on its own atlas
+//	- latency: distinct chars of the corpus are rasterized at once for raster throughput,
+//	  then the corpus is required line by line on a new atlas, once cold and rounds times warm
+//	- pack: glyphs per page of the shelf packer and of the fixed grid it replaced
+//	- frag: the packer after glyphs are freed in the middle of a page
+//	- lru: a chat log is replayed with few pages, glyphs rasterized again after eviction are counted
+//
+#include "dfont/dfont_manager.h"
+#include "dfont/dfont_render.h"
+#include "dfont/dfont_atlas.h"
+#include "dfont/dfont_packer.h"
+#include "dfont/dfont_utility.h"
+#include "dfont/dfont_utf8.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+
+using namespace dfont;
+
+static const char* c_default_corpus =
+	"The quick brown fox jumps over the lazy dog. 0123456789\n"
+	"Sphinx of black quartz, judge my vow! (item #42: 3 x 19.99 = 59.97)\n"
+	"Franz jagt im komplett verwahrlosten Taxi quer durch Bayern. Über Größe.\n"
+	"Voix ambiguë d'un cœur qui, au zéphyr, préfère les jattes de kiwis.\n"
+	"Съешь же ещё этих мягких французских булок, да выпей чаю.\n"
+	"Ξεσκεπάζω την ψυχοφθόρα βδελυγμία.\n"
+	"[12:04:31] <player_01> gg wp, see you at the next match!\n";
+
+struct BenchConfig
+{
+	std::string font;
+	int size;
+	EFontStyle style;
+};
+
+struct BenchResult
+{
+	double raster_ms;
+	size_t raster_count;
+	std::vector<double> cold_us;
+	std::vector<double> warm_us;
+	CatalogStats stats;
+	size_t upload_calls;
+	size_t upload_bytes;
+};
+
+typedef std::vector<std::pair<const char*, const char*> > line_list_t;
+
+static void split_lines(const std::string& text, line_list_t* lines)
+{
+	const char* p = text.data();
+	const char* end = p + text.size();
+	while ( p < end )
+	{
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		if ( !eol )
+			eol = end;
+		if ( eol > p )
+			lines->push_back(std::make_pair(p, eol));
+		p = eol + 1;
+	}
+}
+
+// distinct chars in order of appearance
+static void distinct_chars(const std::string& text, std::vector<utf32>* chars)
+{
+	std::set<utf32> seen;
+	Utf8Decoder decoder(text.data(), text.data() + text.size());
+	unsigned long code;
+	while ( decoder.next(&code) )
+	{
+		if ( code != '\n' && seen.insert(code).second )
+			chars->push_back(code);
+	}
+}
+
+static const char* style_name(EFontStyle style)
+{
+	switch (style)
+	{
+	case e_plain:		return "plain";
+	case e_strengthen:	return "strengthen";
+	case e_border:		return "border";
+	case e_shadow:		return "shadow";
+	}
+	return "?";
+}
+
+static bool parse_style(const std::string& name, EFontStyle* style)
+{
+	static const EFontStyle styles[] = { e_plain, e_strengthen, e_border, e_shadow };
+	for ( size_t i = 0; i < sizeof(styles) / sizeof(styles[0]); i++ )
+	{
+		if ( name == style_name(styles[i]) )
+		{
+			*style = styles[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+static void split(const std::string& s, std::vector<std::string>* items)
+{
+	size_t start = 0;
+	while ( start <= s.size() )
+	{
+		size_t end = s.find(',', start);
+		if ( end == std::string::npos )
+			end = s.size();
+		if ( end > start )
+			items->push_back(s.substr(start, end - start));
+		start = end + 1;
+	}
+}
+
+static double percentile(std::vector<double> values, double q)
+{
+	if ( values.empty() )
+		return 0.0;
+
+	std::sort(values.begin(), values.end());
+	size_t i = (size_t)(q * values.size());
+	return values[i < values.size() ? i : values.size() - 1];
+}
+
+static void require_lines(FontCatalog* catalog, const line_list_t& lines, std::vector<double>* latencies)
+{
+	std::vector<GlyphSlot*> slots;
+	for ( size_t i = 0; i < lines.size(); i++ )
+	{
+		slots.clear();
+		double start = now_ms();
+		catalog->require_text(lines[i].first, lines[i].second, &slots);
+		latencies->push_back((now_ms() - start) * 1000.0);
+
+		// a line is dropped before the next, its glyphs can be evicted
+		for ( size_t j = 0; j < slots.size(); j++ )
+		{
+			slots[j]->release();
+		}
+	}
+}
+
+static FontCatalog* new_catalog(FT_Library library, const BenchConfig& config, AtlasManager* atlas)
+{
+	FontInfo* font = FontInfo::create_font(library, full_path(config.font.c_str()).c_str(), 0, config.size, config.size, dfont_default_ppi);
+	if ( !font )
+	{
+		return NULL;
+	}
+	FontFactory::add_style_passes(font, config.style, 0xffffffff, 1.0f, 0xff000000);
+
+	return new FontCatalog(font, atlas);
+}
+
+static bool run(FT_Library library, const BenchConfig& config, const line_list_t& lines,
+	std::vector<utf32>& chars, int rounds, int page_size, int max_pages, BenchResult* result)
+{
+	RecordingTextureBackend backend;
+	WTexture2D::set_texture_backend(&backend);
+
+	// raster throughput, enough pages to hold all chars
+	{
+		AtlasManager atlas(page_size, page_size, 1024);
+		FontCatalog* catalog = new_catalog(library, config, &atlas);
+		if ( !catalog )
+		{
+			WTexture2D::set_texture_backend(NULL);
+			return false;
+		}
+
+		std::vector<GlyphSlot*> slots;
+		double start = now_ms();
+		catalog->require_text(&chars[0], chars.size(), &slots);
+		result->raster_ms = now_ms() - start;
+
+		CatalogStats stats;
+		catalog->stats(&stats);
+		result->raster_count = stats.raster_count;
+
+		for ( size_t i = 0; i < slots.size(); i++ )
+		{
+			slots[i]->release();
+		}
+
+		// pages are given back before the atlas
+		delete catalog;
+	}
+	backend.reset();
+
+	AtlasManager* atlas = new AtlasManager(page_size, page_size, max_pages);
+	atlas->set_pages_per_catalog(0);
+	FontCatalog* catalog = new_catalog(library, config, atlas);
+
+	require_lines(catalog, lines, &result->cold_us);
+
+	for ( int i = 0; i < rounds; i++ )
+	{
+		require_lines(catalog, lines, &result->warm_us);
+	}
+
+	catalog->stats(&result->stats);
+	result->upload_calls = backend.upload_calls();
+	result->upload_bytes = backend.upload_bytes();
+
+	delete catalog;
+	delete atlas;
+	WTexture2D::set_texture_backend(NULL);
+	return true;
+}
+
+static std::string base_name(const std::string& path)
+{
+	size_t slash = path.find_last_of("/\\");
+	return slash != std::string::npos ? path.substr(slash + 1) : path;
+}
+
+// deterministic numbers for generated glyphs and logs
+static unsigned int s_seed = 12345;
+
+static unsigned int next_random()
+{
+	s_seed = s_seed * 1103515245 + 12345;
+	return (s_seed >> 8) & 0xffffff;
+}
+
+// chars of the font in [first, last], at most max_count
+static void font_chars(FT_Library library, const std::string& font, utf32 first, utf32 last, size_t max_count, std::vector<utf32>* chars)
+{
+	FT_Face face;
+	if ( FT_New_Face(library, full_path(font.c_str()).c_str(), 0, &face) )
+		return;
+
+	FT_UInt index;
+	FT_ULong code = FT_Get_First_Char(face, &index);
+	while ( index != 0 && chars->size() < max_count )
+	{
+		if ( code >= first && code <= last )
+			chars->push_back(code);
+		code = FT_Get_Next_Char(face, code, &index);
+	}
+	FT_Done_Face(face);
+}
+
+typedef std::vector<std::pair<int, int> > size_list_t;
+
+static void glyph_sizes(FontInfo* font, const std::vector<utf32>& chars, size_list_t* sizes)
+{
+	for ( size_t i = 0; i < chars.size(); i++ )
+	{
+		GlyphBitmap bm;
+		if ( font->render_charcode(chars[i], &bm) && bm.bitmap )
+		{
+			sizes->push_back(std::make_pair(bm.bitmap->real_width(), bm.bitmap->real_height()));
+			bm.bitmap->release();
+		}
+	}
+}
+
+// font size and style extent in pixels
+static int em_pixels(FontInfo* font)
+{
+	FT_UInt size = font->char_width_pt() > font->char_height_pt() ? font->char_width_pt() : font->char_height_pt();
+	return (int)((size * font->ppi() + 71) / 72 + font->extend_pt());
+}
+
+// em boxes with some jitter, for fonts without ideographs
+static void synthetic_cjk_sizes(int em, size_t count, size_list_t* sizes)
+{
+	for ( size_t i = 0; i < count; i++ )
+	{
+		int w = em - (int)(next_random() % (em / 8 + 1));
+		int h = em - (int)(next_random() % (em / 8 + 1));
+		sizes->push_back(std::make_pair(w + DFONT_BITMAP_PADDING * 2, h + DFONT_BITMAP_PADDING * 2));
+	}
+}
+
+// glyphs of the list in turn until the page is full
+static int shelf_glyphs_per_page(const size_list_t& sizes, int page_size, float* fill)
+{
+	ShelfPacker packer(page_size, page_size);
+	PaddingRect rect;
+	int count = 0;
+	while ( packer.alloc(sizes[count % sizes.size()].first, sizes[count % sizes.size()].second, &rect) )
+	{
+		count++;
+	}
+	*fill = packer.occupancy();
+	return count;
+}
+
+static void run_pack(FT_Library library, const BenchConfig& config, int page_size)
+{
+	FontInfo* font = FontInfo::create_font(library, full_path(config.font.c_str()).c_str(), 0, config.size, config.size, dfont_default_ppi);
+	if ( !font )
+	{
+		fprintf(stderr, "dfont_bench: can not open %s\n", config.font.c_str());
+		return;
+	}
+	FontFactory::add_style_passes(font, config.style, 0xffffffff, 1.0f, 0xff000000);
+
+	std::vector<utf32> latin_chars;
+	std::vector<utf32> cjk_chars;
+	font_chars(library, config.font, 0x21, 0x7e, 256, &latin_chars);
+	font_chars(library, config.font, 0x4e00, 0x9fff, 3500, &cjk_chars);
+
+	size_list_t latin;
+	size_list_t cjk;
+	glyph_sizes(font, latin_chars, &latin);
+	glyph_sizes(font, cjk_chars, &cjk);
+
+	// the grid cut pages into em cells, see FontCatalog before the shelf packer
+	int em = em_pixels(font);
+	int cell = em + DFONT_BITMAP_PADDING * 2;
+	bool synthetic = cjk.size() < 256;
+	if ( synthetic )
+	{
+		cjk.clear();
+		synthetic_cjk_sizes(em, 3500, &cjk);
+	}
+	font->release();
+
+	// one ideograph for each latin glyph
+	size_list_t mixed;
+	for ( size_t i = 0; !latin.empty() && i < cjk.size(); i++ )
+	{
+		mixed.push_back(latin[i % latin.size()]);
+		mixed.push_back(cjk[i]);
+	}
+
+	const char* set_names[3] = { "latin", synthetic ? "cjk*" : "cjk", synthetic ? "mixed*" : "mixed" };
+	const size_list_t* sets[3] = { &latin, &cjk, &mixed };
+	int grid = (page_size / cell) * (page_size / cell);
+	for ( int i = 0; i < 3; i++ )
+	{
+		if ( sets[i]->empty() )
+			continue;
+
+		float fill = 0.0f;
+		int shelf = shelf_glyphs_per_page(*sets[i], page_size, &fill);
+		printf("%-24.24s %4d %-10s %-7s | %4d %6d | %6d %4.0f%% | %5.2fx\n",
+			base_name(config.font).c_str(), config.size, style_name(config.style), set_names[i],
+			cell, grid, shelf, fill * 100.0f, grid > 0 ? (float)shelf / grid : 0.0f);
+	}
+}
+
+// a page of 12x12 glyphs, all freed but the last one, then a 40x40 one
+static void run_frag_page()
+{
+	ShelfPacker packer(128, 128);
+	std::vector<PaddingRect> rects;
+	PaddingRect rect;
+	while ( packer.alloc(12, 12, &rect) )
+	{
+		rects.push_back(rect);
+	}
+	for ( size_t i = 0; i + 1 < rects.size(); i++ )
+	{
+		packer.free(rects[i]);
+	}
+	float fill = packer.occupancy();
+	bool fits = packer.alloc(40, 40, &rect);
+	printf("128x128 page, %u 12x12 glyphs, all but the last freed: fill %.1f%%, 40x40 %s\n",
+		(unsigned int)rects.size(), fill * 100.0f, fits ? "fits" : "failed");
+}
+
+// latin and em sized glyphs in turns of steps / 8 allocations, like a chat switching fonts,
+// half of the glyphs are freed at random when one fails
+static void run_frag(FT_Library library, const BenchConfig& config, int page_size, int steps)
+{
+	FontInfo* font = FontInfo::create_font(library, full_path(config.font.c_str()).c_str(), 0, config.size, config.size, dfont_default_ppi);
+	if ( !font )
+	{
+		fprintf(stderr, "dfont_bench: can not open %s\n", config.font.c_str());
+		return;
+	}
+	FontFactory::add_style_passes(font, config.style, 0xffffffff, 1.0f, 0xff000000);
+
+	std::vector<utf32> latin_chars;
+	font_chars(library, config.font, 0x21, 0x7e, 256, &latin_chars);
+	size_list_t latin;
+	glyph_sizes(font, latin_chars, &latin);
+	size_list_t em;
+	synthetic_cjk_sizes(em_pixels(font), 256, &em);
+	font->release();
+	if ( latin.empty() )
+	{
+		return;
+	}
+
+	ShelfPacker packer(page_size, page_size);
+	std::vector<PaddingRect> live;
+	int turn = steps / 8 > 0 ? steps / 8 : 1;
+	int failures = 0;
+	double fill_sum = 0.0;
+	float fill_min = 1.0f;
+	for ( int i = 0; i < steps; i++ )
+	{
+		const size_list_t& sizes = (i / turn) % 2 ? em : latin;
+		const std::pair<int, int>& size = sizes[next_random() % sizes.size()];
+		PaddingRect rect;
+		if ( packer.alloc(size.first, size.second, &rect) )
+		{
+			live.push_back(rect);
+			continue;
+		}
+
+		float fill = packer.occupancy();
+		failures++;
+		fill_sum += fill;
+		fill_min = fill < fill_min ? fill : fill_min;
+
+		for ( size_t j = 0; j < live.size(); )
+		{
+			if ( next_random() & 1 )
+			{
+				packer.free(live[j]);
+				live[j] = live.back();
+				live.pop_back();
+			}
+			else
+			{
+				j++;
+			}
+		}
+	}
+
+	printf("%-24.24s %4d %-10s | %6d %6d | %5.1f%% %5.1f%%\n",
+		base_name(config.font).c_str(), config.size, style_name(config.style), steps, failures,
+		failures ? fill_sum * 100.0 / failures : 0.0, failures ? fill_min * 100.0f : 0.0f);
+}
+
+// lines of 8 to 40 chars, 3500 chars of the font are picked by zipf's law in a random order of ranks
+static void chat_log(FT_Library library, const BenchConfig& config, int line_count, std::string* log)
+{
+	std::vector<utf32> chars;
+	font_chars(library, config.font, 0x21, 0x10ffff, 1 << 20, &chars);
+	for ( size_t i = chars.size(); i > 1; i-- )
+	{
+		std::swap(chars[i - 1], chars[next_random() % i]);
+	}
+	if ( chars.empty() )
+	{
+		return;
+	}
+
+	// vocabulary of the common hanzi list size
+	if ( chars.size() > 3500 )
+	{
+		chars.resize(3500);
+	}
+
+	std::vector<double> cdf(chars.size());
+	double sum = 0.0;
+	for ( size_t i = 0; i < chars.size(); i++ )
+	{
+		sum += 1.0 / (i + 1);
+		cdf[i] = sum;
+	}
+
+	for ( int i = 0; i < line_count; i++ )
+	{
+		int len = 8 + (int)(next_random() % 33);
+		for ( int j = 0; j < len; j++ )
+		{
+			double r = (next_random() / 16777216.0) * sum;
+			size_t k = std::lower_bound(cdf.begin(), cdf.end(), r) - cdf.begin();
+			utf32 code = chars[k < chars.size() ? k : chars.size() - 1];
+
+			// utf-8
+			if ( code < 0x80 )
+			{
+				log->push_back((char)code);
+			}
+			else if ( code < 0x800 )
+			{
+				log->push_back((char)(0xc0 | (code >> 6)));
+				log->push_back((char)(0x80 | (code & 0x3f)));
+			}
+			else if ( code < 0x10000 )
+			{
+				log->push_back((char)(0xe0 | (code >> 12)));
+				log->push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+				log->push_back((char)(0x80 | (code & 0x3f)));
+			}
+			else
+			{
+				log->push_back((char)(0xf0 | (code >> 18)));
+				log->push_back((char)(0x80 | ((code >> 12) & 0x3f)));
+				log->push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+				log->push_back((char)(0x80 | (code & 0x3f)));
+			}
+		}
+		log->push_back('\n');
+	}
+}
+
+// the lines once with 1, 2, 4 .. max_pages pages
+static void run_replay(FT_Library library, const BenchConfig& config, const line_list_t& lines,
+	size_t distinct, int page_size, int max_pages)
+{
+	RecordingTextureBackend backend;
+	WTexture2D::set_texture_backend(&backend);
+
+	for ( int pages = 1; pages <= max_pages; pages *= 2 )
+	{
+		AtlasManager* atlas = new AtlasManager(page_size, page_size, pages);
+		atlas->set_pages_per_catalog(0);
+		FontCatalog* catalog = new_catalog(library, config, atlas);
+		if ( !catalog )
+		{
+			delete atlas;
+			fprintf(stderr, "dfont_bench: can not open %s\n", config.font.c_str());
+			break;
+		}
+
+		std::vector<double> latencies;
+		require_lines(catalog, lines, &latencies);
+
+		CatalogStats stats;
+		catalog->stats(&stats);
+		size_t required = stats.hit_count + stats.miss_count;
+		size_t reraster = stats.raster_count > distinct ? stats.raster_count - distinct : 0;
+
+		printf("%-24.24s %4d %-10s | %5d %7u | %8u %8u %6.2f%% | %6.2f%% %8u %8u | %8.1f %8.1f\n",
+			base_name(config.font).c_str(), config.size, style_name(config.style), pages,
+			(unsigned int)stats.texture_count,
+			(unsigned int)stats.raster_count, (unsigned int)reraster, required ? reraster * 100.0 / required : 0.0,
+			required ? stats.hit_count * 100.0 / required : 0.0, (unsigned int)stats.eviction_count, (unsigned int)stats.fallback_count,
+			percentile(latencies, 0.5), percentile(latencies, 0.99));
+
+		delete catalog;
+		delete atlas;
+	}
+
+	WTexture2D::set_texture_backend(NULL);
+}
+
+static void usage()
+{
+	printf(
+		"usage: dfont_bench [options]\n"
+		"  -f font     font file, repeatable, searched in %s (default %s)\n"
+		"  -s sizes    comma separated pixel sizes (default 12,18,24)\n"
+		"  -y styles   comma separated: plain,strengthen,border,shadow (default plain,border)\n"
+		"  -c corpus   utf-8 text required line by line (default built-in sample)\n"
+		"  -r rounds   warm passes over the corpus (default 5)\n"
+		"  -p size     atlas page size (default %d)\n"
+		"  -m pages    max pages of the page group, not raised per catalog (default %d)\n"
+		"  -M mode     latency, pack, frag or lru (default latency)\n"
+		"  -n steps    allocations of the frag mode, lines of the generated lru log (default 100000)\n"
+		"\n"
+		"latency: raster/s is glyphs per second to rasterize and cache the distinct chars of the corpus,\n"
+		"latencies are of one line, cold for the first pass and warm for the others,\n"
+		"fill is used pixels of the pages, uploads are row bands given to the texture backend.\n"
+		"pack: glyphs of printable ascii, ideographs and both in turn are packed into a page until\n"
+		"one fails, grid is the glyphs of the fixed font size cells, * marks em boxes for fonts without ideographs.\n"
+		"frag: a page of small glyphs is freed but one glyph and a large one is allocated,\n"
+		"then ascii and em sized glyphs are allocated at random in turns, half of the glyphs\n"
+		"are freed at random when one fails, fill is of the page at the failures.\n"
+		"lru: the corpus, or a log of 3500 chars of the font picked by zipf's law without -c, is required\n"
+		"line by line with 1, 2, 4 .. max pages, reraster is glyphs rasterized again after eviction,\n"
+		"its rate is of all required glyphs.\n",
+		get_systemfont_path(), get_system_fallback_fontfile(), DFONT_ATLAS_PAGE_WIDTH, DFONT_ATLAS_MAX_PAGES);
+}
+
+static void noop_initor()
+{
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<std::string> fonts;
+	std::vector<std::string> sizes;
+	std::vector<std::string> styles;
+	const char* corpus_file = NULL;
+	int rounds = 5;
+	int page_size = DFONT_ATLAS_PAGE_WIDTH;
+	int max_pages = DFONT_ATLAS_MAX_PAGES;
+	std::string mode = "latency";
+	int steps = 100000;
+
+	for ( int i = 1; i < argc; i++ )
+	{
+		std::string opt = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+		if ( opt == "-h" || !value )
+		{
+			usage();
+			return opt == "-h" ? 0 : 1;
+		}
+
+		if ( opt == "-f" )		fonts.push_back(value);
+		else if ( opt == "-s" )	split(value, &sizes);
+		else if ( opt == "-y" )	split(value, &styles);
+		else if ( opt == "-c" )	corpus_file = value;
+		else if ( opt == "-r" )	rounds = atoi(value);
+		else if ( opt == "-p" )	page_size = atoi(value);
+		else if ( opt == "-m" )	max_pages = atoi(value);
+		else if ( opt == "-M" )	mode = value;
+		else if ( opt == "-n" )	steps = atoi(value);
+		else
+		{
+			usage();
+			return 1;
+		}
+		i++;
+	}
+
+	dfont_default_fontpath = get_systemfont_path();
+	if ( fonts.empty() )
+		fonts.push_back(get_system_fallback_fontfile());
+	if ( sizes.empty() )
+		split("12,18,24", &sizes);
+	if ( styles.empty() )
+		split("plain,border", &styles);
+
+	// the factory is not used, no default font
+	FontFactory::register_initor(noop_initor);
+
+	std::string corpus = c_default_corpus;
+	if ( corpus_file )
+	{
+		unsigned long size = 0;
+		unsigned char* data = read_file(full_path(corpus_file).c_str(), &size);
+		if ( !data )
+		{
+			fprintf(stderr, "dfont_bench: can not read %s\n", corpus_file);
+			return 1;
+		}
+		corpus.assign((const char*)data, size);
+		delete[] data;
+	}
+
+	line_list_t lines;
+	split_lines(corpus, &lines);
+
+	std::vector<utf32> chars;
+	distinct_chars(corpus, &chars);
+	if ( chars.empty() )
+	{
+		fprintf(stderr, "dfont_bench: empty corpus\n");
+		return 1;
+	}
+
+	std::vector<BenchConfig> configs;
+	for ( size_t i = 0; i < fonts.size(); i++ )
+	{
+		for ( size_t j = 0; j < sizes.size(); j++ )
+		{
+			for ( size_t k = 0; k < styles.size(); k++ )
+			{
+				BenchConfig config;
+				config.font = fonts[i];
+				config.size = atoi(sizes[j].c_str());
+				if ( config.size <= 0 || !parse_style(styles[k], &config.style) )
+				{
+					usage();
+					return 1;
+				}
+				configs.push_back(config);
+			}
+		}
+	}
+
+	FT_Library library;
+	if ( FT_Init_FreeType(&library) )
+	{
+		fprintf(stderr, "dfont_bench: can not init FreeType\n");
+		return 1;
+	}
+
+	if ( mode == "pack" )
+	{
+		printf("pages %dx%d\n", page_size, page_size);
+		printf("%-24s %4s %-10s %-7s | %4s %6s | %6s %5s | %6s\n",
+			"font", "size", "style", "glyphs", "cell", "grid", "shelf", "fill", "gain");
+		for ( size_t i = 0; i < configs.size(); i++ )
+		{
+			run_pack(library, configs[i], page_size);
+		}
+		FT_Done_FreeType(library);
+		return 0;
+	}
+
+	if ( mode == "frag" )
+	{
+		run_frag_page();
+		printf("%-24s %4s %-10s | %6s %6s | %6s %6s\n",
+			"font", "size", "style", "allocs", "fails", "fill", "min");
+		for ( size_t i = 0; i < configs.size(); i++ )
+		{
+			run_frag(library, configs[i], page_size, steps);
+		}
+		FT_Done_FreeType(library);
+		return 0;
+	}
+
+	if ( mode == "lru" )
+	{
+		printf("pages %dx%d, %s\n", page_size, page_size, corpus_file ? corpus_file : "generated chat log");
+		printf("%-24s %4s %-10s | %5s %7s | %8s %8s %7s | %7s %8s %8s | %8s %8s\n",
+			"font", "size", "style", "max", "pages", "raster", "reraster", "rate", "hits", "evict", "fallback", "p50 us", "p99 us");
+		for ( size_t i = 0; i < configs.size(); i++ )
+		{
+			std::string log;
+			line_list_t log_lines;
+			std::vector<utf32> log_chars;
+			if ( !corpus_file )
+			{
+				chat_log(library, configs[i], steps, &log);
+				split_lines(log, &log_lines);
+				distinct_chars(log, &log_chars);
+			}
+			run_replay(library, configs[i], corpus_file ? lines : log_lines,
+				corpus_file ? chars.size() : log_chars.size(), page_size, max_pages);
+		}
+		FT_Done_FreeType(library);
+		return 0;
+	}
+
+	if ( mode != "latency" )
+	{
+		usage();
+		FT_Done_FreeType(library);
+		return 1;
+	}
+
+	printf("corpus %s: %u bytes, %u lines, %u chars, %d warm rounds, pages %dx%d max %d\n",
+		corpus_file ? corpus_file : "built-in", (unsigned int)corpus.size(), (unsigned int)lines.size(), (unsigned int)chars.size(),
+		rounds, page_size, page_size, max_pages);
+	printf("%-24s %4s %-10s %9s | %9s %9s | %8s %8s %8s %8s | %5s %5s %6s | %7s %9s\n",
+		"font", "size", "style", "raster/s", "cold p50", "cold p99", "p50 us", "p90 us", "p99 us", "max us", "pages", "fill", "evict", "uploads", "upload KB");
+
+	int failed = 0;
+	for ( size_t i = 0; i < configs.size(); i++ )
+	{
+		const BenchConfig& config = configs[i];
+		BenchResult result;
+		if ( !run(library, config, lines, chars, rounds, page_size, max_pages, &result) )
+		{
+			fprintf(stderr, "dfont_bench: can not open %s\n", config.font.c_str());
+			failed++;
+			continue;
+		}
+
+		printf("%-24.24s %4d %-10s %9.0f | %9.1f %9.1f | %8.1f %8.1f %8.1f %8.1f | %5u %4.0f%% %6u | %7u %9u\n",
+			base_name(config.font).c_str(), config.size, style_name(config.style),
+			result.raster_ms > 0.0 ? result.raster_count * 1000.0 / result.raster_ms : 0.0,
+			percentile(result.cold_us, 0.5), percentile(result.cold_us, 0.99),
+			percentile(result.warm_us, 0.5), percentile(result.warm_us, 0.9), percentile(result.warm_us, 0.99), percentile(result.warm_us, 1.0),
+			(unsigned int)result.stats.texture_count, result.stats.occupancy * 100.0f, (unsigned int)result.stats.eviction_count,
+			(unsigned int)result.upload_calls, (unsigned int)(result.upload_bytes >> 10));
+	}
+
+	FT_Done_FreeType(library);
+	return failed ? 1 : 0;
+}
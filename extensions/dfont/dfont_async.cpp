@@ -0,0 +1,347 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#include "dfont_async.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+#include <stdio.h>
+
+#include <map>
+#include <deque>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#define DFONT_MEMORY_BARRIER() MemoryBarrier()
+#else
+#define DFONT_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+namespace dfont
+{
+
+class AsyncRasterizer::Worker
+{
+public:
+	Worker();
+	~Worker();
+
+	void post(const Request& request);
+
+	bool poll(Result* result);
+
+	void drop_font(FontInfo* font);
+
+private:
+	static void* working(void* context);
+
+	// false when the worker is stopped
+	bool do_work();
+
+	void _queue(const Request& request);
+
+	// single producer(worker) single consumer(main thread)
+	void _push_result(const Result& result);
+
+	volatile bool m_working;
+	pthread_t m_thread;
+
+	// requests are signaled with a condition, unnamed semaphores are not on every platform
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond;
+	std::deque<Request> m_requests;
+
+	// used by the worker to render and by main thread to clone fonts
+	FT_Library m_library;
+	pthread_mutex_t m_library_mutex;
+
+	// main thread only, origin - clone
+	std::map<FontInfo*, FontInfo*> m_fonts;
+
+	Result m_results[DFONT_ASYNC_RING_SIZE];
+	volatile size_t m_result_head;	// write by main thread
+	volatile size_t m_result_tail;	// write by worker
+};
+
+void* AsyncRasterizer::Worker::working(void* context)
+{
+	Worker* worker = (Worker*)context;
+
+	while ( worker->do_work() )
+	{
+	}
+
+	return 0;
+}
+
+AsyncRasterizer::Worker::Worker()
+	: m_working(true), m_library(NULL), m_result_head(0), m_result_tail(0)
+{
+	FT_Error error = FT_Init_FreeType(&m_library);
+	assert(error == 0);
+
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+	pthread_mutex_init(&m_library_mutex, NULL);
+
+	pthread_create(&m_thread, NULL, Worker::working, this);
+}
+
+AsyncRasterizer::Worker::~Worker()
+{
+	pthread_mutex_lock(&m_mutex);
+	m_working = false;
+	pthread_cond_signal(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+	pthread_join(m_thread, NULL);
+
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_mutex);
+	pthread_mutex_destroy(&m_library_mutex);
+
+	// drop results not polled
+	Result result;
+	while ( poll(&result) )
+	{
+		if ( result.bitmap.bitmap )
+		{
+			result.bitmap.bitmap->release();
+		}
+	}
+
+	// clones of dropped fonts not released yet
+	for ( size_t i = 0; i < m_requests.size(); i++ )
+	{
+		if ( m_requests[i].drop && m_requests[i].clone )
+		{
+			m_requests[i].clone->release();
+		}
+	}
+	m_requests.clear();
+
+	for ( std::map<FontInfo*, FontInfo*>::iterator it = m_fonts.begin(); it != m_fonts.end(); it++ )
+	{
+		if ( it->second )
+		{
+			it->second->release();
+		}
+	}
+	m_fonts.clear();
+	FT_Done_FreeType(m_library);
+}
+
+void AsyncRasterizer::Worker::post(const Request& request)
+{
+	// cloned here, the font may be changed on main thread later
+	std::map<FontInfo*, FontInfo*>::iterator it = m_fonts.find(request.font);
+	if ( it == m_fonts.end() )
+	{
+		pthread_mutex_lock(&m_library_mutex);
+		FontInfo* clone = request.font->clone(m_library);
+		pthread_mutex_unlock(&m_library_mutex);
+		it = m_fonts.insert(std::make_pair(request.font, clone)).first;
+	}
+
+	Request posted = request;
+	posted.clone = it->second;
+	posted.drop = false;
+	_queue(posted);
+}
+
+void AsyncRasterizer::Worker::drop_font(FontInfo* font)
+{
+	std::map<FontInfo*, FontInfo*>::iterator it = m_fonts.find(font);
+	if ( it == m_fonts.end() )
+	{
+		return;
+	}
+
+	Request request;
+	request.catalog = NULL;
+	request.font = font;
+	request.charcode = 0;
+	request.phase = 0;
+	request.offset_x = 0;
+	request.clone = it->second;
+	request.drop = true;
+	m_fonts.erase(it);
+	_queue(request);
+}
+
+void AsyncRasterizer::Worker::_queue(const Request& request)
+{
+	pthread_mutex_lock(&m_mutex);
+	m_requests.push_back(request);
+	pthread_cond_signal(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+}
+
+bool AsyncRasterizer::Worker::poll(Result* result)
+{
+	if ( m_result_head == m_result_tail )
+	{
+		return false;
+	}
+	DFONT_MEMORY_BARRIER();
+
+	*result = m_results[m_result_head % DFONT_ASYNC_RING_SIZE];
+
+	DFONT_MEMORY_BARRIER();
+	m_result_head++;
+	return true;
+}
+
+bool AsyncRasterizer::Worker::do_work()
+{
+	pthread_mutex_lock(&m_mutex);
+	while ( m_working && m_requests.empty() )
+	{
+		pthread_cond_wait(&m_cond, &m_mutex);
+	}
+	if ( !m_working )
+	{
+		pthread_mutex_unlock(&m_mutex);
+		return false;
+	}
+	Request request = m_requests.front();
+	m_requests.pop_front();
+	pthread_mutex_unlock(&m_mutex);
+
+	if ( request.drop )
+	{
+		pthread_mutex_lock(&m_library_mutex);
+		if ( request.clone )
+		{
+			request.clone->release();
+		}
+		pthread_mutex_unlock(&m_library_mutex);
+		return true;
+	}
+
+	Result result;
+	result.catalog = request.catalog;
+	result.charcode = request.charcode;
+	result.phase = request.phase;
+
+	pthread_mutex_lock(&m_library_mutex);
+	FontInfo* font = request.clone;
+	if ( !font || !font->render_charcode(request.charcode, &result.bitmap, request.offset_x) )
+	{
+		if ( result.bitmap.bitmap )
+		{
+			result.bitmap.bitmap->release();
+		}
+		result.bitmap.bitmap = NULL;
+	}
+	pthread_mutex_unlock(&m_library_mutex);
+
+	_push_result(result);
+	return true;
+}
+
+void AsyncRasterizer::Worker::_push_result(const Result& result)
+{
+	// wait for main thread if the ring is full
+	while ( m_result_tail - m_result_head >= DFONT_ASYNC_RING_SIZE )
+	{
+		if ( !m_working )
+		{
+			if ( result.bitmap.bitmap )
+			{
+				result.bitmap.bitmap->release();
+			}
+			return;
+		}
+		sched_yield();
+	}
+	DFONT_MEMORY_BARRIER();
+
+	m_results[m_result_tail % DFONT_ASYNC_RING_SIZE] = result;
+
+	DFONT_MEMORY_BARRIER();
+	m_result_tail++;
+}
+
+
+AsyncRasterizer::AsyncRasterizer(size_t worker_num)
+	: m_poll_idx(0)
+{
+	for ( size_t i = 0; i < worker_num; i++ )
+	{
+		m_workers.push_back(new Worker);
+	}
+}
+
+AsyncRasterizer::~AsyncRasterizer()
+{
+	for ( size_t i = 0; i < m_workers.size(); i++ )
+	{
+		delete m_workers[i];
+	}
+	m_workers.clear();
+}
+
+void AsyncRasterizer::post(FontCatalog* catalog, FontInfo* font, utf32 charcode, int phase /*= 0*/, FT_Pos offset_x /*= 0*/)
+{
+	Request request;
+	request.catalog = catalog;
+	request.font = font;
+	request.charcode = charcode;
+	request.phase = phase;
+	request.offset_x = offset_x;
+	request.clone = NULL;
+	request.drop = false;
+
+	m_workers[charcode % m_workers.size()]->post(request);
+}
+
+void AsyncRasterizer::drop_font(FontInfo* font)
+{
+	for ( size_t i = 0; i < m_workers.size(); i++ )
+	{
+		m_workers[i]->drop_font(font);
+	}
+}
+
+bool AsyncRasterizer::poll(Result* result)
+{
+	for ( size_t i = 0; i < m_workers.size(); i++ )
+	{
+		Worker* worker = m_workers[m_poll_idx];
+		m_poll_idx = (m_poll_idx + 1) % m_workers.size();
+		if ( worker->poll(result) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t AsyncRasterizer::worker_num()
+{
+	return m_workers.size();
+}
+
+}//namespace dfont
@@ -0,0 +1,88 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#ifndef __DFONT_ASYNC_H__ 
+#define __DFONT_ASYNC_H__
+
+#include "dfont_config.h"
+#include "dfont_render.h"
+#include "dfont_manager.h"
+
+#include <vector>
+
+namespace dfont
+{
+
+//
+// rasterize glyphs in worker threads
+//	- each worker owns a FT_Library and clones of the fonts it renders
+//	- results are handed back to main thread with a lock-free ring per worker
+//	- fonts are cloned on main thread at the first request, drop_font after
+//	  a font is changed or before it is released
+//
+class AsyncRasterizer
+{
+public:
+	struct Request
+	{
+		class FontCatalog* catalog;
+		class FontInfo* font;
+		utf32 charcode;
+		int phase;			// subpixel variant
+		FT_Pos offset_x;	// 26.6, outline offset of the variant
+		class FontInfo* clone;	// worker's copy of font
+		bool drop;			// release the clone, nothing is rendered
+	};
+
+	struct Result
+	{
+		class FontCatalog* catalog;
+		utf32 charcode;
+		int phase;
+		GlyphBitmap bitmap;	// bitmap is NULL if render failed
+	};
+
+	AsyncRasterizer(size_t worker_num);
+	~AsyncRasterizer();
+
+	// main thread only
+	void post(class FontCatalog* catalog, class FontInfo* font, utf32 charcode, int phase = 0, FT_Pos offset_x = 0);
+
+	// main thread only, return false if no more result
+	bool poll(Result* result);
+
+	// main thread only, clones of the font are released after the requests posted before
+	void drop_font(class FontInfo* font);
+
+	size_t worker_num();
+
+private:
+	class Worker;
+	std::vector<Worker*> m_workers;
+	size_t m_poll_idx;
+};
+
+}
+
+#endif//__DFONT_ASYNC_H__
@@ -0,0 +1,392 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#include "dfont_atlas.h"
+#include "dfont_render.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+namespace dfont
+{
+
+AtlasManager::AtlasManager(int page_width, int page_height, int max_pages)
+	: m_page_width(page_width), m_page_height(page_height), m_max_pages(max_pages),
+	m_pages_per_catalog(DFONT_ATLAS_PAGES_PER_CATALOG)
+{
+	for ( int i = 0; i < 4; i++ )
+	{
+		m_groups[i].lru_head = NULL;
+		m_groups[i].lru_tail = NULL;
+		m_groups[i].lru_area = 0;
+		m_groups[i].saturated = false;
+		m_groups[i].saturated_lru_area = 0;
+		m_groups[i].catalog_count = 0;
+	}
+}
+
+AtlasManager::~AtlasManager()
+{
+	// catalogs are deleted before, no slot left
+	for ( int i = 0; i < 4; i++ )
+	{
+		for ( size_t j = 0; j < m_groups[i].pages.size(); j++ )
+		{
+			delete m_groups[i].pages[j];
+		}
+		m_groups[i].pages.clear();
+	}
+}
+
+void AtlasManager::set_page_size(int width, int height)
+{
+	m_page_width = width;
+	m_page_height = height;
+	_clear_saturated();
+}
+
+int AtlasManager::page_width()
+{
+	return m_page_width;
+}
+
+int AtlasManager::page_height()
+{
+	return m_page_height;
+}
+
+void AtlasManager::set_max_pages(int max_pages)
+{
+	m_max_pages = max_pages;
+	_clear_saturated();
+}
+
+int AtlasManager::max_pages()
+{
+	return m_max_pages;
+}
+
+void AtlasManager::set_pages_per_catalog(int pages)
+{
+	m_pages_per_catalog = pages;
+	_clear_saturated();
+}
+
+int AtlasManager::pages_per_catalog()
+{
+	return m_pages_per_catalog;
+}
+
+int AtlasManager::max_pages(int bytes_per_pixel, bool smooth)
+{
+	return _max_pages(_group(bytes_per_pixel, smooth));
+}
+
+void AtlasManager::add_catalog(int bytes_per_pixel, bool smooth)
+{
+	PageGroup* group = _group(bytes_per_pixel, smooth);
+	group->catalog_count++;
+	group->saturated = false;
+}
+
+void AtlasManager::remove_catalog(int bytes_per_pixel, bool smooth)
+{
+	_group(bytes_per_pixel, smooth)->catalog_count--;
+}
+
+bool AtlasManager::fits(int w, int h)
+{
+	return w <= m_page_width && h <= m_page_height;
+}
+
+bool AtlasManager::cache_bitmap(GlyphBitmap* bm, int bytes_per_pixel, bool smooth, GlyphSlot* slot, bool evict)
+{
+	int w = bm->bitmap->real_width();
+	int h = bm->bitmap->real_height();
+	if ( !fits(w, h) )
+	{
+		return false;
+	}
+
+	PageGroup* group = _group(bytes_per_pixel, smooth);
+
+	bool cached = false;
+	for ( size_t i = 0; i < group->pages.size() && !cached; i++ )
+	{
+		cached = group->pages[i]->cache_charcode(bm, slot);
+	}
+
+	// no more room, create a new page
+	if ( !cached && (int)group->pages.size() < _max_pages(group) )
+	{
+		WTexture2D* page = new WTexture2D(m_page_width, m_page_height, bytes_per_pixel, smooth);
+		group->pages.push_back(page);
+		cached = page->cache_charcode(bm, slot);
+	}
+
+	// evict least recently used glyphs of one page until the bitmap fits,
+	// nothing is evicted if no page can make room
+	WTexture2D* page = !cached && evict ? _evict_page(group, w, h) : NULL;
+	GlyphSlot* victim = page ? group->lru_head : NULL;
+	while ( !cached && victim )
+	{
+		GlyphSlot* next = victim->lru_next;
+		if ( victim->texture == page )
+		{
+			lru_unlink(victim);
+			page->uncache(victim);
+			victim->catalog->_on_evicted(victim);
+			cached = page->cache_charcode(bm, slot);
+		}
+		victim = next;
+	}
+
+	if ( evict )
+	{
+		group->saturated = !cached;
+		group->saturated_lru_area = group->lru_area;
+	}
+
+	return cached;
+}
+
+void AtlasManager::uncache(GlyphSlot* slot)
+{
+	lru_unlink(slot);
+	if ( slot->texture )
+	{
+		_group(slot->texture)->saturated = false;
+		slot->texture->uncache(slot);
+	}
+}
+
+bool AtlasManager::saturated(int bytes_per_pixel, bool smooth)
+{
+	PageGroup* group = _group(bytes_per_pixel, smooth);
+	return group->saturated && group->lru_area <= group->saturated_lru_area;
+}
+
+bool AtlasManager::lru_push(GlyphSlot* slot)
+{
+	// pending slot can not be evicted
+	if ( !slot->texture )
+	{
+		return false;
+	}
+
+	PageGroup* group = _group(slot->texture);
+	slot->lru_prev = group->lru_tail;
+	slot->lru_next = NULL;
+	if ( group->lru_tail )
+	{
+		group->lru_tail->lru_next = slot;
+	}
+	else
+	{
+		group->lru_head = slot;
+	}
+	group->lru_tail = slot;
+	group->lru_area += slot->padding_rect.width * slot->padding_rect.height;
+	return true;
+}
+
+bool AtlasManager::lru_unlink(GlyphSlot* slot)
+{
+	if ( !slot->texture )
+	{
+		return false;
+	}
+
+	PageGroup* group = _group(slot->texture);
+	if ( slot->lru_prev )
+	{
+		slot->lru_prev->lru_next = slot->lru_next;
+	}
+	else if ( group->lru_head == slot )
+	{
+		group->lru_head = slot->lru_next;
+	}
+	else
+	{
+		// not linked
+		return false;
+	}
+
+	if ( slot->lru_next )
+	{
+		slot->lru_next->lru_prev = slot->lru_prev;
+	}
+	else
+	{
+		group->lru_tail = slot->lru_prev;
+	}
+	slot->lru_prev = NULL;
+	slot->lru_next = NULL;
+	group->lru_area -= slot->padding_rect.width * slot->padding_rect.height;
+	return true;
+}
+
+std::vector<WTexture2D*>* AtlasManager::pages(int bytes_per_pixel, bool smooth)
+{
+	return &_group(bytes_per_pixel, smooth)->pages;
+}
+
+void AtlasManager::all_pages(std::vector<WTexture2D*>* pages)
+{
+	for ( int i = 0; i < 4; i++ )
+	{
+		pages->insert(pages->end(), m_groups[i].pages.begin(), m_groups[i].pages.end());
+	}
+}
+
+void AtlasManager::flush()
+{
+	for ( int i = 0; i < 4; i++ )
+	{
+		for ( size_t j = 0; j < m_groups[i].pages.size(); j++ )
+		{
+			m_groups[i].pages[j]->flush();
+		}
+	}
+}
+
+float AtlasManager::pinned_ratio(int bytes_per_pixel, bool smooth)
+{
+	PageGroup* group = _group(bytes_per_pixel, smooth);
+
+	float used_pixels = 0.0f;
+	float total_pixels = 0.0f;
+	for ( size_t i = 0; i < group->pages.size(); i++ )
+	{
+		WTexture2D* page = group->pages[i];
+		float pixels = (float)(page->width() * page->height());
+		used_pixels += page->occupancy() * pixels;
+		total_pixels += pixels;
+	}
+
+	// pages to create
+	int more_pages = _max_pages(group) - (int)group->pages.size();
+	if ( more_pages > 0 )
+	{
+		total_pixels += (float)more_pages * m_page_width * m_page_height;
+	}
+
+	float pinned_pixels = used_pixels - (float)group->lru_area;
+	return total_pixels > 0.0f ? pinned_pixels / total_pixels : 1.0f;
+}
+
+float AtlasManager::occupancy()
+{
+	float used_pixels = 0.0f;
+	float total_pixels = 0.0f;
+	for ( int i = 0; i < 4; i++ )
+	{
+		for ( size_t j = 0; j < m_groups[i].pages.size(); j++ )
+		{
+			WTexture2D* page = m_groups[i].pages[j];
+			float pixels = (float)(page->width() * page->height());
+			used_pixels += page->occupancy() * pixels;
+			total_pixels += pixels;
+		}
+	}
+	return total_pixels > 0.0f ? used_pixels / total_pixels : 0.0f;
+}
+
+void AtlasManager::dump_textures()
+{
+	static const char* names[4] = { "atlas_a8", "atlas_rgba", "atlas_a8_alias", "atlas_rgba_alias" };
+	for ( int i = 0; i < 4; i++ )
+	{
+		for ( size_t j = 0; j < m_groups[i].pages.size(); j++ )
+		{
+			m_groups[i].pages[j]->dump_textures(names[i], j);
+		}
+	}
+}
+
+AtlasManager::PageGroup* AtlasManager::_group(int bytes_per_pixel, bool smooth)
+{
+	return &m_groups[(bytes_per_pixel == 1 ? 0 : 1) + (smooth ? 0 : 2)];
+}
+
+AtlasManager::PageGroup* AtlasManager::_group(WTexture2D* texture)
+{
+	return _group(texture->bytes_per_pixel(), texture->smooth());
+}
+
+WTexture2D* AtlasManager::_evict_page(PageGroup* group, int w, int h)
+{
+	// pages in order of their least recently used glyphs
+	std::vector<WTexture2D*> checked;
+	for ( GlyphSlot* victim = group->lru_head; victim && checked.size() < group->pages.size(); victim = victim->lru_next )
+	{
+		WTexture2D* page = victim->texture;
+		if ( std::find(checked.begin(), checked.end(), page) != checked.end() )
+		{
+			continue;
+		}
+		checked.push_back(page);
+
+		if ( page->width() < w || page->height() < h )
+		{
+			continue;
+		}
+
+		// give back unused glyphs of the page in lru order until w*h fits,
+		// as the eviction will do
+		ShelfPacker packer = page->packer();
+		PaddingRect rect;
+		for ( GlyphSlot* unused = victim; unused; unused = unused->lru_next )
+		{
+			if ( unused->texture != page )
+			{
+				continue;
+			}
+
+			packer.free(unused->padding_rect);
+			if ( packer.alloc(w, h, &rect) )
+			{
+				return page;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+int AtlasManager::_max_pages(PageGroup* group)
+{
+	int pages = m_pages_per_catalog * group->catalog_count;
+	return pages > m_max_pages ? pages : m_max_pages;
+}
+
+void AtlasManager::_clear_saturated()
+{
+	for ( int i = 0; i < 4; i++ )
+	{
+		m_groups[i].saturated = false;
+	}
+}
+
+}//namespace dfont
@@ -0,0 +1,147 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#ifndef __DFONT_ATLAS_H__ 
+#define __DFONT_ATLAS_H__
+
+#include "dfont_config.h"
+#include "dfont_manager.h"
+
+#include <vector>
+
+namespace dfont
+{
+
+//
+// texture pages shared by all catalogs
+//	- glyphs of different fonts and sizes are packed into the same pages,
+//	  mixed-font text is drawn with fewer textures and atlases
+//	- pages are grouped by pixel format and filter, each group has a lru list
+//	  of unused glyphs of any catalog
+//	- page size can be changed at runtime, it applies to pages created later
+//
+class AtlasManager
+{
+public:
+	AtlasManager(int page_width, int page_height, int max_pages);
+	~AtlasManager();
+
+	void set_page_size(int width, int height);
+	int page_width();
+	int page_height();
+
+	// max pages of each group, raised to pages_per_catalog for each catalog in the group
+	void set_max_pages(int max_pages);
+	int max_pages();
+
+	// 0 keeps every group at max_pages
+	void set_pages_per_catalog(int pages);
+	int pages_per_catalog();
+
+	// max pages of a group with its catalogs
+	int max_pages(int bytes_per_pixel, bool smooth);
+
+	// a catalog caches glyphs in the group
+	void add_catalog(int bytes_per_pixel, bool smooth);
+	void remove_catalog(int bytes_per_pixel, bool smooth);
+
+	// false if a w*h bitmap is larger than a page
+	bool fits(int w, int h);
+
+	// copy the bitmap into a page of the group and fill the slot,
+	// evict least recently used glyphs of the group if evict is true
+	bool cache_bitmap(struct GlyphBitmap* bm, int bytes_per_pixel, bool smooth, GlyphSlot* slot, bool evict);
+
+	// give back the slot's region
+	void uncache(GlyphSlot* slot);
+
+	// a bitmap did not fit with eviction, and no glyph was released or given back since
+	bool saturated(int bytes_per_pixel, bool smooth);
+
+	// pixels of glyphs in use or pending / pixels of max pages of the group
+	float pinned_ratio(int bytes_per_pixel, bool smooth);
+
+	// slot is not in use, append to the lru tail, return false if the slot is pending
+	bool lru_push(GlyphSlot* slot);
+
+	// slot is in use again, return false if the slot is not linked
+	bool lru_unlink(GlyphSlot* slot);
+
+	// pages of a group, bytes_per_pixel is 1 for a8 and 4 for rgba
+	std::vector<WTexture2D*>* pages(int bytes_per_pixel, bool smooth);
+
+	// pages of all groups
+	void all_pages(std::vector<WTexture2D*>* pages);
+
+	void flush();
+
+	// used pixels / pixels of all pages
+	float occupancy();
+
+	void dump_textures();
+
+private:
+	struct PageGroup
+	{
+		std::vector<WTexture2D*> pages;
+
+		// least recently used at head
+		GlyphSlot* lru_head;
+		GlyphSlot* lru_tail;
+
+		// pixels of the slots in lru
+		size_t lru_area;
+
+		// lru_area when a bitmap did not fit
+		bool saturated;
+		size_t saturated_lru_area;
+
+		int catalog_count;
+	};
+
+	PageGroup* _group(int bytes_per_pixel, bool smooth);
+
+	PageGroup* _group(WTexture2D* texture);
+
+	// the page of the least recently used glyph which has room for w*h after evicting
+	// its unused glyphs, NULL if none
+	WTexture2D* _evict_page(PageGroup* group, int w, int h);
+
+	int _max_pages(PageGroup* group);
+
+	// page size or count changed
+	void _clear_saturated();
+
+	// a8 smooth, rgba smooth, a8 alias, rgba alias
+	PageGroup m_groups[4];
+
+	int m_page_width;
+	int m_page_height;
+	int m_max_pages;
+	int m_pages_per_catalog;
+};
+
+}
+
+#endif//__DFONT_ATLAS_H__
@@ -27,6 +27,11 @@
 
 #define _DFONT_DEBUG 0
 
+// 0 builds dfont without cocos2d-x, see dfont_utility.h for the engine glue
+#ifndef DFONT_COCOS2D
+#define DFONT_COCOS2D 1
+#endif
+
 namespace dfont 
 {
 	extern const char* dfont_default_fontpath;
@@ -39,18 +44,26 @@ namespace dfont
 #define DFONT_DEFAULT_FONTPPI		dfont::dfont_default_ppi
 
 #define DFONT_BITMAP_PADDING		1
-#define DFONT_TEXTURE_SIZE_WIDTH	256
-#define DFONT_TEXTURE_SIZE_HEIGHT	256
-#define DFONT_MAX_TEXTURE_NUM_PERFONT 8
+#define DFONT_ATLAS_PAGE_WIDTH		512
+#define DFONT_ATLAS_PAGE_HEIGHT		512
+#define DFONT_ATLAS_MAX_PAGES		4
+#define DFONT_ATLAS_PAGES_PER_CATALOG	2	// a group grows to this many pages per catalog in it
+#define DFONT_SHELF_HEIGHT_ALIGN	4
+#define DFONT_UPLOAD_MERGE_ROWS		8
+#define DFONT_ASYNC_RING_SIZE		256
+#define DFONT_DISKCACHE_MAX_SIZE	(8 * 1024 * 1024)
+#define DFONT_SDF_REFERENCE_SIZE	32
+#define DFONT_SDF_SPREAD			6
+#define DFONT_GLYPH_CACHE_SIZE		256
+#define DFONT_KERNING_CACHE_SIZE	4096
+#define DFONT_BITMAP_POOL_SIZE		(1024 * 1024)
+#define DFONT_PREWARM_BUDGET_MS		4.0f
+#define DFONT_PREWARM_MAX_PINNED	0.75f	// pinned pixels / pixels of max pages
+#define DFONT_SUBPIXEL_LAST_CHAR	0x024f	// latin extended-b
 
 //
 // TODO:
-//	- 1.GlyphSolṱ㷨Ż
 //	- 2.ͬƽ̨·Ĭ崴ʹù
-//	- 3.ڴռãʣλϢʵʱؽӿ
-//	- (?)4.̴߳
-//	- (?)5.Kerning
-//	- 6.wtexture
 //
 
 #endif//__DFONT_CONFIG_H__
@@ -0,0 +1,421 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#include "dfont_diskcache.h"
+#include "dfont_face.h"
+#include "dfont_utility.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace dfont
+{
+
+static const unsigned int c_diskcache_magic = 0x43464644;	// "DFFC"
+static const unsigned int c_diskcache_version = 3;
+
+struct DiskCacheHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int key_low;
+	unsigned int key_high;
+	unsigned int bytes_per_pixel;
+	unsigned int reserved;
+};
+
+// followed by pixels, record size is aligned to 4 bytes
+struct DiskGlyphRecord
+{
+	unsigned int charcode;
+	short left;
+	short top;
+	short advance_x;
+	short advance_y;
+	unsigned short real_width;
+	unsigned short real_height;
+	unsigned short padding;
+	unsigned short reserved;
+	int advance_x_26dot6;
+};
+
+static size_t _record_size(int real_width, int real_height, int bytes_per_pixel)
+{
+	return (sizeof(DiskGlyphRecord) + real_width * real_height * bytes_per_pixel + 3) & ~(size_t)3;
+}
+
+static const unsigned long long c_fnv_offset = 14695981039346656037ULL;
+
+// byte order independent
+static unsigned long long _hash_value(long long value, unsigned long long h)
+{
+	unsigned char bytes[8];
+	for ( int i = 0; i < 8; i++ )
+	{
+		bytes[i] = (unsigned char)(value >> (i * 8));
+	}
+	return hash_bytes(bytes, sizeof(bytes), h);
+}
+
+static unsigned long long _hash_font(FontInfo* font, unsigned long long h)
+{
+	// sampled content, hashed once for each file
+	h = _hash_value(FaceManager::instance()->file_hash(font->font_name()), h);
+	h = _hash_value(font->face_idx(), h);
+	h = _hash_value(font->char_width_pt(), h);
+	h = _hash_value(font->char_height_pt(), h);
+	h = _hash_value(font->ppi(), h);
+	h = _hash_value(font->shift_y(), h);
+
+	std::set<FT_ULong>* charset = font->available_charset();
+	if ( charset )
+	{
+		h = _hash_value(charset->size(), h);
+		for ( std::set<FT_ULong>::iterator it = charset->begin(); it != charset->end(); it++ )
+		{
+			h = _hash_value(*it, h);
+		}
+	}
+	return h;
+}
+
+unsigned long long GlyphDiskCache::make_key(FontInfo* font)
+{
+	unsigned long long h = c_fnv_offset;
+	h = _hash_value(c_diskcache_version, h);
+	h = _hash_value(DFONT_BITMAP_PADDING, h);
+	h = _hash_value(font->pixel_format(), h);
+	h = _hash_font(font, h);
+
+	const std::vector<RenderPassParam>* params = font->pass_params();
+	if ( params )
+	{
+		for ( size_t i = 0; i < params->size(); i++ )
+		{
+			const RenderPassParam& param = (*params)[i];
+			h = _hash_value(param.color.to_uint32(), h);
+			h = _hash_value(param.blender, h);
+			h = _hash_value(param.translate_x, h);
+			h = _hash_value(param.translate_y, h);
+			h = _hash_value(param.stroke, h);
+			h = _hash_value(param.stroke_radius, h);
+			h = _hash_value(param.sdf_spread, h);
+		}
+	}
+
+	std::vector<FontInfo*>* hackfonts = font->hackfonts();
+	for ( size_t i = 0; i < hackfonts->size(); i++ )
+	{
+		h = _hash_font((*hackfonts)[i], h);
+	}
+
+	return h;
+}
+
+//////////////////////////////////////////////////////////////////////////
+GlyphDiskCache::GlyphDiskCache(const char* path, unsigned long long key, int bytes_per_pixel)
+	: m_path(path), m_key(key), m_bytes_per_pixel(bytes_per_pixel),
+	m_data(NULL), m_size(0),
+	m_file(NULL), m_file_size(0)
+{
+	size_t valid_size = 0;
+	if ( _map_file() )
+	{
+		valid_size = _scan_records();
+	}
+
+	if ( valid_size > 0 )
+	{
+		// append after the last valid record
+		m_file = fopen(path, "r+b");
+		if ( m_file && valid_size < m_size )
+		{
+			fflush(m_file);
+#if defined(_WIN32)
+			_chsize(_fileno(m_file), (long)valid_size);
+#else
+			if ( ftruncate(fileno(m_file), (off_t)valid_size) != 0 )
+			{
+				fclose(m_file);
+				m_file = NULL;
+			}
+#endif
+		}
+
+		if ( m_file && fseek(m_file, (long)valid_size, SEEK_SET) == 0 )
+		{
+			m_file_size = valid_size;
+		}
+		else if ( m_file )
+		{
+			fclose(m_file);
+			m_file = NULL;
+		}
+	}
+
+	if ( !m_file )
+	{
+		// new or stale file, start over
+		_unmap_file();
+		m_index.clear();
+
+		m_file = fopen(path, "wb");
+		if ( m_file )
+		{
+			DiskCacheHeader header;
+			header.magic = c_diskcache_magic;
+			header.version = c_diskcache_version;
+			header.key_low = (unsigned int)m_key;
+			header.key_high = (unsigned int)(m_key >> 32);
+			header.bytes_per_pixel = m_bytes_per_pixel;
+			header.reserved = 0;
+			if ( fwrite(&header, sizeof(header), 1, m_file) == 1 )
+			{
+				m_file_size = sizeof(header);
+			}
+			else
+			{
+				fclose(m_file);
+				m_file = NULL;
+			}
+		}
+	}
+}
+
+GlyphDiskCache::~GlyphDiskCache()
+{
+	if ( m_file )
+	{
+		fclose(m_file);
+		m_file = NULL;
+	}
+	_unmap_file();
+}
+
+bool GlyphDiskCache::load(utf32 charcode, GlyphBitmap* bm)
+{
+	std::map<utf32, size_t>::iterator it = m_index.find(charcode);
+	if ( it == m_index.end() )
+	{
+		return false;
+	}
+
+	const DiskGlyphRecord* rec = (const DiskGlyphRecord*)(m_data + it->second);
+	unsigned char* pixels = (unsigned char*)(m_data + it->second + sizeof(DiskGlyphRecord));
+
+	if ( m_bytes_per_pixel == 1 )
+	{
+		bm->bitmap = new Bitmap_8bits(pixels, rec->real_width, rec->real_height, rec->padding);
+	}
+	else
+	{
+		bm->bitmap = new Bitmap_32bits((unsigned int*)pixels, rec->real_width, rec->real_height, rec->padding);
+	}
+	bm->top_left_pixels.x = rec->left;
+	bm->top_left_pixels.y = rec->top;
+	bm->advance_pixels.x = rec->advance_x;
+	bm->advance_pixels.y = rec->advance_y;
+	bm->advance_x_26dot6 = rec->advance_x_26dot6;
+
+	return true;
+}
+
+void GlyphDiskCache::store(utf32 charcode, GlyphBitmap* bm)
+{
+	if ( !m_file || !bm->bitmap || bm->bitmap->numbits() != m_bytes_per_pixel * 8 )
+	{
+		return;
+	}
+
+	if ( m_index.find(charcode) != m_index.end() || m_stored.find(charcode) != m_stored.end() )
+	{
+		return;
+	}
+
+	IBitmap* bitmap = bm->bitmap;
+	size_t pixels_size = bitmap->real_width() * bitmap->real_height() * m_bytes_per_pixel;
+	size_t size = _record_size(bitmap->real_width(), bitmap->real_height(), m_bytes_per_pixel);
+	if ( m_file_size + size > DFONT_DISKCACHE_MAX_SIZE )
+	{
+		return;
+	}
+
+	DiskGlyphRecord rec;
+	rec.charcode = (unsigned int)charcode;
+	rec.left = (short)bm->top_left_pixels.x;
+	rec.top = (short)bm->top_left_pixels.y;
+	rec.advance_x = (short)bm->advance_pixels.x;
+	rec.advance_y = (short)bm->advance_pixels.y;
+	rec.real_width = (unsigned short)bitmap->real_width();
+	rec.real_height = (unsigned short)bitmap->real_height();
+	rec.padding = (unsigned short)bitmap->padding();
+	rec.reserved = 0;
+	rec.advance_x_26dot6 = (int)bm->advance_x_26dot6;
+
+	static const unsigned char zeros[4] = {0};
+	size_t align = size - sizeof(rec) - pixels_size;
+	if ( fwrite(&rec, sizeof(rec), 1, m_file) != 1 
+		|| (pixels_size > 0 && fwrite(bitmap->get_buffer(), pixels_size, 1, m_file) != 1)
+		|| (align > 0 && fwrite(zeros, align, 1, m_file) != 1) )
+	{
+		// disk full, the broken record is dropped at next launch
+		fclose(m_file);
+		m_file = NULL;
+		return;
+	}
+
+	m_file_size += size;
+	m_stored.insert(charcode);
+}
+
+void GlyphDiskCache::flush()
+{
+	if ( m_file )
+	{
+		fflush(m_file);
+	}
+}
+
+void GlyphDiskCache::charcodes(std::vector<utf32>* out)
+{
+	for ( std::map<utf32, size_t>::iterator it = m_index.begin(); it != m_index.end(); it++ )
+	{
+		out->push_back(it->first);
+	}
+}
+
+size_t GlyphDiskCache::glyph_count()
+{
+	return m_index.size();
+}
+
+const char* GlyphDiskCache::path()
+{
+	return m_path.c_str();
+}
+
+bool GlyphDiskCache::_map_file()
+{
+#if defined(_WIN32)
+	FILE* f = fopen(m_path.c_str(), "rb");
+	if ( !f )
+	{
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if ( size < (long)sizeof(DiskCacheHeader) )
+	{
+		fclose(f);
+		return false;
+	}
+	unsigned char* data = (unsigned char*)malloc(size);
+	if ( fread(data, size, 1, f) != 1 )
+	{
+		free(data);
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+	m_data = data;
+	m_size = size;
+#else
+	int fd = open(m_path.c_str(), O_RDONLY);
+	if ( fd < 0 )
+	{
+		return false;
+	}
+	struct stat st;
+	if ( fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(DiskCacheHeader) )
+	{
+		close(fd);
+		return false;
+	}
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( data == MAP_FAILED )
+	{
+		return false;
+	}
+	m_data = (const unsigned char*)data;
+	m_size = st.st_size;
+#endif
+
+	const DiskCacheHeader* header = (const DiskCacheHeader*)m_data;
+	if ( header->magic != c_diskcache_magic 
+		|| header->version != c_diskcache_version
+		|| header->key_low != (unsigned int)m_key
+		|| header->key_high != (unsigned int)(m_key >> 32)
+		|| (int)header->bytes_per_pixel != m_bytes_per_pixel )
+	{
+		_unmap_file();
+		return false;
+	}
+
+	return true;
+}
+
+void GlyphDiskCache::_unmap_file()
+{
+	if ( !m_data )
+	{
+		return;
+	}
+#if defined(_WIN32)
+	free((void*)m_data);
+#else
+	munmap((void*)m_data, m_size);
+#endif
+	m_data = NULL;
+	m_size = 0;
+}
+
+size_t GlyphDiskCache::_scan_records()
+{
+	size_t offset = sizeof(DiskCacheHeader);
+	while ( offset + sizeof(DiskGlyphRecord) <= m_size )
+	{
+		const DiskGlyphRecord* rec = (const DiskGlyphRecord*)(m_data + offset);
+		size_t size = _record_size(rec->real_width, rec->real_height, m_bytes_per_pixel);
+		if ( offset + size > m_size || rec->real_width < rec->padding * 2 || rec->real_height < rec->padding * 2 )
+		{
+			break;
+		}
+		m_index[rec->charcode] = offset;
+		offset += size;
+	}
+	return offset;
+}
+
+}
@@ -0,0 +1,97 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#ifndef __DFONT_DISKCACHE_H__ 
+#define __DFONT_DISKCACHE_H__
+
+#include "dfont_config.h"
+#include "dfont_render.h"
+#include "dfont_manager.h"
+
+#include <stdio.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace dfont
+{
+
+//
+// rendered glyphs saved in a file, mapped into memory at next launch
+//	- one file per key, key is hashed from font file contents and render params
+//	- records are only appended, glyphs stored in this run are loadable after reopen
+//	- a broken tail is dropped and overwritten
+//
+class GlyphDiskCache
+{
+public:
+	// hash of font files, face, size, ppi, passes and hackfonts
+	static unsigned long long make_key(class FontInfo* font);
+
+	GlyphDiskCache(const char* path, unsigned long long key, int bytes_per_pixel);
+	~GlyphDiskCache();
+
+	// bitmap refers to the mapped memory and is read only, release it after used
+	bool load(utf32 charcode, GlyphBitmap* bm);
+
+	// append a rendered glyph, ignored if already stored or the file is full
+	void store(utf32 charcode, GlyphBitmap* bm);
+
+	// write appended records to the file
+	void flush();
+
+	// loadable charcodes
+	void charcodes(std::vector<utf32>* out);
+
+	size_t glyph_count();
+
+	const char* path();
+
+private:
+	bool _map_file();
+	void _unmap_file();
+
+	// build index, return the size of valid data
+	size_t _scan_records();
+
+	std::string m_path;
+	unsigned long long m_key;
+	int m_bytes_per_pixel;
+
+	// mapped file
+	const unsigned char* m_data;
+	size_t m_size;
+
+	// charcode - record offset in mapped file
+	std::map<utf32, size_t> m_index;
+	std::set<utf32> m_stored;
+
+	FILE* m_file;
+	size_t m_file_size;
+};
+
+}
+
+#endif//__DFONT_DISKCACHE_H__
@@ -0,0 +1,354 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#include "dfont_face.h"
+
+#include FT_SIZES_H
+
+#include "dfont_utility.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace dfont
+{
+
+static pthread_mutex_t s_face_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//////////////////////////////////////////////////////////////////////////
+bool SharedFace::GlyphKey::operator<(const GlyphKey& other) const
+{
+	if ( x_scale != other.x_scale )
+		return x_scale < other.x_scale;
+	if ( y_scale != other.y_scale )
+		return y_scale < other.y_scale;
+	return char_idx < other.char_idx;
+}
+
+SharedFace::SharedFace(FT_Face face, FT_Library library, const std::string& filename, FT_Long face_idx)
+	: m_face(face), m_library(library), m_filename(filename), m_face_idx(face_idx), m_ref_count(1)
+{
+}
+
+SharedFace::~SharedFace()
+{
+	for ( std::map<GlyphKey, CachedGlyph>::iterator it = m_glyphs.begin(); it != m_glyphs.end(); it++ )
+	{
+		FT_Done_Glyph(it->second.glyph);
+	}
+	m_glyphs.clear();
+	m_lru.clear();
+
+	FT_Done_Face(m_face);
+	m_face = NULL;
+}
+
+FT_Face SharedFace::face()
+{
+	return m_face;
+}
+
+FT_Glyph SharedFace::load_glyph(FT_Size size, FT_UInt char_idx, FT_Fixed* linear_advance /*= NULL*/)
+{
+	GlyphKey key;
+	key.x_scale = size->metrics.x_scale;
+	key.y_scale = size->metrics.y_scale;
+	key.char_idx = char_idx;
+
+	std::map<GlyphKey, CachedGlyph>::iterator it = m_glyphs.find(key);
+	if ( it != m_glyphs.end() )
+	{
+		m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+		if ( linear_advance )
+		{
+			*linear_advance = it->second.linear_advance;
+		}
+		return it->second.glyph;
+	}
+
+	FT_Glyph glyph = NULL;
+	if ( FT_Activate_Size(size) != 0
+		|| FT_Load_Glyph(m_face, char_idx, FT_LOAD_DEFAULT) != 0 
+		|| FT_Get_Glyph(m_face->glyph, &glyph) != 0 )
+	{
+		return NULL;
+	}
+
+	// drop the least recently used
+	if ( m_glyphs.size() >= DFONT_GLYPH_CACHE_SIZE )
+	{
+		std::map<GlyphKey, CachedGlyph>::iterator victim = m_glyphs.find(m_lru.back());
+		FT_Done_Glyph(victim->second.glyph);
+		m_glyphs.erase(victim);
+		m_lru.pop_back();
+	}
+
+	m_lru.push_front(key);
+	CachedGlyph& cached = m_glyphs[key];
+	cached.glyph = glyph;
+	cached.linear_advance = m_face->glyph->linearHoriAdvance;
+	cached.lru = m_lru.begin();
+
+	if ( linear_advance )
+	{
+		*linear_advance = cached.linear_advance;
+	}
+
+	return glyph;
+}
+
+size_t SharedFace::cached_glyph_count()
+{
+	return m_glyphs.size();
+}
+
+//////////////////////////////////////////////////////////////////////////
+FaceManager* FaceManager::instance()
+{
+	static FaceManager* _manager = NULL;
+
+	pthread_mutex_lock(&s_face_mutex);
+	if ( _manager == NULL )
+	{
+		_manager = new FaceManager;
+	}
+	pthread_mutex_unlock(&s_face_mutex);
+
+	return _manager;
+}
+
+FaceManager::FaceManager()
+{
+}
+
+FaceManager::~FaceManager()
+{
+}
+
+SharedFace* FaceManager::acquire(FT_Library library, const char* filename, FT_Long face_idx)
+{
+	SharedFace* shared = NULL;
+
+	pthread_mutex_lock(&s_face_mutex);
+
+	for ( std::list<SharedFace*>::iterator it = m_faces.begin(); it != m_faces.end(); it++ )
+	{
+		if ( (*it)->m_library == library && (*it)->m_face_idx == face_idx && (*it)->m_filename == filename )
+		{
+			shared = *it;
+			shared->m_ref_count++;
+			break;
+		}
+	}
+
+	if ( !shared )
+	{
+		FontFile* file = _open_file(filename);
+		FT_Face face = NULL;
+		if ( file && FT_New_Memory_Face(library, file->data, (FT_Long)file->size, face_idx, &face) == 0 )
+		{
+			shared = new SharedFace(face, library, filename, face_idx);
+			m_faces.push_back(shared);
+		}
+		else if ( file )
+		{
+			_close_file(filename);
+		}
+	}
+
+	pthread_mutex_unlock(&s_face_mutex);
+
+	return shared;
+}
+
+void FaceManager::release(SharedFace* face)
+{
+	pthread_mutex_lock(&s_face_mutex);
+
+	if ( --face->m_ref_count == 0 )
+	{
+		m_faces.remove(face);
+		std::string filename = face->m_filename;
+		delete face;
+		_close_file(filename);
+	}
+
+	pthread_mutex_unlock(&s_face_mutex);
+}
+
+size_t FaceManager::face_count()
+{
+	pthread_mutex_lock(&s_face_mutex);
+	size_t count = m_faces.size();
+	pthread_mutex_unlock(&s_face_mutex);
+	return count;
+}
+
+size_t FaceManager::file_count()
+{
+	pthread_mutex_lock(&s_face_mutex);
+	size_t count = m_files.size();
+	pthread_mutex_unlock(&s_face_mutex);
+	return count;
+}
+
+// the first and last 64KB, the table directory there keeps checksums of all tables,
+// and 64 chunks of 1KB between them
+static unsigned long long _sample_hash(const FT_Byte* data, size_t size)
+{
+	const size_t edge = 64 * 1024;
+	const size_t chunk = 1024;
+	const size_t chunks = 64;
+
+	unsigned long long h = hash_bytes(&size, sizeof(size));
+	if ( size <= edge * 2 + chunk * chunks )
+	{
+		return hash_bytes(data, size, h);
+	}
+
+	h = hash_bytes(data, edge, h);
+	size_t step = (size - edge * 2) / chunks;
+	for ( size_t i = 0; i < chunks; i++ )
+	{
+		h = hash_bytes(data + edge + i * step, chunk, h);
+	}
+	return hash_bytes(data + size - edge, edge, h);
+}
+
+unsigned long long FaceManager::file_hash(const char* filename)
+{
+	struct stat st;
+	if ( stat(filename, &st) != 0 )
+	{
+		return hash_bytes(filename, strlen(filename));
+	}
+
+	pthread_mutex_lock(&s_face_mutex);
+
+	FileHash& entry = m_hashes[filename];
+	if ( entry.hash == 0 || entry.size != (long long)st.st_size || entry.mtime != (long long)st.st_mtime )
+	{
+		entry.size = st.st_size;
+		entry.mtime = st.st_mtime;
+
+		// mapped by faces of the file, or for the hash only
+		FontFile* file = _open_file(filename);
+		entry.hash = file ? _sample_hash(file->data, file->size) : hash_bytes(filename, strlen(filename));
+		if ( file )
+		{
+			_close_file(filename);
+		}
+	}
+	unsigned long long hash = entry.hash;
+
+	pthread_mutex_unlock(&s_face_mutex);
+
+	return hash;
+}
+
+FaceManager::FontFile* FaceManager::_open_file(const std::string& filename)
+{
+	std::map<std::string, FontFile>::iterator it = m_files.find(filename);
+	if ( it != m_files.end() )
+	{
+		it->second.ref_count++;
+		return &it->second;
+	}
+
+	FontFile file;
+	file.data = NULL;
+	file.size = 0;
+	file.ref_count = 1;
+
+#if defined(_WIN32)
+	FILE* f = fopen(filename.c_str(), "rb");
+	if ( !f )
+	{
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	FT_Byte* data = size > 0 ? (FT_Byte*)malloc(size) : NULL;
+	if ( !data || fread(data, size, 1, f) != 1 )
+	{
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	file.data = data;
+	file.size = size;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if ( fd < 0 )
+	{
+		return NULL;
+	}
+	struct stat st;
+	if ( fstat(fd, &st) != 0 || st.st_size == 0 )
+	{
+		close(fd);
+		return NULL;
+	}
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if ( data == MAP_FAILED )
+	{
+		return NULL;
+	}
+	file.data = (const FT_Byte*)data;
+	file.size = st.st_size;
+#endif
+
+	return &(m_files[filename] = file);
+}
+
+void FaceManager::_close_file(const std::string& filename)
+{
+	std::map<std::string, FontFile>::iterator it = m_files.find(filename);
+	if ( it == m_files.end() || --it->second.ref_count > 0 )
+	{
+		return;
+	}
+
+#if defined(_WIN32)
+	free((void*)it->second.data);
+#else
+	munmap((void*)it->second.data, it->second.size);
+#endif
+	m_files.erase(it);
+}
+
+}
@@ -0,0 +1,138 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#ifndef __DFONT_FACE_H__ 
+#define __DFONT_FACE_H__
+
+#include "dfont_config.h"
+
+#include <map>
+#include <list>
+#include <string>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_GLYPH_H
+
+namespace dfont
+{
+
+//
+// a face shared by fonts of the same file on the same library
+//	- only used by the thread owning the library
+//	- fonts set their own FT_Size on it
+//	- loaded glyphs are cached for fonts of the same size
+//
+class SharedFace
+{
+	friend class FaceManager;
+public:
+	FT_Face face();
+
+	// glyph loaded with the size, owned by the cache, NULL if failed
+	//	- linear_advance is the unhinted advance in 16.16
+	FT_Glyph load_glyph(FT_Size size, FT_UInt char_idx, FT_Fixed* linear_advance = NULL);
+
+	size_t cached_glyph_count();
+
+private:
+	struct GlyphKey
+	{
+		FT_Fixed x_scale;
+		FT_Fixed y_scale;
+		FT_UInt char_idx;
+
+		bool operator<(const GlyphKey& other) const;
+	};
+
+	struct CachedGlyph
+	{
+		FT_Glyph glyph;
+		FT_Fixed linear_advance;
+		std::list<GlyphKey>::iterator lru;	// position in m_lru
+	};
+
+	SharedFace(FT_Face face, FT_Library library, const std::string& filename, FT_Long face_idx);
+	~SharedFace();
+
+	FT_Face m_face;
+	FT_Library m_library;
+	std::string m_filename;
+	FT_Long m_face_idx;
+	size_t m_ref_count;
+
+	std::map<GlyphKey, CachedGlyph> m_glyphs;
+	std::list<GlyphKey> m_lru;	// most recently used at front
+};
+
+//
+// opens font files once
+//	- file data is mapped and shared by faces on all libraries
+//	- thread safe, worker libraries open faces in their threads
+//
+class FaceManager
+{
+public:
+	static FaceManager* instance();
+
+	// NULL if failed, give back by release
+	SharedFace* acquire(FT_Library library, const char* filename, FT_Long face_idx);
+	void release(SharedFace* face);
+
+	size_t face_count();
+	size_t file_count();
+
+	// content key of a font file, the path if it can not be read
+	//	- size and sampled bytes, hashed again only if size or mtime changed
+	unsigned long long file_hash(const char* filename);
+
+private:
+	struct FontFile
+	{
+		const FT_Byte* data;
+		size_t size;
+		size_t ref_count;
+	};
+
+	struct FileHash
+	{
+		long long size;
+		long long mtime;
+		unsigned long long hash;
+	};
+
+	FaceManager();
+	~FaceManager();
+
+	FontFile* _open_file(const std::string& filename);
+	void _close_file(const std::string& filename);
+
+	std::map<std::string, FontFile> m_files;
+	std::map<std::string, FileHash> m_hashes;	// kept after files are closed
+	std::list<SharedFace*> m_faces;
+};
+
+}
+
+#endif//__DFONT_FACE_H__
@@ -0,0 +1,184 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#include "dfont_index.h"
+#include "dfont_manager.h"
+
+#include <string.h>
+
+namespace dfont
+{
+
+GlyphIndex::GlyphIndex()
+	: m_direct_count(0), m_entries(NULL), m_mask(0), m_count(0)
+{
+	memset(m_direct, 0, sizeof(m_direct));
+}
+
+GlyphIndex::~GlyphIndex()
+{
+	delete[] m_entries;
+}
+
+void GlyphIndex::insert(GlyphSlot* slot)
+{
+	unsigned long charcode = key(slot->charcode, slot->phase);
+	if ( charcode < c_direct_size )
+	{
+		if ( !m_direct[charcode] )
+		{
+			m_direct_count++;
+		}
+		m_direct[charcode] = slot;
+		return;
+	}
+
+	if ( (m_count + 1) * 2 > m_mask + 1 )
+	{
+		_grow();
+	}
+
+	size_t i = _home(charcode);
+	while ( m_entries[i].slot && m_entries[i].charcode != charcode )
+	{
+		i = (i + 1) & m_mask;
+	}
+
+	if ( !m_entries[i].slot )
+	{
+		m_count++;
+	}
+	m_entries[i].charcode = charcode;
+	m_entries[i].slot = slot;
+}
+
+void GlyphIndex::erase(GlyphSlot* slot)
+{
+	unsigned long charcode = key(slot->charcode, slot->phase);
+	if ( charcode < c_direct_size )
+	{
+		if ( m_direct[charcode] == slot )
+		{
+			m_direct[charcode] = NULL;
+			m_direct_count--;
+		}
+		return;
+	}
+
+	if ( !m_count )
+	{
+		return;
+	}
+
+	size_t i = _home(charcode);
+	while ( m_entries[i].slot != slot )
+	{
+		if ( !m_entries[i].slot )
+		{
+			return;
+		}
+		i = (i + 1) & m_mask;
+	}
+
+	// shift back the following entries of the cluster, so no tombstone is needed
+	m_entries[i].slot = NULL;
+	m_count--;
+	for ( size_t j = (i + 1) & m_mask; m_entries[j].slot; j = (j + 1) & m_mask )
+	{
+		size_t home = _home(m_entries[j].charcode);
+
+		// entry j can move to i only if its home is not in (i, j]
+		bool movable = i <= j ? (home <= i || home > j) : (home <= i && home > j);
+		if ( movable )
+		{
+			m_entries[i] = m_entries[j];
+			m_entries[j].slot = NULL;
+			i = j;
+		}
+	}
+}
+
+void GlyphIndex::slots(std::vector<GlyphSlot*>* out)
+{
+	for ( size_t i = 0; i < c_direct_size; i++ )
+	{
+		if ( m_direct[i] )
+		{
+			out->push_back(m_direct[i]);
+		}
+	}
+
+	for ( size_t i = 0; m_count && i <= m_mask; i++ )
+	{
+		if ( m_entries[i].slot )
+		{
+			out->push_back(m_entries[i].slot);
+		}
+	}
+}
+
+void GlyphIndex::clear()
+{
+	memset(m_direct, 0, sizeof(m_direct));
+	m_direct_count = 0;
+
+	if ( m_entries )
+	{
+		memset(m_entries, 0, sizeof(Entry) * (m_mask + 1));
+	}
+	m_count = 0;
+}
+
+size_t GlyphIndex::size()
+{
+	return m_direct_count + m_count;
+}
+
+void GlyphIndex::_grow()
+{
+	Entry* old_entries = m_entries;
+	size_t old_capacity = m_entries ? m_mask + 1 : 0;
+
+	size_t capacity = old_capacity ? old_capacity * 2 : c_initial_capacity;
+	m_entries = new Entry[capacity];
+	memset(m_entries, 0, sizeof(Entry) * capacity);
+	m_mask = capacity - 1;
+
+	for ( size_t i = 0; i < old_capacity; i++ )
+	{
+		if ( old_entries[i].slot )
+		{
+			size_t j = _home(old_entries[i].charcode);
+			while ( m_entries[j].slot )
+			{
+				j = (j + 1) & m_mask;
+			}
+			m_entries[j] = old_entries[i];
+		}
+	}
+
+	delete[] old_entries;
+}
+
+}
@@ -0,0 +1,119 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#ifndef __DFONT_INDEX_H__ 
+#define __DFONT_INDEX_H__
+
+#include "dfont_config.h"
+
+#include <stddef.h>
+#include <vector>
+
+namespace dfont
+{
+
+struct GlyphSlot;
+
+//
+// charcode to glyph slot index of a font catalog
+//	- latin-1 chars are looked up in a direct array
+//	- others in an open addressing table with linear probing
+//	- slots carry their charcode, so they are removed by pointer
+//	- subpixel variants are keyed with their phase above unicode range
+//
+class GlyphIndex
+{
+public:
+	GlyphIndex();
+	~GlyphIndex();
+
+	// key of a glyph variant, the charcode itself for phase 0
+	static unsigned long key(unsigned long charcode, int phase)
+	{
+		return charcode | ((unsigned long)phase << 24);
+	}
+
+	// NULL if not found, charcode is a key for variants
+	GlyphSlot* find(unsigned long charcode) const
+	{
+		if ( charcode < c_direct_size )
+		{
+			return m_direct[charcode];
+		}
+
+		if ( !m_count )
+		{
+			return NULL;
+		}
+
+		for ( size_t i = _home(charcode); m_entries[i].slot; i = (i + 1) & m_mask )
+		{
+			if ( m_entries[i].charcode == charcode )
+			{
+				return m_entries[i].slot;
+			}
+		}
+		return NULL;
+	}
+
+	// replace the slot of the same charcode
+	void insert(GlyphSlot* slot);
+
+	void erase(GlyphSlot* slot);
+
+	// all slots in no order
+	void slots(std::vector<GlyphSlot*>* out);
+
+	void clear();
+
+	size_t size();
+
+private:
+	enum { c_direct_size = 256, c_initial_capacity = 64 };
+
+	struct Entry
+	{
+		unsigned long charcode;
+		GlyphSlot* slot;	// NULL for an empty entry
+	};
+
+	size_t _home(unsigned long charcode) const
+	{
+		return ((unsigned int)charcode * 0x9E3779B1u >> 7) & m_mask;
+	}
+
+	// double the table, keep load factor under 1/2
+	void _grow();
+
+	GlyphSlot* m_direct[c_direct_size];
+	size_t m_direct_count;
+
+	Entry* m_entries;
+	size_t m_mask;
+	size_t m_count;
+};
+
+}
+
+#endif//__DFONT_INDEX_H__
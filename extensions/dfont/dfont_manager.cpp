@@ -25,12 +25,14 @@
 #include "dfont_manager.h"
 #include "dfont_utility.h"
 #include "dfont_render.h"
-
-#include <cocos2d.h>
+#include "dfont_async.h"
+#include "dfont_diskcache.h"
+#include "dfont_atlas.h"
+#include "dfont_utf8.h"
 
 #include <fstream>
-
-using namespace cocos2d;
+#include <math.h>
+#include <assert.h>
 
 namespace dfont
 {
@@ -42,7 +44,7 @@ void GlyphSlot::retain()
 	++ref_count;
 	if ( ref_count == 1 )
 	{
-		texture->_slot_inuse(this);
+		catalog->_lru_unlink(this);
 	}
 }
 void GlyphSlot::release()
@@ -50,70 +52,73 @@ void GlyphSlot::release()
 	--ref_count;
 	if ( ref_count == 0 )
 	{
-		texture->_slot_nouse(this);
+		catalog->_lru_push(this);
 	}
 }
 
 
-WTexture2D::WTexture2D(FontInfo* f, int width, int height, int padding_width, int padding_height)
-	: m_font(f), m_width(width), m_height(height), 
-	m_padding_width(padding_width), m_padding_height(padding_height),
-	m_data(NULL), m_user_texture(NULL)
+static ITextureBackend* s_texture_backend = NULL;
+
+RecordingTextureBackend::RecordingTextureBackend()
+	: m_texture_count(0), m_upload_calls(0), m_upload_bytes(0)
 {
-	m_cols = m_width/m_padding_width;
-	m_rows = m_height/m_padding_height;
-	m_slot_num = m_cols * m_rows;
-	m_slots = new GlyphSlot[m_slot_num];
+}
 
-	for ( size_t i = 0; i < m_slot_num; i++ )
-	{
-		_init_slot(i);
-	}
+void* RecordingTextureBackend::create_texture(WTexture2D* texture, const unsigned char* data)
+{
+	m_texture_count++;
+	return NULL;
+}
 
-#if _DFONT_DEBUG
-	m_data = new unsigned char[width * height * 4];
-	memset(m_data, 0, width * height * 4);
+void RecordingTextureBackend::destroy_texture(WTexture2D* texture, void* user_texture)
+{
+	m_texture_count--;
+}
 
-	for( int i = 0; i < width * height * 4; i+=4 )
-	{
-		int row = (i/4) / width;
-		int col = (i/4) % width;
-		if (col % m_padding_width == 0 || row % m_padding_height == 0)
-		{
-			//int* p = &m_data[i];
-			*(int*)(&m_data[i]) = 0xffff0000;
-		}
-		else
-		{
-			*(int*)(&m_data[i]) = 0x80008000;
-		}
-	}
-#endif//_DFONT_DEBUG
+void RecordingTextureBackend::upload_rows(WTexture2D* texture, int y, int rows, const unsigned char* data)
+{
+	m_upload_calls++;
+	m_upload_bytes += texture->width() * rows * texture->bytes_per_pixel();
+}
 
-	CCTexture2D* tex = new CCTexture2D;
-	tex->initWithData(m_data, kCCTexture2DPixelFormat_RGBA8888, m_width, m_height, CCSize(m_width, m_height));
+size_t RecordingTextureBackend::texture_count()
+{
+	return m_texture_count;
+}
 
-	if ( m_font->is_bitmap() )
-	{
-		tex->setAliasTexParameters();
-	}
-	else
-	{
-		tex->setAntiAliasTexParameters();
-	}
-	
-	m_user_texture = tex;
+size_t RecordingTextureBackend::upload_calls()
+{
+	return m_upload_calls;
+}
+
+size_t RecordingTextureBackend::upload_bytes()
+{
+	return m_upload_bytes;
+}
+
+void RecordingTextureBackend::reset()
+{
+	m_upload_calls = 0;
+	m_upload_bytes = 0;
+}
+
+
+WTexture2D::WTexture2D(int width, int height, int bytes_per_pixel, bool smooth)
+	: m_packer(width, height), m_width(width), m_height(height), 
+	m_bytes_per_pixel(bytes_per_pixel), m_smooth(smooth), m_data(NULL), m_backend(texture_backend()), m_user_texture(NULL)
+{
+	m_data = new unsigned char[width * height * m_bytes_per_pixel];
+	memset(m_data, 0, width * height * m_bytes_per_pixel);
+
+	m_user_texture = m_backend->create_texture(this, m_data);
 }
 
 WTexture2D::~WTexture2D()
 {
-	m_dirty_slots.clear();
-	if ( m_user_texture )
-	{
-		user_texture<CCTexture2D>()->release();
-		m_user_texture = NULL;
-	}
-	delete[] m_slots;
+	m_dirty_rows.clear();
+	m_backend->destroy_texture(this, m_user_texture);
+	m_user_texture = NULL;
+	m_slots.clear();
 	delete[] m_data;
 }
 
@@ -125,165 +130,148 @@ int WTexture2D::height()
 {
 	return m_height;
 }
+int WTexture2D::bytes_per_pixel()
+{
+	return m_bytes_per_pixel;
+}
+bool WTexture2D::smooth()
+{
+	return m_smooth;
+}
 
 // flush data to GPU
 void WTexture2D::flush()
 {
-    //box@hulijun.cn: fix skewed bug
-    //http://www.opengl.org/archives/resources/features/KilgardTechniques/oglpitfall/
-    //GL_UNPACK_ALIGNMENT
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if ( m_dirty_rows.empty() )
+	{
+		return;
+	}
 
-	ccGLBindTexture2D(user_texture<CCTexture2D>()->getName());
+	// merge dirty rows into bands, close bands are merged too
+	std::sort(m_dirty_rows.begin(), m_dirty_rows.end());
 
-	for ( size_t i = 0; i < m_dirty_slots.size(); i++ )
+	int band_first = m_dirty_rows[0].first;
+	int band_last = m_dirty_rows[0].second;
+	for ( size_t i = 1; i <= m_dirty_rows.size(); i++ )
 	{
-		GlyphSlot* slot = m_dirty_slots[i];		
+		if ( i < m_dirty_rows.size() && m_dirty_rows[i].first <= band_last + DFONT_UPLOAD_MERGE_ROWS )
+		{
+			band_last = band_last > m_dirty_rows[i].second ? band_last : m_dirty_rows[i].second;
+			continue;
+		}
 
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 
-			slot->padding_rect.origin_x, slot->padding_rect.origin_y,
-			slot->bitmap->real_width(), slot->bitmap->real_height(),
-			GL_RGBA, GL_UNSIGNED_BYTE, slot->bitmap->get_buffer()
-			);
+		m_backend->upload_rows(this, band_first, band_last - band_first, 
+			m_data + band_first * m_width * m_bytes_per_pixel);
 
-		slot->bitmap->release();
-		slot->bitmap = NULL;
+		if ( i < m_dirty_rows.size() )
+		{
+			band_first = m_dirty_rows[i].first;
+			band_last = m_dirty_rows[i].second;
+		}
 	}
 
-	m_dirty_slots.clear();
+	m_dirty_rows.clear();
 }
 
-bool WTexture2D::has_empty_slot()
+void WTexture2D::set_texture_backend(ITextureBackend* backend)
 {
-	return m_emptyslots.empty() == false;
+	s_texture_backend = backend;
 }
 
-GlyphSlot* WTexture2D::cache_charcode(utf32 charcode)
+ITextureBackend* WTexture2D::texture_backend()
 {
-	GlyphSlot* slot = NULL;
+	return s_texture_backend ? s_texture_backend : default_texture_backend();
+}
 
-	if ( m_emptyslots.empty() )
+bool WTexture2D::cache_charcode(GlyphBitmap* bm, GlyphSlot* slot)
+{
+	PaddingRect rect;
+	if ( !m_packer.alloc(bm->bitmap->real_width(), bm->bitmap->real_height(), &rect) )
 	{
-		return NULL;
+		// no more room yet!
+		return false;
 	}
-	slot = *m_emptyslots.begin();
 
-	if ( slot )
-	{
-		GlyphBitmap bm;
-		if ( m_font->render_charcode(charcode, &bm) )
-		{
-			slot->charcode = charcode;
-			slot->metrics.left = bm.top_left_pixels.x;
-			slot->metrics.top = bm.top_left_pixels.y;
-			slot->metrics.width = bm.bitmap->width();
-			slot->metrics.height = bm.bitmap->height();
-			slot->metrics.advance_x = bm.advance_pixels.x;
-			slot->metrics.advance_y = bm.advance_pixels.y;
-			slot->bitmap = bm.bitmap;
-			slot->padding_rect.width = bm.bitmap->real_width();
-			slot->padding_rect.height = bm.bitmap->real_height();
-
-#if _DFONT_DEBUG
-			_dump2texture(bm.bitmap, slot->padding_rect, false);
-#endif
-
-			// bitmap will release later after update texture
-			m_dirty_slots.push_back(slot);
-		}
-		else
-		{
-			// render a bad char!
-			slot = NULL;
-		}
-	}
+	slot->texture = this;
+	slot->padding_rect = rect;
+	slot->metrics.left = bm->top_left_pixels.x;
+	slot->metrics.top = bm->top_left_pixels.y;
+	slot->metrics.width = bm->bitmap->width();
+	slot->metrics.height = bm->bitmap->height();
+	slot->metrics.advance_x = bm->advance_pixels.x;
+	slot->metrics.advance_y = bm->advance_pixels.y;
+	slot->metrics.advance_x_26dot6 = bm->advance_x_26dot6;
 
-	// no more free slot yet!
-	return slot;
+	m_slots.insert(slot);
+
+	_copy2texture(bm->bitmap, rect);
+	m_dirty_rows.push_back(std::make_pair(rect.origin_y, rect.origin_y + rect.height));
+
+	return true;
 }
 
-unsigned char* WTexture2D::buffer_data()
+void WTexture2D::uncache(GlyphSlot* slot)
 {
-	return m_data;
+	m_packer.free(slot->padding_rect);
+	m_slots.erase(slot);
+	slot->texture = NULL;
 }
 
-void WTexture2D::dump_textures(const char* prefix, int index)
+ShelfPacker WTexture2D::packer()
 {
-	char path_buffer[256];
-	sprintf(path_buffer, "%sdfont_%s_%2d.tga", CCFileUtils::sharedFileUtils()->getWritablePath().c_str(), prefix, index);
-
-#if	_DFONT_DEBUG
-	if ( m_data )
-	{
-		dump2tga(path_buffer, (unsigned int*)m_data, this->width(), this->height());
-	}
-#endif//_DFONT_DEBUG
+	return m_packer;
 }
 
-void WTexture2D::_init_slot(int i)
+size_t WTexture2D::glyph_count()
 {
-	GlyphSlot& slot = m_slots[i];
-	slot.charcode = 0;
-	slot.ref_count = 0;
-	slot.texture = this;
-	slot.padding_rect.width = m_padding_width;
-	slot.padding_rect.height = m_padding_height;
-	slot.padding_rect.origin_x = i % m_cols * m_padding_width;
-	slot.padding_rect.origin_y = i / m_cols * m_padding_height;
-
-	m_emptyslots.insert(&slot);
+	return m_slots.size();
 }
 
-void WTexture2D::_slot_nouse(GlyphSlot* slot)
+float WTexture2D::occupancy()
 {
-	m_emptyslots.insert(slot);
+	return m_packer.occupancy();
 }
 
-void WTexture2D::_slot_inuse(GlyphSlot* slot)
+unsigned char* WTexture2D::buffer_data()
 {
-	std::set<GlyphSlot*>::iterator it = m_emptyslots.find(slot);
-	if(it != m_emptyslots.end())
-	{
-		m_emptyslots.erase(it);
-	}
+	return m_data;
 }
 
-void WTexture2D::_dump2texture(IBitmap* bitmap, const PaddingRect& rect, bool draw_cbox/* = false*/)
+void WTexture2D::dump_textures(const char* prefix, int index)
 {
-	FT_Int  i, j, p, q;
-	FT_Int  x_max = rect.origin_x + bitmap->width();
-	FT_Int  y_max = rect.origin_y + bitmap->height();
+	char path_buffer[256];
+	sprintf(path_buffer, "%sdfont_%s_%2d.tga", writable_path().c_str(), prefix, index);
 
-	for ( i = rect.origin_x, p = 0; i < x_max; i++, p++ )
+#if	_DFONT_DEBUG
+	if ( m_bytes_per_pixel == 4 )
+	{
+		dump2tga(path_buffer, (unsigned int*)m_data, this->width(), this->height());
+	}
+	else
 	{
-		for ( j = rect.origin_y, q = 0; j < y_max; j++, q++ )
+		// white with alpha
+		std::vector<unsigned int> pixels(m_width * m_height);
+		for ( size_t i = 0; i < pixels.size(); i++ )
 		{
-			if ( i < 0 || j < 0 || i >= m_width || j >= m_height )
-				continue;
+			pixels[i] = ((unsigned int)m_data[i] << 24) | 0x00ffffff;
+		}
+		dump2tga(path_buffer, &pixels[0], this->width(), this->height());
+	}
+#endif//_DFONT_DEBUG
+}
 
-			int pos = j * m_width * 4 + i * 4;
-			ColorRGBA src = bitmap->get_unit_at(p, q);
-			ColorRGBA bgc(m_data[pos + 0], m_data[pos + 1 ], m_data[pos + 2 ], m_data[pos + 3 ]);
-			ReplaceBlender blender;
-			ColorRGBA color = blender.blend(src, bgc);
-			//if ( color.a )
-			{
-				m_data[pos + 0 ] = color.r;
-				m_data[pos + 1 ] = color.g;
-				m_data[pos + 2 ] = color.b;
-				m_data[pos + 3 ] = color.a;
-			}
+void WTexture2D::_copy2texture(IBitmap* bitmap, const PaddingRect& rect)
+{
+	const unsigned char* src = (const unsigned char*)bitmap->get_buffer();
+	size_t src_pitch = bitmap->real_width() * m_bytes_per_pixel;
+	size_t dst_pitch = m_width * m_bytes_per_pixel;
+	unsigned char* dst = m_data + rect.origin_y * dst_pitch + rect.origin_x * m_bytes_per_pixel;
 
-			// draw cbox
-			if (draw_cbox)
-				if ( p == 0 || q == 0 || p == bitmap->width() - 1 || q == bitmap->height() - 1 )
-				{
-					m_data[pos + 0 ] = 0x00;
-					m_data[pos + 1 ] = 0xff;
-					m_data[pos + 2 ] = 0x00;
-					m_data[pos + 3 ] = 0xff;
-				}
-		}
+	for ( int row = 0; row < bitmap->real_height(); row++ )
+	{
+		memcpy(dst, src, src_pitch);
+		src += src_pitch;
+		dst += dst_pitch;
 	}
 }
 
@@ -291,26 +279,16 @@ void FontCatalog::require_text(utf16* text, size_t len, std::vector<GlyphSlot*>*
 {
 	for ( size_t i = 0; i < len; i++ )
 	{
-		GlyphSlot* slot = NULL;
-
-		if ( cocos2d::isspace_unicode(text[i]) )
-		{
-			slot = require_char(c_char_blank);
-		}
-		else
-		{
-			slot = require_char(text[i]);
-		}
+		utf32 code = text[i];
 
-		if ( !slot )
+		// surrogate pair
+		if ( code >= 0xd800 && code <= 0xdbff && i + 1 < len && text[i + 1] >= 0xdc00 && text[i + 1] <= 0xdfff )
 		{
-			slot = require_char(c_char_invalid);
+			code = 0x10000 + ((code - 0xd800) << 10) + (text[i + 1] - 0xdc00);
+			i++;
 		}
 
-		if ( slot )
-		{
-			glyph_slots->push_back(slot);
-		}
+		_require_code(code, glyph_slots);
 	}
 	this->flush();
 }
@@ -319,93 +297,126 @@ void FontCatalog::require_text(utf32* text, size_t len, std::vector<GlyphSlot*>*
 {
 	for ( size_t i = 0; i < len; i++ )
 	{
-		GlyphSlot* slot = NULL;
-
-		if ( cocos2d::isspace_unicode((utf16)text[i]) )
-		{
-			slot = require_char(c_char_blank);
-		}
-		else
-		{
-			slot = require_char(text[i]);
-		}
+		_require_code(text[i], glyph_slots);
+	}
+	this->flush();
+}
 
-		if ( !slot )
-		{
-			slot = require_char(c_char_invalid);
-		}
+void FontCatalog::require_text(const char* utf8_begin, const char* utf8_end, std::vector<GlyphSlot*>* glyph_slots)
+{
+	Utf8Decoder decoder(utf8_begin, utf8_end);
 
-		if ( slot )
+	// decoded in chunks on stack
+	utf32 codes[256];
+	size_t count;
+	while ( (count = decoder.decode(codes, 256)) > 0 )
+	{
+		for ( size_t i = 0; i < count; i++ )
 		{
-			glyph_slots->push_back(slot);
+			_require_code(codes[i], glyph_slots);
 		}
 	}
 	this->flush();
 }
 
-GlyphSlot* FontCatalog::require_char(utf32 charcode)
+void FontCatalog::_require_code(utf32 code, std::vector<GlyphSlot*>* glyph_slots)
+{
+	GlyphSlot* slot = NULL;
+
+	if ( isspace_unicode(code) )
+	{
+		slot = require_char(c_char_blank);
+	}
+	else
+	{
+		slot = require_char(code);
+	}
+
+	if ( !slot )
+	{
+		m_fallback_count++;
+		slot = require_char(c_char_invalid);
+	}
+
+	if ( slot )
+	{
+		glyph_slots->push_back(slot);
+	}
+}
+
+GlyphSlot* FontCatalog::require_char(utf32 charcode, int phase /*= 0*/)
 {
+	if ( m_source )
+	{
+		return m_source->require_char(charcode, phase);
+	}
+
+	// variants are keyed by quarter pixels, they stay valid if phases changes
+	int phases = subpixel_phases(charcode);
+	int quarter = phase > 0 && phase < phases ? phase * 4 / phases : 0;
+
 	GlyphSlot* slot = NULL;
-	bool invalid_char = false;
 
 	// find if already created
-	glyph_map_t::iterator it = m_glyphmap.find(charcode);
-	if ( it != m_glyphmap.end() )
+	slot = m_glyphmap.find(GlyphIndex::key(charcode, quarter));
+	if ( slot )
 	{
-		slot = it->second;
+		m_hit_count++;
 	}
 	else
 	{
-		//
-		// create a new char
-		//
+		m_miss_count++;
 
-		for ( size_t i = 0; i < m_textures.size(); i++ )
+		// variants are not kept in the disk cache
+		GlyphBitmap bm;
+		bool loaded = quarter == 0 && m_diskcache && m_diskcache->load(charcode, &bm);
+		if ( !loaded && m_async && m_atlas->saturated(m_bytes_per_pixel, m_smooth) )
 		{
-			if ( m_textures[i]->has_empty_slot() )
-			{
-				slot = m_textures[i]->cache_charcode(charcode);
-				if ( !slot )
-				{
-					invalid_char = true;
-				}
-				break;
-			}
+			// the result would be dropped again until glyphs are released
+			m_saturation_count++;
 		}
+		else if ( !loaded && m_async )
+		{
+			//
+			// create a pending char, filled when rasterized
+			//
+			m_pending_count++;
+
+			slot = _new_slot(charcode, quarter);
+			slot->metrics.advance_x = m_font->char_width_pt();
+			slot->metrics.advance_x_26dot6 = slot->metrics.advance_x << 6;
+			_add_to_map(slot);
 
-		if ( !invalid_char && !slot )
+			m_async->post(this, m_font, charcode, quarter, quarter << 4);
+		}
+		else if ( loaded || m_font->render_charcode(charcode, &bm, quarter << 4) )
 		{
-			// no more empty slots, create a new texture
-			if (!slot && (int)m_textures.size() < m_max_textures)
+			//
+			// create a new char
+			//
+			if ( !loaded )
 			{
-				WTexture2D* newtex = new WTexture2D(
-					m_font, m_texture_width, m_texture_height, 
-					m_padding_width + DFONT_BITMAP_PADDING*2, m_padding_height + DFONT_BITMAP_PADDING*2);
-				m_textures.push_back(newtex);
-				slot = newtex->cache_charcode(charcode);
-
-				if ( !slot )
+				m_raster_count++;
+				if ( m_diskcache && quarter == 0 )
 				{
-					invalid_char = true;
+					m_diskcache->store(charcode, &bm);
 				}
 			}
-		}
 
-		// invalid char code
-		if ( invalid_char )
-		{
-			//glyph_map_t::iterator it = m_glyphmap.find(c_char_invalid);
-			//if ( it != m_glyphmap.end() )
-			//{
-			//	slot = it->second;
-			//}
-		}
-		// new char
-		else if ( slot )
-		{
-			_remove_from_map(slot);// remove previous slot map
-			_add_to_map(slot);
+			slot = _new_slot(charcode, quarter);
+			if ( _cache_bitmap(&bm, slot) )
+			{
+				_add_to_map(slot);
+			}
+			else
+			{
+				// bitmap can not fit in texture
+				delete slot;
+				slot = NULL;
+			}
+			bm.bitmap->release();
 		}
+		// else: render a bad char!
 	}
 
 	if ( slot )
@@ -423,147 +434,902 @@ GlyphSlot* FontCatalog::require_char(utf32 charcode)
 
 std::vector<WTexture2D*>* FontCatalog::textures()
 {
-	return &m_textures;
+	if ( m_source )
+	{
+		return m_source->textures();
+	}
+
+	return m_atlas->pages(m_bytes_per_pixel, m_smooth);
 }
 
 void FontCatalog::flush()
 {
-	for ( size_t i = 0; i < m_textures.size(); i++ )
+	if ( m_source )
 	{
-		m_textures[i]->flush();
+		m_source->flush();
+		return;
 	}
 
-	m_previous_char_idx = 0;
+	m_atlas->flush();
+
+	if ( m_diskcache )
+	{
+		m_diskcache->flush();
+	}
 }
 
 unsigned int FontCatalog::char_width()
 {
+	if ( m_source )
+	{
+		return (unsigned int)(m_source->char_width() * m_scale + 0.5f);
+	}
+
 	return m_font->char_width_pt();
 }
 
 unsigned int FontCatalog::char_height()
 {
+	if ( m_source )
+	{
+		return (unsigned int)(m_source->char_height() * m_scale + 0.5f);
+	}
+
 	return m_font->char_height_pt();
 }
 
-bool FontCatalog::add_hackfont(const char* fontname, std::set<unsigned long>* charset, unsigned int shift_y /*= 0*/)
+int FontCatalog::kerning(utf32 left_code, utf32 right_code)
 {
-	return add_hackfont(fontname, 0, charset, shift_y);
-}
+	if ( m_source )
+	{
+		return (int)floorf(m_source->kerning(left_code, right_code) * m_scale + 0.5f);
+	}
 
-bool FontCatalog::add_hackfont(const char* fontname, long face_idx, std::set<unsigned long>* charset, unsigned int shift_y)
-{
-	return m_font->add_hackfont(fontname, face_idx, charset, shift_y) != NULL;
+	return m_font->kerning(left_code, right_code);
 }
 
-void FontCatalog::dump_textures(const char* prefix)
+void FontCatalog::set_subpixel_phases(int phases)
 {
-	for ( size_t i = 0; i < m_textures.size(); i++ )
+	// distance field glyphs are scaled, no use
+	if ( m_sdf )
 	{
-		m_textures[i]->dump_textures(prefix, i);
+		return;
 	}
+
+	m_subpixel_phases = phases >= 4 ? 4 : (phases >= 2 ? 2 : 1);
 }
 
-FontCatalog::FontCatalog(FontInfo* f, int texture_width, int texture_height, int max_textures/*=2*/)
-	: m_font(f), 
-	m_max_textures(max_textures),
-	m_texture_width(texture_width), 
-	m_texture_height(texture_height), 
-	m_previous_char_idx(0)
+int FontCatalog::subpixel_phases(utf32 charcode)
 {
-	int font_size = (int)(f->char_width_pt() > f->char_height_pt() ? f->char_width_pt() : f->char_height_pt());
-	font_size += f->extend_pt();
-	m_padding_width = font_size;
-	m_padding_height = font_size;
+	return charcode <= DFONT_SUBPIXEL_LAST_CHAR ? m_subpixel_phases : 1;
 }
 
-FontCatalog::~FontCatalog()
+bool FontCatalog::add_hackfont(const char* fontname, std::set<unsigned long>* charset, unsigned int shift_y /*= 0*/)
 {
-	m_glyphmap.clear();
-	m_reverse_glyphmap.clear();
-	for ( size_t i = 0; i < m_textures.size(); i++ )
+	return add_hackfont(fontname, 0, charset, shift_y);
+}
+
+bool FontCatalog::add_hackfont(const char* fontname, long face_idx, std::set<unsigned long>* charset, unsigned int shift_y)
+{
+	if ( m_source )
+	{
+		return m_source->add_hackfont(fontname, face_idx, charset, shift_y);
+	}
+
+	if ( !m_font->add_hackfont(fontname, face_idx, charset, shift_y) )
+	{
+		return false;
+	}
+
+	// workers clone the changed font again
+	if ( m_async )
+	{
+		m_async->drop_font(m_font);
+	}
+
+	if ( m_diskcache )
 	{
-		delete m_textures[i];
+		_open_diskcache();
 	}
-	m_textures.clear();
-	m_font->release();
+	return true;
 }
 
-void FontCatalog::_add_to_map(GlyphSlot* slot)
+float FontCatalog::occupancy()
 {
-	m_glyphmap[slot->charcode] = slot;
-	m_reverse_glyphmap[slot] = slot->charcode;
+	if ( m_source )
+	{
+		return m_source->occupancy();
+	}
+
+	std::vector<WTexture2D*>* pages = textures();
+	if ( pages->empty() )
+	{
+		return 0.0f;
+	}
+
+	float total = 0.0f;
+	for ( size_t i = 0; i < pages->size(); i++ )
+	{
+		total += (*pages)[i]->occupancy();
+	}
+	return total / pages->size();
 }
 
-void FontCatalog::_remove_from_map(GlyphSlot* slot)
+size_t FontCatalog::hit_count()
 {
-	reverse_glyph_map_t::iterator it = m_reverse_glyphmap.find(slot);
-	if ( it != m_reverse_glyphmap.end() )
+	if ( m_source )
 	{
-		m_glyphmap.erase(it->second);
-		m_reverse_glyphmap.erase(it);
+		return m_source->hit_count();
 	}
-}
 
+	return m_hit_count;
+}
 
-FontCatalog* FontFactory::find_font(const char* alias, bool no_fail /*= true*/)
+size_t FontCatalog::miss_count()
 {
-	if ( !alias )
-		alias = DFONT_DEFAULT_FONTALIAS;
-	
-	std::map<std::string, FontCatalog*>::iterator it = m_fonts.find(alias);
-	if ( it != m_fonts.end() )
+	if ( m_source )
 	{
-		return it->second;
+		return m_source->miss_count();
 	}
 
-	if ( no_fail )
-		return m_fonts[DFONT_DEFAULT_FONTALIAS];
-
-	return NULL;
+	return m_miss_count;
 }
 
-FontCatalog* FontFactory::another_alias(const char* another_alias, const char* origin_alias)
+size_t FontCatalog::eviction_count()
 {
-	FontCatalog* fontc = find_font(origin_alias);
-
-	if ( fontc )
+	if ( m_source )
 	{
-		m_fonts[another_alias] = fontc;
+		return m_source->eviction_count();
 	}
 
-	return fontc;
+	return m_eviction_count;
 }
 
-FontCatalog* FontFactory::create_font(
-	const char* alias, const char* font_name, unsigned int color, int size_pt,
-	EFontStyle style/*=e_plain*/, float strength/*=1.0f*/, unsigned int secondary_color/*=0xff000000*/, 
-	int faceidx/*=0*/, int ppi/*=DFONT_DEFAULT_FONTPPI*/
-	)
+void FontCatalog::reset_counters()
 {
-	if ( !alias )
+	if ( m_source )
 	{
-		return NULL;
+		m_source->reset_counters();
+		return;
 	}
-	FontCatalog* catalog = find_font(alias, false);
-	FontInfo* font = NULL;
-	if ( catalog )
+
+	m_hit_count = 0;
+	m_miss_count = 0;
+	m_eviction_count = 0;
+	m_raster_count = 0;
+	m_saturation_count = 0;
+	m_fallback_count = 0;
+}
+
+void FontCatalog::stats(CatalogStats* stats)
+{
+	if ( m_source )
 	{
-		// the alias is already in used, return it.
-		return catalog;
+		// fallback chars are counted by require_text of the alias
+		m_source->stats(stats);
+		stats->fallback_count += m_fallback_count;
+		return;
 	}
 
-	std::string fullpath = CCFileUtils::sharedFileUtils()->fullPathForFilename(font_name);
+	memset(stats, 0, sizeof(CatalogStats));
 
-	font = FontInfo::create_font(s_ft_library, fullpath.c_str(), faceidx, size_pt, size_pt, ppi);
-	if ( !font )
+	std::vector<WTexture2D*>* pages = textures();
+	stats->texture_count = pages->size();
+	for ( size_t i = 0; i < pages->size(); i++ )
 	{
-		return find_font(DFONT_DEFAULT_FONTALIAS);
+		stats->texture_bytes += (*pages)[i]->width() * (*pages)[i]->height() * (*pages)[i]->bytes_per_pixel();
 	}
+	stats->occupancy = occupancy();
+
+	stats->glyph_count = m_glyphmap.size();
+	stats->unused_count = m_lru_count;
+	stats->pinned_count = stats->glyph_count - m_lru_count;
+	stats->pending_count = m_pending_count;
+	stats->variant_count = m_variant_count;
+
+	stats->hit_count = m_hit_count;
+	stats->miss_count = m_miss_count;
+	stats->eviction_count = m_eviction_count;
+	stats->raster_count = m_raster_count;
+	stats->saturation_count = m_saturation_count;
+	stats->fallback_count = m_fallback_count;
+}
 
-	switch (style)
+void FontCatalog::set_async(AsyncRasterizer* async)
+{
+	if ( m_source )
 	{
-	case e_plain:
+		m_source->set_async(async);
+		return;
+	}
+
+	m_async = async;
+}
+
+size_t FontCatalog::pending_count()
+{
+	if ( m_source )
+	{
+		return m_source->pending_count();
+	}
+
+	return m_pending_count;
+}
+
+unsigned int FontCatalog::tint()
+{
+	return m_tint;
+}
+
+const SDFEffect* FontCatalog::sdf_effect()
+{
+	return m_sdf ? &m_sdf_effect : NULL;
+}
+
+float FontCatalog::scale()
+{
+	return m_scale;
+}
+
+void FontCatalog::enable_diskcache(bool enable)
+{
+	if ( m_source )
+	{
+		m_source->enable_diskcache(enable);
+		return;
+	}
+
+	if ( enable && !m_diskcache )
+	{
+		_open_diskcache();
+	}
+	else if ( !enable && m_diskcache )
+	{
+		FontFactory::instance()->_release_diskcache(m_diskcache);
+		m_diskcache = NULL;
+	}
+}
+
+size_t FontCatalog::warm_from_diskcache()
+{
+	if ( m_source )
+	{
+		return m_source->warm_from_diskcache();
+	}
+
+	if ( !m_diskcache )
+	{
+		return 0;
+	}
+
+	std::vector<utf32> charcodes;
+	m_diskcache->charcodes(&charcodes);
+
+	size_t count = 0;
+	for ( size_t i = 0; i < charcodes.size(); i++ )
+	{
+		GlyphBitmap bm;
+		if ( m_glyphmap.find(charcodes[i]) || !m_diskcache->load(charcodes[i], &bm) )
+		{
+			continue;
+		}
+
+		// never evict glyphs for warming
+		GlyphSlot* slot = _new_slot(charcodes[i]);
+		bool cached = _cache_bitmap(&bm, slot, false);
+		bm.bitmap->release();
+		if ( !cached )
+		{
+			delete slot;
+			break;
+		}
+
+		_add_to_map(slot);
+		_lru_push(slot);
+		count++;
+	}
+
+	flush();
+	return count;
+}
+
+void FontCatalog::prewarm(const std::set<unsigned long>* charset, float budget_ms /*= DFONT_PREWARM_BUDGET_MS*/)
+{
+	std::vector<utf32> chars(charset->begin(), charset->end());
+	_prewarm(chars, budget_ms);
+}
+
+bool FontCatalog::prewarm(const char* corpus_file, size_t max_chars, float budget_ms /*= DFONT_PREWARM_BUDGET_MS*/)
+{
+	std::vector<utf32> chars;
+	if ( !frequent_chars(corpus_file, max_chars, &chars) )
+	{
+		return false;
+	}
+
+	_prewarm(chars, budget_ms);
+	return true;
+}
+
+bool FontCatalog::update_prewarm()
+{
+	if ( m_source )
+	{
+		return m_source->update_prewarm();
+	}
+
+	// async results arrived, failed or evicted ones are not in the map
+	for ( size_t i = 0; i < m_prewarm_pending.size(); )
+	{
+		GlyphSlot* slot = m_glyphmap.find(m_prewarm_pending[i]);
+		if ( slot && !slot->texture )
+		{
+			i++;
+			continue;
+		}
+
+		if ( slot )
+		{
+			slot->retain();
+			_pin_prewarm(slot);
+		}
+		m_prewarm_pending[i] = m_prewarm_pending.back();
+		m_prewarm_pending.pop_back();
+	}
+
+	if ( m_prewarm_next >= m_prewarm_chars.size() )
+	{
+		return !m_prewarm_pending.empty();
+	}
+
+	double start = now_ms();
+
+	// at least one char a frame
+	while ( m_prewarm_next < m_prewarm_chars.size() )
+	{
+		GlyphSlot* slot = require_char(m_prewarm_chars[m_prewarm_next++]);
+		if ( slot )
+		{
+			_pin_prewarm(slot);
+		}
+		else if ( m_atlas->saturated(m_bytes_per_pixel, m_smooth) )
+		{
+			// glyphs in use fill the pages, the rest would fail too
+			m_saturation_count += m_prewarm_chars.size() - m_prewarm_next;
+			m_prewarm_next = m_prewarm_chars.size();
+		}
+
+		if ( now_ms() - start >= m_prewarm_budget_ms )
+		{
+			break;
+		}
+	}
+
+	flush();
+	return m_prewarm_next < m_prewarm_chars.size();
+}
+
+float FontCatalog::prewarm_progress()
+{
+	if ( m_source )
+	{
+		return m_source->prewarm_progress();
+	}
+
+	if ( m_prewarm_chars.empty() )
+	{
+		return 1.0f;
+	}
+
+	// glyphs posted to workers are done when their results arrived
+	size_t done = m_prewarm_next - m_prewarm_pending.size();
+	return (float)done / m_prewarm_chars.size();
+}
+
+void FontCatalog::release_prewarm()
+{
+	if ( m_source )
+	{
+		m_source->release_prewarm();
+		return;
+	}
+
+	if ( m_prewarm_next < m_prewarm_chars.size() || !m_prewarm_pending.empty() )
+	{
+		FontFactory::instance()->_cancel_prewarm(this);
+	}
+
+	for ( size_t i = 0; i < m_prewarm_slots.size(); i++ )
+	{
+		m_prewarm_slots[i]->release();
+	}
+	m_prewarm_slots.clear();
+	m_prewarm_pending.clear();
+	m_prewarm_chars.clear();
+	m_prewarm_next = 0;
+}
+
+void FontCatalog::_prewarm(const std::vector<utf32>& chars, float budget_ms)
+{
+	if ( m_source )
+	{
+		m_source->_prewarm(chars, budget_ms);
+		return;
+	}
+
+	m_prewarm_chars.insert(m_prewarm_chars.end(), chars.begin(), chars.end());
+	m_prewarm_budget_ms = budget_ms;
+
+	if ( m_async )
+	{
+		// workers rasterize them, results are pinned in update_prewarm,
+		// unpinned until then so that a burst of results can evict each other
+		while ( m_prewarm_next < m_prewarm_chars.size() )
+		{
+			utf32 charcode = m_prewarm_chars[m_prewarm_next++];
+			GlyphSlot* slot = require_char(charcode);
+			if ( slot && slot->texture )
+			{
+				_pin_prewarm(slot);
+			}
+			else if ( slot )
+			{
+				slot->release();
+				m_prewarm_pending.push_back(charcode);
+			}
+		}
+		flush();
+	}
+
+	FontFactory::instance()->_schedule_prewarm(this);
+}
+
+void FontCatalog::_pin_prewarm(GlyphSlot* slot)
+{
+	// keep room for glyphs required later, the rest are cached but can be evicted
+	if ( slot->texture && m_atlas->pinned_ratio(m_bytes_per_pixel, m_smooth) <= DFONT_PREWARM_MAX_PINNED )
+	{
+		m_prewarm_slots.push_back(slot);
+	}
+	else
+	{
+		slot->release();
+	}
+}
+
+BitmapPool* FontCatalog::bitmap_pool()
+{
+	if ( m_source )
+	{
+		return m_source->bitmap_pool();
+	}
+
+	return m_bitmap_pool;
+}
+
+void FontCatalog::dump_textures(const char* prefix)
+{
+	if ( m_source )
+	{
+		m_source->dump_textures(prefix);
+		return;
+	}
+
+	std::vector<WTexture2D*>* pages = textures();
+	for ( size_t i = 0; i < pages->size(); i++ )
+	{
+		(*pages)[i]->dump_textures(prefix, i);
+	}
+}
+
+FontCatalog::FontCatalog(FontInfo* f, AtlasManager* atlas)
+	: m_font(f), 
+	m_atlas(atlas),
+	m_bytes_per_pixel(4), m_smooth(true),
+	m_hit_count(0), m_miss_count(0), m_eviction_count(0),
+	m_raster_count(0), m_saturation_count(0), m_fallback_count(0), m_lru_count(0),
+	m_variant_count(0), m_subpixel_phases(1),
+	m_tint(0xffffffff),
+	m_async(NULL), m_pending_count(0),
+	m_diskcache(NULL),
+	m_bitmap_pool(new BitmapPool),
+	m_prewarm_next(0), m_prewarm_budget_ms(DFONT_PREWARM_BUDGET_MS),
+	m_source(NULL), m_scale(1.0f), m_sdf(false)
+{
+	m_font->set_bitmap_pool(m_bitmap_pool);
+
+	// single color glyphs only need coverage, color is applied at draw time
+	ColorRGBA color;
+	if ( m_font->single_color(&color) )
+	{
+		m_font->set_pixel_format(e_pixel_a8);
+		color.a = 0xff;
+		m_tint = color.to_uint32();
+		m_bytes_per_pixel = 1;
+	}
+	m_smooth = !m_font->is_bitmap();
+
+	// distance field glyphs drawn at the reference size
+	const std::vector<RenderPassParam>* params = m_font->pass_params();
+	if ( params && !params->empty() && (*params)[0].sdf_spread > 0 )
+	{
+		m_sdf = true;
+		m_sdf_effect.smoothing = 0.25f / (*params)[0].sdf_spread;
+		m_sdf_effect.outline_edge = 0.5f;
+		m_sdf_effect.outline_color = 0;
+		m_sdf_effect.shadow_offset_x = 0.0f;
+		m_sdf_effect.shadow_offset_y = 0.0f;
+		m_sdf_effect.shadow_color = 0;
+	}
+
+	m_atlas->add_catalog(m_bytes_per_pixel, m_smooth);
+}
+
+FontCatalog::FontCatalog(FontCatalog* source, float scale, unsigned int tint, const SDFEffect& effect)
+	: m_font(NULL), 
+	m_atlas(source->m_atlas),
+	m_bytes_per_pixel(source->m_bytes_per_pixel), m_smooth(source->m_smooth),
+	m_hit_count(0), m_miss_count(0), m_eviction_count(0),
+	m_raster_count(0), m_saturation_count(0), m_fallback_count(0), m_lru_count(0),
+	m_variant_count(0), m_subpixel_phases(1),
+	m_tint(tint),
+	m_async(NULL), m_pending_count(0),
+	m_diskcache(NULL),
+	m_bitmap_pool(NULL),
+	m_prewarm_next(0), m_prewarm_budget_ms(DFONT_PREWARM_BUDGET_MS),
+	m_source(source), m_scale(scale), m_sdf(true), m_sdf_effect(effect)
+{
+}
+
+FontCatalog::~FontCatalog()
+{
+	if ( m_prewarm_next < m_prewarm_chars.size() || !m_prewarm_pending.empty() )
+	{
+		FontFactory::instance()->_cancel_prewarm(this);
+	}
+	m_prewarm_slots.clear();
+	m_prewarm_pending.clear();
+
+	if ( m_diskcache )
+	{
+		FontFactory::instance()->_release_diskcache(m_diskcache);
+		m_diskcache = NULL;
+	}
+
+	std::vector<GlyphSlot*> slots;
+	m_glyphmap.slots(&slots);
+	for ( size_t i = 0; i < slots.size(); i++ )
+	{
+		// pages are shared, give back the regions
+		m_atlas->uncache(slots[i]);
+		delete slots[i];
+	}
+	m_glyphmap.clear();
+
+	if ( !m_source )
+	{
+		m_atlas->remove_catalog(m_bytes_per_pixel, m_smooth);
+	}
+
+	if ( m_font )
+	{
+		if ( m_async && !m_source )
+		{
+			m_async->drop_font(m_font);
+		}
+		m_font->set_bitmap_pool(NULL);
+		m_font->release();
+	}
+
+	delete m_bitmap_pool;
+	m_bitmap_pool = NULL;
+}
+
+void FontCatalog::_add_to_map(GlyphSlot* slot)
+{
+	m_glyphmap.insert(slot);
+	if ( slot->phase )
+	{
+		m_variant_count++;
+	}
+}
+
+void FontCatalog::_remove_from_map(GlyphSlot* slot)
+{
+	m_glyphmap.erase(slot);
+	if ( slot->phase )
+	{
+		m_variant_count--;
+	}
+}
+
+GlyphSlot* FontCatalog::_new_slot(utf32 charcode, int phase /*= 0*/)
+{
+	GlyphSlot* slot = new GlyphSlot;
+	memset(slot, 0, sizeof(GlyphSlot));
+	slot->charcode = charcode;
+	slot->phase = phase;
+	slot->catalog = this;
+	return slot;
+}
+
+bool FontCatalog::_cache_bitmap(GlyphBitmap* bm, GlyphSlot* slot, bool evict /*= true*/)
+{
+	if ( !m_atlas->fits(bm->bitmap->real_width(), bm->bitmap->real_height()) )
+	{
+		return false;
+	}
+
+	// unused glyphs of other catalogs in the pages may be evicted
+	bool cached = m_atlas->cache_bitmap(bm, m_bytes_per_pixel, m_smooth, slot, evict);
+
+	if ( !cached && evict )
+	{
+		m_saturation_count++;
+	}
+
+	return cached;
+}
+
+void FontCatalog::_open_diskcache()
+{
+	if ( m_diskcache )
+	{
+		FontFactory::instance()->_release_diskcache(m_diskcache);
+		m_diskcache = NULL;
+	}
+
+	unsigned long long key = GlyphDiskCache::make_key(m_font);
+	char path_buffer[512];
+	sprintf(path_buffer, "%sdfont_%08x%08x.cache", 
+		writable_path().c_str(), 
+		(unsigned int)(key >> 32), (unsigned int)key);
+
+	m_diskcache = FontFactory::instance()->_retain_diskcache(path_buffer, key, m_font->pixel_format() == e_pixel_a8 ? 1 : 4);
+}
+
+void FontCatalog::_on_rasterized(utf32 charcode, int phase, GlyphBitmap* bm)
+{
+	m_pending_count--;
+
+	GlyphSlot* slot = m_glyphmap.find(GlyphIndex::key(charcode, phase));
+	if ( !slot || slot->texture )
+	{
+		return;
+	}
+
+	// show the invalid char for a bad char
+	if ( !bm->bitmap )
+	{
+		m_font->render_charcode(c_char_invalid, bm);
+	}
+	else
+	{
+		m_raster_count++;
+		if ( m_diskcache && phase == 0 )
+		{
+			m_diskcache->store(charcode, bm);
+		}
+	}
+
+	if ( bm->bitmap && _cache_bitmap(bm, slot) )
+	{
+		if ( slot->ref_count == 0 )
+		{
+			_lru_push(slot);
+		}
+		return;
+	}
+
+	// no room, the next require_char tries again or shows the invalid char,
+	// holders keep the empty slot until they release it
+	m_fallback_count++;
+	_remove_from_map(slot);
+	if ( slot->ref_count == 0 )
+	{
+		delete slot;
+	}
+}
+
+void FontCatalog::_lru_push(GlyphSlot* slot)
+{
+	if ( m_atlas->lru_push(slot) )
+	{
+		m_lru_count++;
+	}
+	else if ( m_glyphmap.find(GlyphIndex::key(slot->charcode, slot->phase)) != slot )
+	{
+		// dropped by _on_rasterized
+		delete slot;
+	}
+}
+
+void FontCatalog::_lru_unlink(GlyphSlot* slot)
+{
+	if ( m_atlas->lru_unlink(slot) )
+	{
+		m_lru_count--;
+	}
+}
+
+void FontCatalog::_on_evicted(GlyphSlot* slot)
+{
+	// unlinked and uncached by atlas
+	m_lru_count--;
+	m_eviction_count++;
+	_remove_from_map(slot);
+	delete slot;
+}
+
+FontCatalog* FontFactory::find_font(const char* alias, bool no_fail /*= true*/)
+{
+	if ( !alias )
+		alias = DFONT_DEFAULT_FONTALIAS;
+	
+	std::map<std::string, FontCatalog*>::iterator it = m_fonts.find(alias);
+	if ( it != m_fonts.end() )
+	{
+		return it->second;
+	}
+
+	if ( no_fail )
+		return m_fonts[DFONT_DEFAULT_FONTALIAS];
+
+	return NULL;
+}
+
+FontCatalog* FontFactory::create_sdf_font(
+	const char* alias, const char* font_name, unsigned int color, int size_pt,
+	EFontStyle style/*=e_plain*/, float strength/*=1.0f*/, unsigned int secondary_color/*=0xff000000*/, 
+	int faceidx/*=0*/, int ppi/*=DFONT_DEFAULT_FONTPPI*/
+	)
+{
+	if ( !alias || size_pt <= 0 )
+	{
+		return NULL;
+	}
+	FontCatalog* catalog = find_font(alias, false);
+	if ( catalog )
+	{
+		// the alias is already in used, return it.
+		return catalog;
+	}
+
+	std::string fullpath = full_path(font_name);
+
+	char key_buffer[32];
+	sprintf(key_buffer, "#%d@%d", faceidx, ppi);
+	std::string key = fullpath + key_buffer;
+
+	// one distance field catalog for all sizes of the font
+	FontCatalog* source = NULL;
+	std::map<std::string, FontCatalog*>::iterator it = m_sdf_fonts.find(key);
+	if ( it != m_sdf_fonts.end() )
+	{
+		source = it->second;
+	}
+	else
+	{
+		FontInfo* font = FontInfo::create_font(s_ft_library, fullpath.c_str(), faceidx, 
+			DFONT_SDF_REFERENCE_SIZE, DFONT_SDF_REFERENCE_SIZE, ppi);
+		if ( !font )
+		{
+			return find_font(DFONT_DEFAULT_FONTALIAS);
+		}
+		font->add_pass(RenderPassParam(0xffffffff, e_replace_blender, 0, 0, false, 0, DFONT_SDF_SPREAD));
+
+		source = new FontCatalog(font, m_atlas);
+		source->set_async(m_async);
+		if ( m_diskcache )
+		{
+			source->enable_diskcache(true);
+		}
+		m_sdf_fonts[key] = source;
+	}
+
+	//
+	// styles are thresholds of the distance, in alpha of the texture
+	//	- one screen pixel is 1 / scale reference pixels
+	//	- one reference pixel is 0.5 / DFONT_SDF_SPREAD alpha
+	//
+	float scale = (float)size_pt / DFONT_SDF_REFERENCE_SIZE;
+	float pixel = 0.5f / (DFONT_SDF_SPREAD * scale);
+	float max_pixels = DFONT_SDF_SPREAD * scale * 0.5f;
+	if ( strength > max_pixels )
+	{
+		strength = max_pixels;
+	}
+
+	SDFEffect effect;
+	effect.smoothing = pixel * 0.5f;
+	effect.outline_edge = 0.5f;
+	effect.outline_color = 0;
+	effect.shadow_offset_x = 0.0f;
+	effect.shadow_offset_y = 0.0f;
+	effect.shadow_color = 0;
+
+	switch (style)
+	{
+	case e_plain:
+		break;
+	case e_strengthen:
+		effect.outline_edge = 0.5f - strength * pixel;
+		effect.outline_color = color;
+		break;
+	case e_border:
+		effect.outline_edge = 0.5f - strength * pixel;
+		effect.outline_color = secondary_color;
+		break;
+	case e_shadow:
+		effect.shadow_offset_x = strength / scale;
+		effect.shadow_offset_y = strength / scale;
+		effect.shadow_color = secondary_color;
+		break;
+	}
+
+	catalog = new FontCatalog(source, scale, color, effect);
+	m_fonts[alias] = catalog;
+
+	return catalog;
+}
+
+FontCatalog* FontFactory::another_alias(const char* another_alias, const char* origin_alias)
+{
+	FontCatalog* fontc = find_font(origin_alias);
+
+	if ( fontc )
+	{
+		m_fonts[another_alias] = fontc;
+	}
+
+	return fontc;
+}
+
+FontCatalog* FontFactory::create_font(
+	const char* alias, const char* font_name, unsigned int color, int size_pt,
+	EFontStyle style/*=e_plain*/, float strength/*=1.0f*/, unsigned int secondary_color/*=0xff000000*/, 
+	int faceidx/*=0*/, int ppi/*=DFONT_DEFAULT_FONTPPI*/
+	)
+{
+	if ( !alias )
+	{
+		return NULL;
+	}
+	FontCatalog* catalog = find_font(alias, false);
+	FontInfo* font = NULL;
+	if ( catalog )
+	{
+		// the alias is already in used, return it.
+		return catalog;
+	}
+
+	std::string fullpath = full_path(font_name);
+
+	font = FontInfo::create_font(s_ft_library, fullpath.c_str(), faceidx, size_pt, size_pt, ppi);
+	if ( !font )
+	{
+		return find_font(DFONT_DEFAULT_FONTALIAS);
+	}
+
+	add_style_passes(font, style, color, strength, secondary_color);
+
+	catalog = new FontCatalog(font, m_atlas);
+	catalog->set_async(m_async);
+	if ( m_diskcache )
+	{
+		catalog->enable_diskcache(true);
+	}
+
+	m_fonts[alias] = catalog;
+
+	return catalog;
+}
+
+void FontFactory::add_style_passes(FontInfo* font, EFontStyle style, unsigned int color, float strength, unsigned int secondary_color)
+{
+	switch (style)
+	{
+	case e_plain:
 		font->add_pass(RenderPassParam(color, e_replace_blender, 0, 0, false, 0));
 		break;
 	case e_strengthen:
@@ -578,24 +1344,289 @@ FontCatalog* FontFactory::create_font(
 			->add_pass(RenderPassParam(color, e_additive_blender, 0, 0, false, 0));
 		break;
 	}
+}
 
-	catalog = new FontCatalog(font, 
-		DFONT_TEXTURE_SIZE_WIDTH, 
-		DFONT_TEXTURE_SIZE_HEIGHT, 
-		DFONT_MAX_TEXTURE_NUM_PERFONT);
+void FontFactory::dump_textures()
+{
+	m_atlas->dump_textures();
 
-	m_fonts[alias] = catalog;
+	// pages and glyph counts of the dumped textures
+	dump_stats();
+}
 
-	return catalog;
+AtlasManager* FontFactory::atlas()
+{
+	return m_atlas;
 }
 
-void FontFactory::dump_textures()
+void FontFactory::enable_async(size_t worker_num)
+{
+	if ( m_async || worker_num == 0 )
+	{
+		return;
+	}
+
+	m_async = new AsyncRasterizer(worker_num);
+
+	std::map<std::string, FontCatalog*>::iterator it = m_fonts.begin();
+	for ( ; it != m_fonts.end(); it++ )
+	{
+		if ( it->second )
+		{
+			it->second->set_async(m_async);
+		}
+	}
+
+	_start_ticker();
+}
+
+void FontFactory::update(float dt /*= 0.0f*/)
+{
+	if ( m_async )
+	{
+		std::set<FontCatalog*> updated;
+		AsyncRasterizer::Result result;
+		while ( m_async->poll(&result) )
+		{
+			result.catalog->_on_rasterized(result.charcode, result.phase, &result.bitmap);
+			if ( result.bitmap.bitmap )
+			{
+				result.bitmap.bitmap->release();
+			}
+			updated.insert(result.catalog);
+		}
+
+		for ( std::set<FontCatalog*>::iterator it = updated.begin(); it != updated.end(); it++ )
+		{
+			(*it)->flush();
+		}
+	}
+
+	// each catalog rasterizes prewarm chars within its budget
+	std::set<FontCatalog*>::iterator it = m_prewarming.begin();
+	while ( it != m_prewarming.end() )
+	{
+		if ( (*it)->update_prewarm() )
+		{
+			it++;
+		}
+		else
+		{
+			m_prewarming.erase(it++);
+		}
+	}
+
+	m_stats_elapsed += dt;
+	if ( m_stats_hook && m_stats_elapsed >= m_stats_interval )
+	{
+		std::set<FontCatalog*> reported;
+		std::map<std::string, FontCatalog*>::iterator fit = m_fonts.begin();
+		for ( ; fit != m_fonts.end(); fit++ )
+		{
+			FontCatalog* catalog = fit->second;
+			if ( !catalog || reported.find(catalog) != reported.end() )
+			{
+				continue;
+			}
+			reported.insert(catalog);
+
+			CatalogStats stats;
+			catalog->stats(&stats);
+
+			size_t& last_raster_count = m_stats_raster_counts[catalog];
+			if ( stats.raster_count >= last_raster_count )
+			{
+				stats.raster_per_second = (stats.raster_count - last_raster_count) / m_stats_elapsed;
+			}
+			last_raster_count = stats.raster_count;
+
+			m_stats_hook(fit->first.c_str(), stats);
+		}
+		m_stats_elapsed = 0.0f;
+	}
+}
+
+void FontFactory::stats(CatalogStats* stats)
+{
+	memset(stats, 0, sizeof(CatalogStats));
+
+	// aliases share catalogs, count each once
+	std::set<FontCatalog*> catalogs;
+	std::map<std::string, FontCatalog*>::iterator it = m_fonts.begin();
+	for ( ; it != m_fonts.end(); it++ )
+	{
+		catalogs.insert(it->second);
+	}
+	for ( it = m_sdf_fonts.begin(); it != m_sdf_fonts.end(); it++ )
+	{
+		catalogs.insert(it->second);
+	}
+
+	for ( std::set<FontCatalog*>::iterator cit = catalogs.begin(); cit != catalogs.end(); cit++ )
+	{
+		FontCatalog* catalog = *cit;
+		if ( !catalog )
+		{
+			continue;
+		}
+
+		// views only add their fallback chars
+		if ( catalog->m_source )
+		{
+			stats->fallback_count += catalog->m_fallback_count;
+			continue;
+		}
+
+		CatalogStats one;
+		catalog->stats(&one);
+		stats->glyph_count += one.glyph_count;
+		stats->unused_count += one.unused_count;
+		stats->pinned_count += one.pinned_count;
+		stats->pending_count += one.pending_count;
+		stats->variant_count += one.variant_count;
+		stats->hit_count += one.hit_count;
+		stats->miss_count += one.miss_count;
+		stats->eviction_count += one.eviction_count;
+		stats->raster_count += one.raster_count;
+		stats->saturation_count += one.saturation_count;
+		stats->fallback_count += one.fallback_count;
+	}
+
+	// pages are shared, count each once
+	std::vector<WTexture2D*> pages;
+	m_atlas->all_pages(&pages);
+	stats->texture_count = pages.size();
+	for ( size_t i = 0; i < pages.size(); i++ )
+	{
+		stats->texture_bytes += pages[i]->width() * pages[i]->height() * pages[i]->bytes_per_pixel();
+	}
+	stats->occupancy = m_atlas->occupancy();
+}
+
+void FontFactory::set_stats_hook(stats_hook_t hook, float interval /*= 5.0f*/)
+{
+	m_stats_hook = hook;
+	m_stats_interval = interval;
+	m_stats_elapsed = 0.0f;
+	m_stats_raster_counts.clear();
+
+	if ( hook )
+	{
+		_start_ticker();
+	}
+}
+
+static void log_stats(const char* alias, const CatalogStats& stats)
+{
+	dfont_log("[dfont] %s: %u pages %uKB %.0f%%, glyphs %u (unused %u, pinned %u, pending %u, variants %u), "
+		"hit %u miss %u evict %u raster %u, saturated %u, fallback %u",
+		alias, (unsigned int)stats.texture_count, (unsigned int)(stats.texture_bytes >> 10), stats.occupancy * 100.0f,
+		(unsigned int)stats.glyph_count, (unsigned int)stats.unused_count, (unsigned int)stats.pinned_count, (unsigned int)stats.pending_count, (unsigned int)stats.variant_count,
+		(unsigned int)stats.hit_count, (unsigned int)stats.miss_count, (unsigned int)stats.eviction_count, (unsigned int)stats.raster_count,
+		(unsigned int)stats.saturation_count, (unsigned int)stats.fallback_count);
+}
+
+void FontFactory::dump_stats()
+{
+	std::map<std::string, FontCatalog*>::iterator it = m_fonts.begin();
+	for ( ; it != m_fonts.end(); it++ )
+	{
+		if ( it->second )
+		{
+			CatalogStats stats;
+			it->second->stats(&stats);
+			log_stats(it->first.c_str(), stats);
+		}
+	}
+
+	CatalogStats total;
+	stats(&total);
+	log_stats("total", total);
+}
+
+void FontFactory::_start_ticker()
+{
+	if ( m_ticking )
+	{
+		return;
+	}
+
+	m_ticking = true;
+	schedule_update(this);
+}
+
+void FontFactory::_schedule_prewarm(FontCatalog* catalog)
+{
+	m_prewarming.insert(catalog);
+	_start_ticker();
+}
+
+void FontFactory::_cancel_prewarm(FontCatalog* catalog)
+{
+	m_prewarming.erase(catalog);
+}
+
+GlyphDiskCache* FontFactory::_retain_diskcache(const char* path, unsigned long long key, int bytes_per_pixel)
+{
+	std::pair<GlyphDiskCache*, size_t>& entry = m_diskcaches[path];
+	if ( !entry.first )
+	{
+		entry.first = new GlyphDiskCache(path, key, bytes_per_pixel);
+		entry.second = 0;
+	}
+	entry.second++;
+	return entry.first;
+}
+
+void FontFactory::_release_diskcache(GlyphDiskCache* cache)
+{
+	std::map<std::string, std::pair<GlyphDiskCache*, size_t> >::iterator it = m_diskcaches.find(cache->path());
+	if ( it == m_diskcaches.end() || --it->second.second > 0 )
+	{
+		return;
+	}
+
+	delete it->second.first;
+	m_diskcaches.erase(it);
+}
+
+void FontFactory::enable_diskcache(bool enable)
+{
+	m_diskcache = enable;
+
+	std::map<std::string, FontCatalog*>::iterator it = m_fonts.begin();
+	for ( ; it != m_fonts.end(); it++ )
+	{
+		if ( it->second )
+		{
+			it->second->enable_diskcache(enable);
+		}
+	}
+}
+
+size_t FontFactory::pending_count()
 {
+	// aliases share catalogs, count each once
+	std::set<FontCatalog*> catalogs;
 	std::map<std::string, FontCatalog*>::iterator it = m_fonts.begin();
 	for ( ; it != m_fonts.end(); it++ )
 	{
-		it->second->dump_textures(it->first.c_str());
+		catalogs.insert(it->second);
+	}
+	for ( it = m_sdf_fonts.begin(); it != m_sdf_fonts.end(); it++ )
+	{
+		catalogs.insert(it->second);
+	}
+
+	size_t count = 0;
+	for ( std::set<FontCatalog*>::iterator cit = catalogs.begin(); cit != catalogs.end(); cit++ )
+	{
+		if ( *cit && !(*cit)->m_source )
+		{
+			count += (*cit)->pending_count();
+		}
 	}
+	return count;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -628,16 +1659,39 @@ FontFactory* FontFactory::instance()
 
 
 FontFactory::FontFactory()
+	: m_atlas(new AtlasManager(DFONT_ATLAS_PAGE_WIDTH, DFONT_ATLAS_PAGE_HEIGHT, DFONT_ATLAS_MAX_PAGES)),
+	m_async(NULL), m_ticking(false),
+	m_stats_hook(NULL), m_stats_interval(5.0f), m_stats_elapsed(0.0f),
+	m_diskcache(false)
 {
 	FT_Error error = FT_Init_FreeType(&s_ft_library);
-	CCAssert(error==0, "");
+	assert(error==0);
 }
 
 FontFactory::~FontFactory()
 {
-	std::set<FontCatalog*> delset;
+	if ( m_ticking )
+	{
+		unschedule_update(this);
+		m_ticking = false;
+	}
+
+	// stop workers before fonts deleted
 	std::map<std::string, FontCatalog*>::iterator it = m_fonts.begin();
 	for ( ; it != m_fonts.end(); it++ )
+	{
+		it->second->set_async(NULL);
+	}
+	for ( it = m_sdf_fonts.begin(); it != m_sdf_fonts.end(); it++ )
+	{
+		it->second->set_async(NULL);
+	}
+	delete m_async;
+	m_async = NULL;
+
+	std::set<FontCatalog*> delset;
+	it = m_fonts.begin();
+	for ( ; it != m_fonts.end(); it++ )
 	{
 		if ( delset.find(it->second) == delset.end() )
 		{
@@ -646,6 +1700,18 @@ FontFactory::~FontFactory()
 		}
 	}
 	m_fonts.clear();
+
+	// after aliases of them
+	for ( it = m_sdf_fonts.begin(); it != m_sdf_fonts.end(); it++ )
+	{
+		delete it->second;
+	}
+	m_sdf_fonts.clear();
+
+	// after all glyphs given back
+	delete m_atlas;
+	m_atlas = NULL;
+
 	FT_Done_FreeType(s_ft_library);
 }
 
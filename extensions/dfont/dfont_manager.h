@@ -26,6 +26,8 @@
 #define __DFONT_MANAGER_H__
 
 #include "dfont_config.h"
+#include "dfont_packer.h"
+#include "dfont_index.h"
 
 #include <map>
 #include <set>
@@ -67,43 +69,136 @@ struct GlyphMetrics
 	int height;
 	int advance_x;
 	int advance_y;
+	int advance_x_26dot6;	// advance_x before rounding, for subpixel positioning
+};
+
+// drawing params of distance field glyphs, distances are in texture alpha
+struct SDFEffect
+{
+	float smoothing;			// half width of the anti-aliased edge
+	float outline_edge;			// outline covers [outline_edge, 0.5]
+	unsigned int outline_color;	// 0xAABBGGRR
+	float shadow_offset_x;		// texels, right and down
+	float shadow_offset_y;
+	unsigned int shadow_color;	// 0 for no shadow
+};
+
+// memory and cache counters of a catalog
+struct CatalogStats
+{
+	size_t texture_count;		// pages allocated
+	size_t texture_bytes;		// cpu side, the same on gpu
+	float occupancy;			// used pixels / pages pixels
+
+	size_t glyph_count;			// slots cached
+	size_t unused_count;		// slots not in use, can be evicted
+	size_t pinned_count;		// slots in use or pending, can not be evicted
+	size_t pending_count;		// slots being rasterized
+	size_t variant_count;		// subpixel variants, phase > 0
+
+	size_t hit_count;
+	size_t miss_count;
+	size_t eviction_count;
+	size_t raster_count;		// glyphs rasterized by FreeType
+	float raster_per_second;	// filled by FontFactory stats hook only
+	size_t saturation_count;	// glyphs not cached, all slots are in use
+	size_t fallback_count;		// chars shown as c_char_invalid
 };
 
 struct GlyphSlot
 {
 	utf32 charcode; // unicode
+	int phase;		// subpixel offset of the variant in quarter pixels, 0 at whole pixels
 	size_t ref_count;	// counter for using
 	PaddingRect padding_rect;
 	GlyphMetrics metrics;
-	class WTexture2D* texture;
+	class WTexture2D* texture;	// NULL while rasterizing in async mode
+	class FontCatalog* catalog;
 
-	class IBitmap* bitmap;
+	// lru list of unused slots, linked by AtlasManager
+	GlyphSlot* lru_prev;
+	GlyphSlot* lru_next;
 
 	void retain();
 	void release();
 };
 
+// engine textures of atlas pages, see default_texture_backend in dfont_utility.h
+class ITextureBackend
+{
+public:
+	virtual ~ITextureBackend(){}
+
+	// engine texture for the page, data is the zeroed page, NULL if there is none
+	virtual void* create_texture(class WTexture2D* texture, const unsigned char* data) = 0;
+	virtual void destroy_texture(class WTexture2D* texture, void* user_texture) = 0;
+
+	// upload rows [y, y + rows) with full texture width, data points to row y
+	virtual void upload_rows(class WTexture2D* texture, int y, int rows, const unsigned char* data) = 0;
+};
+
+// no engine textures, count pages, calls and bytes only, for headless test and bench
+class RecordingTextureBackend : public ITextureBackend
+{
+public:
+	RecordingTextureBackend();
+
+	virtual void* create_texture(class WTexture2D* texture, const unsigned char* data);
+	virtual void destroy_texture(class WTexture2D* texture, void* user_texture);
+	virtual void upload_rows(class WTexture2D* texture, int y, int rows, const unsigned char* data);
+
+	size_t texture_count();
+	size_t upload_calls();
+	size_t upload_bytes();
+
+	// counters of calls and bytes, texture_count is kept
+	void reset();
+
+private:
+	size_t m_texture_count;
+	size_t m_upload_calls;
+	size_t m_upload_bytes;
+};
+
 // represent a 2d texture
 class WTexture2D
 {
 	friend struct GlyphSlot;
 public:
-	WTexture2D(class FontInfo* f, int width, int height, int padding_width, int padding_height);
+	// bytes_per_pixel is 1 for a8 and 4 for rgba, smooth for linear filter
+	WTexture2D(int width, int height, int bytes_per_pixel, bool smooth);
 	~WTexture2D();
 
 	int width();
 	int height();
+	int bytes_per_pixel();
+	bool smooth();
 
-	// flush data to GPU
+	// flush dirty rows to GPU
 	void flush();
 
-	bool has_empty_slot();
+	// backend of pages created later, NULL to restore default_texture_backend()
+	static void set_texture_backend(ITextureBackend* backend);
+	static ITextureBackend* texture_backend();
+
+	// copy bitmap into the texture data and fill the slot, return false if there is no room
+	bool cache_charcode(struct GlyphBitmap* bm, GlyphSlot* slot);
+
+	// give back the slot's region
+	void uncache(GlyphSlot* slot);
 
-	GlyphSlot* cache_charcode(utf32 charcode);
+	// copy of the page's packer to try allocations on
+	ShelfPacker packer();
 
+	size_t glyph_count();
+
+	// used pixels / texture pixels
+	float occupancy();
+
+	// cpu side copy of the texture
 	unsigned char* buffer_data();
 
-	// T == cocos2d::CCTexture2D
+	// T == cocos2d::CCTexture2D with the default backend
 	template<typename T>
 	T* user_texture()
 	{
@@ -113,43 +208,40 @@ public:
 	void dump_textures(const char* prefix, int index);
 
 private:
-	void _init_slot(int i);
-
-	void _slot_nouse(GlyphSlot* slot);
+	void _copy2texture(class IBitmap* bitmap, const PaddingRect& rect);
 
-	void _slot_inuse(GlyphSlot* slot);
 
-	void _dump2texture(class IBitmap* bitmap, const PaddingRect& rect, bool draw_cbox = false);
-
-
-	class FontInfo* m_font;
-	GlyphSlot* m_slots;
-	size_t m_slot_num;
+	ShelfPacker m_packer;
+	std::set<GlyphSlot*> m_slots;
 
 	int m_width;
 	int m_height;
-	int m_cols;
-	int m_rows;
-	int m_padding_width;
-	int m_padding_height;
+	int m_bytes_per_pixel;
+	bool m_smooth;
 
 	unsigned char* m_data;
+	ITextureBackend* m_backend;
 	void* m_user_texture;
-	std::vector<GlyphSlot*> m_dirty_slots;
 
-	std::set<GlyphSlot*> m_emptyslots;
+	// dirty row ranges [first, second)
+	std::vector<std::pair<int, int> > m_dirty_rows;
 };
 
 class FontCatalog
 {
+	friend struct GlyphSlot;
+	friend class FontFactory;
+	friend class AtlasManager;
 public:
-	typedef std::map<utf32,  GlyphSlot*> glyph_map_t;
-	typedef std::map<GlyphSlot*, utf32> reverse_glyph_map_t;
-
 	void require_text(utf16* text, size_t len, std::vector<GlyphSlot*>* glyph_slots);
 	void require_text(utf32* text, size_t len, std::vector<GlyphSlot*>* glyph_slots);
-	GlyphSlot* require_char(utf32 charcode);
+	// utf-8 range [utf8_begin, utf8_end), decoded in place without a utf-16 copy
+	void require_text(const char* utf8_begin, const char* utf8_end, std::vector<GlyphSlot*>* glyph_slots);
+	// phase selects a subpixel variant, see set_subpixel_phases
+	GlyphSlot* require_char(utf32 charcode, int phase = 0);
 	//class FontInfo* font();
+
+	// atlas pages the catalog's glyphs are cached in, shared with other catalogs
 	std::vector<WTexture2D*>* textures();
 	void flush();
 
@@ -157,12 +249,82 @@ public:
 	unsigned int char_width();
 	unsigned int char_height();
 
+	// pen offset in pixels between two chars
+	int kerning(utf32 left_code, utf32 right_code);
+
+	// rasterize chars up to DFONT_SUBPIXEL_LAST_CHAR at phases horizontal offsets,
+	// variant i is moved right by i / phases pixel, 1 to turn off
+	//	- phases is 1, 2 or 4, not for distance field fonts
+	//	- glyphs of other phases are cached as they are required
+	void set_subpixel_phases(int phases);
+
+	// phases of the char, 1 if not positioned at subpixels
+	int subpixel_phases(utf32 charcode);
+
 	bool add_hackfont(const char* fontname, std::set<unsigned long>* charset, unsigned int shift_y = 0);
 	bool add_hackfont(const char* fontname, long face_idx, std::set<unsigned long>* charset, unsigned int shift_y);
 
+	// average occupancy of textures, glyphs of other catalogs are counted
+	float occupancy();
+
+	// color to multiply when drawing, 0xffffffff unless glyphs are a8
+	unsigned int tint();
+
+	// glyphs are distance fields, NULL if not
+	const SDFEffect* sdf_effect();
+
+	// metrics and quads scale, 1.0f unless sharing a distance field catalog
+	float scale();
+
+	// cache counters
+	size_t hit_count();
+	size_t miss_count();
+	size_t eviction_count();
+	void reset_counters();
+
+	// memory and cache counters, raster_per_second is 0
+	//	- texture figures are of the shared pages in textures()
+	void stats(CatalogStats* stats);
+
+	// glyph bitmap allocation counters
+	class BitmapPool* bitmap_pool();
+
+	// rasterize new glyphs in worker threads, NULL to turn off
+	void set_async(class AsyncRasterizer* async);
+
+	// glyphs being rasterized
+	size_t pending_count();
+
+	// load rendered glyphs from a file in the writable path, save new ones to it
+	void enable_diskcache(bool enable);
+
+	// cache glyphs in the disk cache until textures are full, return the number cached
+	size_t warm_from_diskcache();
+
+	// rasterize chars before they are required, glyphs are pinned until release_prewarm
+	//	- glyphs past DFONT_PREWARM_MAX_PINNED of the page group are cached unpinned
+	//	- in async mode chars are posted to workers at once
+	//	- otherwise FontFactory rasterizes them within budget_ms every frame
+	void prewarm(const std::set<unsigned long>* charset, float budget_ms = DFONT_PREWARM_BUDGET_MS);
+
+	// prewarm the max_chars most frequent chars of an utf-8 corpus file, most frequent first
+	bool prewarm(const char* corpus_file, size_t max_chars, float budget_ms = DFONT_PREWARM_BUDGET_MS);
+
+	// rasterize prewarm chars within the budget and pin async results, return true if there are more
+	bool update_prewarm();
+
+	// rasterized or failed / requested prewarm chars, 1.0f if nothing to prewarm
+	float prewarm_progress();
+
+	// unpin prewarmed glyphs and drop chars not rasterized yet
+	void release_prewarm();
+
 	void dump_textures(const char* prefix);
 
-	FontCatalog(class FontInfo* f, int texture_width, int texture_height, int max_textures=2);
+	FontCatalog(class FontInfo* f, class AtlasManager* atlas);
+
+	// an alias of the distance field catalog at another size
+	FontCatalog(FontCatalog* source, float scale, unsigned int tint, const SDFEffect& effect);
 
 	~FontCatalog();
 
@@ -171,23 +333,80 @@ private:
 
 	void _remove_from_map(GlyphSlot* slot);
 
+	GlyphSlot* _new_slot(utf32 charcode, int phase = 0);
+
+	// one code of require_text, blanks and fallback applied
+	void _require_code(utf32 code, std::vector<GlyphSlot*>* glyph_slots);
+
+	bool _cache_bitmap(struct GlyphBitmap* bm, GlyphSlot* slot, bool evict = true);
+
+	// key changes with hackfonts
+	void _open_diskcache();
+
+	// async result arrived, bm->bitmap is NULL if failed
+	void _on_rasterized(utf32 charcode, int phase, struct GlyphBitmap* bm);
+
+	void _prewarm(const std::vector<utf32>& chars, float budget_ms);
+
+	// keep a required prewarm slot pinned or release it
+	void _pin_prewarm(GlyphSlot* slot);
+
+	// slot is not in use, append to the lru tail
+	void _lru_push(GlyphSlot* slot);
+
+	// slot is in use again
+	void _lru_unlink(GlyphSlot* slot);
+
+	// atlas gave the slot's region to another glyph
+	void _on_evicted(GlyphSlot* slot);
+
 	class FontInfo* m_font;
-	std::vector<WTexture2D*> m_textures;
-	glyph_map_t m_glyphmap;
-	reverse_glyph_map_t m_reverse_glyphmap;
+	GlyphIndex m_glyphmap;
+
+	class AtlasManager* m_atlas;
+
+	// page group of the glyphs
+	int m_bytes_per_pixel;
+	bool m_smooth;
+
+	size_t m_hit_count;
+	size_t m_miss_count;
+	size_t m_eviction_count;
+	size_t m_raster_count;
+	size_t m_saturation_count;
+	size_t m_fallback_count;
+	size_t m_lru_count;
+	size_t m_variant_count;
+
+	int m_subpixel_phases;
+
+	unsigned int m_tint;
+
+	class AsyncRasterizer* m_async;
+	size_t m_pending_count;
+
+	class GlyphDiskCache* m_diskcache;
 
-	int m_max_textures;
+	// scratch bitmaps of rendered glyphs
+	class BitmapPool* m_bitmap_pool;
 
-	int m_texture_width;
-	int m_texture_height;
-	int m_padding_width;
-	int m_padding_height;
+	// chars before m_prewarm_next are required, their slots are retained
+	std::vector<utf32> m_prewarm_chars;
+	size_t m_prewarm_next;
+	float m_prewarm_budget_ms;
+	std::vector<GlyphSlot*> m_prewarm_slots;
+	std::vector<utf32> m_prewarm_pending;	// posted to workers, pinned in update_prewarm
 
-	utf32 m_previous_char_idx;
+	// glyphs are required from source if set
+	FontCatalog* m_source;
+	float m_scale;
+	bool m_sdf;
+	SDFEffect m_sdf_effect;
 };
 
 class FontFactory
 {
+	friend class FontCatalog;
 public:
 	typedef void (*initor_t)();
 public:
@@ -202,15 +421,82 @@ public:
 		int faceidx=0, int ppi=DFONT_DEFAULT_FONTPPI
 		);
 
+	// distance field glyphs of the font are rendered once at DFONT_SDF_REFERENCE_SIZE,
+	// and shared by all sizes and styles
+	FontCatalog* create_sdf_font(
+		const char* alias, const char* font_name, unsigned int color, int size_pt,
+		EFontStyle style=e_plain, float strength=1.0f, unsigned int secondary_color=0xff000000, 
+		int faceidx=0, int ppi=DFONT_DEFAULT_FONTPPI
+		);
+
 	FontCatalog* another_alias(const char* another_alias, const char* origin_alias);
 
+	// add render passes of the style to a font
+	static void add_style_passes(class FontInfo* font, EFontStyle style, unsigned int color, float strength, unsigned int secondary_color);
+
+	// dump pages of the atlas and log stats
 	void dump_textures();
 
+	// pages shared by all fonts, page size and count can be changed at runtime
+	class AtlasManager* atlas();
+
+	// rasterize glyphs in worker threads, results are applied every frame
+	void enable_async(size_t worker_num);
+
+	// apply async results, prewarm and call stats hook, called by scheduler or by the app without cocos2d-x
+	void update(float dt = 0.0f);
+
+	// glyphs being rasterized in all fonts
+	size_t pending_count();
+
+	// disk cache for all fonts
+	void enable_diskcache(bool enable);
+
+	// sum of all catalogs, raster_per_second is 0
+	void stats(CatalogStats* stats);
+
+	// called with stats of each catalog every interval seconds, NULL to stop
+	typedef void (*stats_hook_t)(const char* alias, const CatalogStats& stats);
+	void set_stats_hook(stats_hook_t hook, float interval = 5.0f);
+
+	// log stats of all catalogs
+	void dump_stats();
+
 private:
 	FontFactory();
 	~FontFactory(); 
 
+	// call update every frame
+	void _start_ticker();
+
+	// rasterize the catalog's prewarm chars in update
+	void _schedule_prewarm(FontCatalog* catalog);
+	void _cancel_prewarm(FontCatalog* catalog);
+
+	// catalogs of the same key share one disk cache, records of one are not overwritten by another
+	class GlyphDiskCache* _retain_diskcache(const char* path, unsigned long long key, int bytes_per_pixel);
+	void _release_diskcache(class GlyphDiskCache* cache);
+
 	std::map<std::string, FontCatalog*> m_fonts;
+
+	// distance field catalogs, key: path#face@ppi
+	std::map<std::string, FontCatalog*> m_sdf_fonts;
+
+	class AtlasManager* m_atlas;
+	class AsyncRasterizer* m_async;
+	bool m_ticking;
+
+	std::set<FontCatalog*> m_prewarming;
+
+	stats_hook_t m_stats_hook;
+	float m_stats_interval;
+	float m_stats_elapsed;		// seconds since last hook call
+	std::map<FontCatalog*, size_t> m_stats_raster_counts;	// raster_count at last hook call
+
+	bool m_diskcache;
+
+	// path - shared disk cache and its catalogs
+	std::map<std::string, std::pair<class GlyphDiskCache*, size_t> > m_diskcaches;
 };
 
 }
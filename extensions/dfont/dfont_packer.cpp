@@ -0,0 +1,272 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#include "dfont_packer.h"
+#include "dfont_manager.h"
+
+namespace dfont
+{
+
+ShelfPacker::ShelfPacker(int width, int height)
+	: m_width(width), m_height(height), 
+	m_top(0), m_used_area(0), m_alloc_count(0)
+{
+}
+
+bool ShelfPacker::alloc(int w, int h, PaddingRect* rect)
+{
+	if ( w <= 0 || h <= 0 || w > m_width || h > m_height )
+		return false;
+
+	// best fit shelf: the lowest one which has a wide enough free span,
+	// empty shelves are cut to the height later
+	int best_shelf = -1;
+	int best_span = -1;
+	int best_empty = -1;
+	for ( size_t i = 0; i < m_shelves.size(); i++ )
+	{
+		Shelf& shelf = m_shelves[i];
+		if ( shelf.height < h )
+			continue;
+
+		if ( shelf.used_count == 0 )
+		{
+			if ( best_empty < 0 || shelf.height < m_shelves[best_empty].height )
+				best_empty = (int)i;
+			continue;
+		}
+
+		if ( best_shelf >= 0 && shelf.height >= m_shelves[best_shelf].height )
+			continue;
+
+		int span_idx = _find_span(shelf, w);
+		if ( span_idx >= 0 )
+		{
+			best_shelf = (int)i;
+			best_span = span_idx;
+			if ( shelf.height == h )
+				break;
+		}
+	}
+
+	// use an empty shelf or open a new one rather than waste too much height of an old one
+	int shelf_height = (h + DFONT_SHELF_HEIGHT_ALIGN - 1) / DFONT_SHELF_HEIGHT_ALIGN * DFONT_SHELF_HEIGHT_ALIGN;
+	int top_height = shelf_height < m_height - m_top ? shelf_height : m_height - m_top;
+	bool can_open = top_height >= h;
+	bool too_wasteful = best_shelf >= 0 && m_shelves[best_shelf].height - h > h / 4 + DFONT_SHELF_HEIGHT_ALIGN;
+
+	if ( best_shelf < 0 || too_wasteful )
+	{
+		if ( best_empty >= 0 )
+		{
+			_cut_shelf(best_empty, shelf_height);
+			best_shelf = best_empty;
+			best_span = 0;
+		}
+		else if ( can_open )
+		{
+			Shelf shelf;
+			shelf.y = m_top;
+			shelf.height = top_height;
+			shelf.used_count = 0;
+			Span span = { 0, m_width };
+			shelf.free_spans.push_back(span);
+			m_shelves.push_back(shelf);
+			m_top += top_height;
+
+			best_shelf = (int)m_shelves.size() - 1;
+			best_span = 0;
+		}
+	}
+
+	if ( best_shelf < 0 )
+		return false;
+
+	_take_span(m_shelves[best_shelf], best_span, w, h, rect);
+	return true;
+}
+
+void ShelfPacker::free(const PaddingRect& rect)
+{
+	int shelf_idx = _find_shelf(rect.origin_y);
+	if ( shelf_idx < 0 )
+		return;
+
+	Shelf& shelf = m_shelves[shelf_idx];
+	std::vector<Span>& spans = shelf.free_spans;
+
+	// insert sorted by x
+	size_t pos = 0;
+	while ( pos < spans.size() && spans[pos].x < rect.origin_x )
+		pos++;
+	Span span = { rect.origin_x, rect.width };
+	spans.insert(spans.begin() + pos, span);
+
+	// merge with next & previous
+	if ( pos + 1 < spans.size() && spans[pos].x + spans[pos].w == spans[pos+1].x )
+	{
+		spans[pos].w += spans[pos+1].w;
+		spans.erase(spans.begin() + pos + 1);
+	}
+	if ( pos > 0 && spans[pos-1].x + spans[pos-1].w == spans[pos].x )
+	{
+		spans[pos-1].w += spans[pos].w;
+		spans.erase(spans.begin() + pos);
+	}
+
+	shelf.used_count--;
+	m_alloc_count--;
+	m_used_area -= rect.width * rect.height;
+
+	if ( shelf.used_count > 0 )
+		return;
+
+	// an empty shelf joins its empty neighbours, a taller glyph can cut it again
+	_merge_empty(shelf_idx);
+
+	// give back the empty shelf on top
+	if ( m_shelves.back().used_count == 0 )
+	{
+		m_top = m_shelves.back().y;
+		m_shelves.pop_back();
+	}
+}
+
+void ShelfPacker::clear()
+{
+	m_shelves.clear();
+	m_top = 0;
+	m_used_area = 0;
+	m_alloc_count = 0;
+}
+
+int ShelfPacker::width()
+{
+	return m_width;
+}
+
+int ShelfPacker::height()
+{
+	return m_height;
+}
+
+int ShelfPacker::alloc_count()
+{
+	return m_alloc_count;
+}
+
+float ShelfPacker::occupancy()
+{
+	return (float)m_used_area / (float)(m_width * m_height);
+}
+
+int ShelfPacker::_find_span(Shelf& shelf, int w)
+{
+	// best fit span
+	int found = -1;
+	for ( size_t i = 0; i < shelf.free_spans.size(); i++ )
+	{
+		if ( shelf.free_spans[i].w >= w 
+			&& ( found < 0 || shelf.free_spans[i].w < shelf.free_spans[found].w ) )
+		{
+			found = (int)i;
+		}
+	}
+	return found;
+}
+
+void ShelfPacker::_take_span(Shelf& shelf, int span_idx, int w, int h, PaddingRect* rect)
+{
+	Span& span = shelf.free_spans[span_idx];
+	rect->origin_x = span.x;
+	rect->origin_y = shelf.y;
+	rect->width = w;
+	rect->height = h;
+
+	span.x += w;
+	span.w -= w;
+	if ( span.w == 0 )
+	{
+		shelf.free_spans.erase(shelf.free_spans.begin() + span_idx);
+	}
+
+	shelf.used_count++;
+	m_alloc_count++;
+	m_used_area += w * h;
+}
+
+void ShelfPacker::_cut_shelf(int shelf_idx, int height)
+{
+	Shelf& shelf = m_shelves[shelf_idx];
+	if ( shelf.height <= height )
+		return;
+
+	// the rest keeps empty below the next shelf
+	Shelf rest;
+	rest.y = shelf.y + height;
+	rest.height = shelf.height - height;
+	rest.used_count = 0;
+	Span span = { 0, m_width };
+	rest.free_spans.push_back(span);
+	shelf.height = height;
+
+	m_shelves.insert(m_shelves.begin() + shelf_idx + 1, rest);
+}
+
+void ShelfPacker::_merge_empty(int shelf_idx)
+{
+	int first = shelf_idx;
+	while ( first > 0 && m_shelves[first - 1].used_count == 0 )
+		first--;
+	int last = shelf_idx;
+	while ( last + 1 < (int)m_shelves.size() && m_shelves[last + 1].used_count == 0 )
+		last++;
+
+	Shelf& shelf = m_shelves[first];
+	shelf.height = m_shelves[last].y + m_shelves[last].height - shelf.y;
+	shelf.free_spans.clear();
+	Span span = { 0, m_width };
+	shelf.free_spans.push_back(span);
+
+	m_shelves.erase(m_shelves.begin() + first + 1, m_shelves.begin() + last + 1);
+}
+
+int ShelfPacker::_find_shelf(int y)
+{
+	int lo = 0;
+	int hi = (int)m_shelves.size() - 1;
+	while ( lo <= hi )
+	{
+		int mid = (lo + hi) / 2;
+		if ( m_shelves[mid].y == y )
+			return mid;
+		if ( m_shelves[mid].y < y )
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+}//namespace dfont
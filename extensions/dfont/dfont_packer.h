@@ -0,0 +1,100 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#ifndef __DFONT_PACKER_H__ 
+#define __DFONT_PACKER_H__
+
+#include "dfont_config.h"
+
+#include <vector>
+
+namespace dfont
+{
+
+struct PaddingRect;
+
+//
+// shelf bin-packer for variable size glyph bitmaps
+//	- a page is cut into horizontal shelves, each shelf keeps its free spans
+//	- freed regions are merged back into their shelf and can be reused
+//	- empty shelves are merged and cut again to the height of new glyphs
+//
+class ShelfPacker
+{
+public:
+	ShelfPacker(int width, int height);
+
+	// return false if there is no room for a w*h region
+	bool alloc(int w, int h, PaddingRect* rect);
+
+	// give back a region returned by alloc
+	void free(const PaddingRect& rect);
+
+	void clear();
+
+	int width();
+	int height();
+
+	// allocated regions count
+	int alloc_count();
+
+	// allocated pixels / page pixels
+	float occupancy();
+
+private:
+	struct Span
+	{
+		int x;
+		int w;
+	};
+
+	struct Shelf
+	{
+		int y;
+		int height;
+		int used_count;
+		std::vector<Span> free_spans;	// sorted by x
+	};
+
+	int _find_span(Shelf& shelf, int w);
+	void _take_span(Shelf& shelf, int span_idx, int w, int h, PaddingRect* rect);
+	int _find_shelf(int y);
+
+	// keep height rows of an empty shelf, the rest is a new empty shelf
+	void _cut_shelf(int shelf_idx, int height);
+
+	// join an empty shelf with its empty neighbours
+	void _merge_empty(int shelf_idx);
+
+	int m_width;
+	int m_height;
+	int m_top;			// first unused row
+	int m_used_area;
+	int m_alloc_count;
+	std::vector<Shelf> m_shelves;	// sorted by y
+};
+
+}
+
+#endif//__DFONT_PACKER_H__
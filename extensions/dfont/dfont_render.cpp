@@ -23,6 +23,13 @@
  THE SOFTWARE.
  ****************************************************************************/
 #include "dfont_render.h"
+#include "dfont_span.h"
+#include "dfont_face.h"
+
+#include FT_SIZES_H
+
+#include <float.h>
+#include <math.h>
 
 namespace dfont
 {
@@ -37,7 +44,8 @@ const IPixelBlender* PixelBlenders[e_blender_num] =
 
 
 Bitmap_32bits::Bitmap_32bits(int width, int height, int padding)
-	: m_buffer(NULL), m_width(width), m_height(height), m_padding(padding), m_managed(true)
+	: m_buffer(NULL), m_width(width), m_height(height), m_padding(padding), m_managed(true),
+	m_pool(NULL), m_capacity(width * height)
 {
 	m_buffer = new unsigned int[width * height];
 	memset(m_buffer, 0, width * height * sizeof(unsigned int));
@@ -56,32 +64,221 @@ Bitmap_32bits::Bitmap_32bits(int width, int height, int padding)
 #endif//_DFONT_DEBUG
 }
 Bitmap_32bits::Bitmap_32bits(unsigned int* buf, int width, int height, int padding)
-	: m_buffer(buf), m_width(width), m_height(height), m_padding(padding), m_managed(false)
+	: m_buffer(buf), m_width(width), m_height(height), m_padding(padding), m_managed(false),
+	m_pool(NULL), m_capacity(width * height)
+{
+}
+Bitmap_32bits::Bitmap_32bits(BitmapPool* pool, int capacity)
+	: m_buffer(NULL), m_width(0), m_height(0), m_padding(0), m_managed(true),
+	m_pool(pool), m_capacity(capacity)
 {
+	m_buffer = new unsigned int[capacity];
 }
 Bitmap_32bits::~Bitmap_32bits() 
 {
 	if ( m_managed && m_buffer )
 	{
-		delete m_buffer;
+		delete[] m_buffer;
 		m_buffer = NULL;
 	}
 }
 
 void Bitmap_32bits::release()
 {
+	if ( m_pool )
+	{
+		m_pool->_recycle(this, numbits(), m_capacity);
+		return;
+	}
 	delete this;
 }
 
+void Bitmap_32bits::_reshape(int width, int height, int padding)
+{
+	m_width = width;
+	m_height = height;
+	m_padding = padding;
+	memset(m_buffer, 0, width * height * sizeof(unsigned int));
+}
+
+Bitmap_8bits::Bitmap_8bits(int width, int height, int padding)
+	: m_buffer(NULL), m_width(width), m_height(height), m_padding(padding), m_managed(true),
+	m_pool(NULL), m_capacity(width * height)
+{
+	m_buffer = new unsigned char[width * height];
+	memset(m_buffer, 0, width * height);
+}
+Bitmap_8bits::Bitmap_8bits(unsigned char* buf, int width, int height, int padding)
+	: m_buffer(buf), m_width(width), m_height(height), m_padding(padding), m_managed(false),
+	m_pool(NULL), m_capacity(width * height)
+{
+}
+Bitmap_8bits::Bitmap_8bits(BitmapPool* pool, int capacity)
+	: m_buffer(NULL), m_width(0), m_height(0), m_padding(0), m_managed(true),
+	m_pool(pool), m_capacity(capacity)
+{
+	m_buffer = new unsigned char[capacity];
+}
+Bitmap_8bits::~Bitmap_8bits() 
+{
+	if ( m_managed && m_buffer )
+	{
+		delete[] m_buffer;
+		m_buffer = NULL;
+	}
+}
+
+void Bitmap_8bits::release()
+{
+	if ( m_pool )
+	{
+		m_pool->_recycle(this, numbits(), m_capacity);
+		return;
+	}
+	delete this;
+}
+
+void Bitmap_8bits::_reshape(int width, int height, int padding)
+{
+	m_width = width;
+	m_height = height;
+	m_padding = padding;
+	memset(m_buffer, 0, width * height);
+}
+
+//////////////////////////////////////////////////////////////////////////
+BitmapPool::BitmapPool(size_t max_pooled_bytes)
+	: m_max_pooled_bytes(max_pooled_bytes), m_pooled_bytes(0),
+	m_alloc_count(0), m_heap_alloc_count(0)
+{
+}
+
+BitmapPool::~BitmapPool()
+{
+	for ( int format = 0; format < 2; format++ )
+	{
+		for ( int cls = 0; cls < c_class_num; cls++ )
+		{
+			std::vector<IBitmap*>& free_list = m_free[format][cls];
+			for ( size_t i = 0; i < free_list.size(); i++ )
+			{
+				delete free_list[i];
+			}
+			free_list.clear();
+		}
+	}
+}
+
+IBitmap* BitmapPool::alloc(int numbits, int real_width, int real_height, int padding)
+{
+	m_alloc_count++;
+
+	int units = real_width * real_height;
+	int cls = _size_class(units);
+	bool a8 = numbits == 8;
+
+	// too large to pool
+	if ( cls < 0 )
+	{
+		m_heap_alloc_count++;
+		if ( a8 )
+			return new Bitmap_8bits(real_width, real_height, padding);
+		return new Bitmap_32bits(real_width, real_height, padding);
+	}
+
+	int capacity = 1 << (cls + c_min_class_bits);
+	std::vector<IBitmap*>& free_list = m_free[a8 ? 0 : 1][cls];
+
+	if ( a8 )
+	{
+		Bitmap_8bits* bitmap = NULL;
+		if ( free_list.empty() )
+		{
+			m_heap_alloc_count++;
+			bitmap = new Bitmap_8bits(this, capacity);
+		}
+		else
+		{
+			bitmap = (Bitmap_8bits*)free_list.back();
+			free_list.pop_back();
+			m_pooled_bytes -= capacity;
+		}
+		bitmap->_reshape(real_width, real_height, padding);
+		return bitmap;
+	}
+	else
+	{
+		Bitmap_32bits* bitmap = NULL;
+		if ( free_list.empty() )
+		{
+			m_heap_alloc_count++;
+			bitmap = new Bitmap_32bits(this, capacity);
+		}
+		else
+		{
+			bitmap = (Bitmap_32bits*)free_list.back();
+			free_list.pop_back();
+			m_pooled_bytes -= capacity * sizeof(unsigned int);
+		}
+		bitmap->_reshape(real_width, real_height, padding);
+		return bitmap;
+	}
+}
+
+size_t BitmapPool::alloc_count()
+{
+	return m_alloc_count;
+}
+
+size_t BitmapPool::heap_alloc_count()
+{
+	return m_heap_alloc_count;
+}
+
+size_t BitmapPool::pooled_bytes()
+{
+	return m_pooled_bytes;
+}
+
+void BitmapPool::reset_counters()
+{
+	m_alloc_count = 0;
+	m_heap_alloc_count = 0;
+}
+
+int BitmapPool::_size_class(int units)
+{
+	int cls = 0;
+	while ( (1 << (cls + c_min_class_bits)) < units )
+	{
+		cls++;
+	}
+	return cls < c_class_num ? cls : -1;
+}
+
+void BitmapPool::_recycle(IBitmap* bitmap, int numbits, int capacity)
+{
+	size_t bytes = capacity * (numbits >> 3);
+	if ( m_pooled_bytes + bytes > m_max_pooled_bytes )
+	{
+		delete bitmap;
+		return;
+	}
+
+	m_free[numbits == 8 ? 0 : 1][_size_class(capacity)].push_back(bitmap);
+	m_pooled_bytes += bytes;
+}
+
 
 //////////////////////////////////////////////////////////////////////////
 RenderPassParam::RenderPassParam(
 	ColorRGBA c, EBlenderType b, 
 	int tx, int ty, 
-	bool _stroke/*=false*/, FT_F26Dot6 _stroke_radius/* = 64*/)
+	bool _stroke/*=false*/, FT_F26Dot6 _stroke_radius/* = 64*/, int _sdf_spread/* = 0*/)
 	: color(c), blender(b), 
 	translate_x(tx), translate_y(ty), 
-	stroke(_stroke), stroke_radius(_stroke_radius)
+	stroke(_stroke), stroke_radius(_stroke_radius),
+	sdf_spread(_sdf_spread)
 {
 
 }
@@ -95,10 +292,12 @@ void BaseRenderPass::reset()
 	memset(&m_cbox, 0, sizeof(m_cbox));
 	m_color = ColorRGBA(0xff, 0xff, 0xff, 0xff);
 	m_glyph = NULL;
+	m_offset_x = 0;
 	memset(&m_translate, 0, sizeof(m_translate));
 	m_stroke = false;
 	m_stroke_radius = 0;
 	m_blender = NULL;
+	m_blender_type = e_replace_blender;
 }
 
 void BaseRenderPass::init(const RenderPassParam& param)
@@ -159,11 +358,13 @@ const IPixelBlender* BaseRenderPass::blender()
 void BaseRenderPass::set_blender(EBlenderType bt)
 {
 	m_blender = PixelBlenders[bt];
+	m_blender_type = bt;
 }
 
-FT_Error BaseRenderPass::pre_render(FT_Glyph& glyph)
+FT_Error BaseRenderPass::pre_render(FT_Glyph& glyph, FT_Pos offset_x)
 {
-	FT_Error error = FT_Glyph_Copy(glyph, &m_glyph);
+	m_glyph = glyph;
+	m_offset_x = offset_x;
 
 	return pre_render_impl();
 }
@@ -171,7 +372,6 @@ FT_Error BaseRenderPass::pre_render(FT_Glyph& glyph)
 FT_Error BaseRenderPass::post_render(IBitmap* buf, const FT_BBox& buf_cbox)
 {
 	FT_Error error = post_render_impl(buf, buf_cbox);
-	FT_Done_Glyph(m_glyph);
 	m_glyph = NULL;
 	return error;
 }
@@ -243,6 +443,7 @@ void BitmapRenderPass::_render(IBitmap* buf,const FT_BBox& buf_cbox, FT_BitmapGl
 	}
 
 	int grey_level = 0;
+	span_blend_func_t blend_span = get_span_blender(m_blender_type, buf->numbits());
 
 	for ( FT_Int y = 0, pen_y = pen_y_start; y < bitmap_glyph->bitmap.rows && pen_y < buf->height(); y++, pen_y++ )
 	{
@@ -257,12 +458,16 @@ void BitmapRenderPass::_render(IBitmap* buf,const FT_BBox& buf_cbox, FT_BitmapGl
 
 			if ( !border )
 			{	
-				if ( grey_level )
+				// blend the run of set bits at once
+				int run = 1;
+				while ( x + run < bitmap_glyph->bitmap.width && pen_x + run < buf->width()
+					&& ( (bitmap_glyph->bitmap.buffer[row_start_x + ((x+run)>>3)]<<((x+run)%8)) & 0x80 ) )
 				{
-					src.a = FT_Byte(grey_level * src.a / 255);
-					ColorRGBA dst(buf->get_unit_at(pen_x, pen_y));
-					buf->set_unit_at(blender()->blend(src, dst).to_uint32(), pen_x, pen_y);
+					run++;
 				}
+				blend_span(buf->get_unit_ptr(pen_x, pen_y), run, src);
+				x += run - 1;
+				pen_x += run - 1;
 			}
 			else
 			{
@@ -293,39 +498,88 @@ void BitmapRenderPass::_render(IBitmap* buf,const FT_BBox& buf_cbox, FT_BitmapGl
 }
 
 
+OutlineRenderPass::OutlineRenderPass()
+	: m_library(NULL), m_point_capacity(0), m_contour_capacity(0), m_stroker(NULL)
+{
+	memset(&m_outline, 0, sizeof(m_outline));
+}
+
+OutlineRenderPass::~OutlineRenderPass()
+{
+	_done_scratch();
+}
+
+void OutlineRenderPass::set_stroke_radius(FT_F26Dot6 radius)
+{
+	BaseRenderPass::set_stroke_radius(radius);
+
+	if ( m_stroker )
+	{
+		FT_Stroker_Set(m_stroker,
+			stroke_radius(),
+			FT_STROKER_LINECAP_ROUND,
+			FT_STROKER_LINEJOIN_ROUND,
+			0);
+	}
+}
+
 FT_Error OutlineRenderPass::decorate()
 {
 	FT_Error error = 0;
+	FT_Outline* source = &reinterpret_cast<FT_OutlineGlyph>(m_glyph)->outline;
 
-	if ( stroke() )
+	if ( !stroke() )
+	{
+		error = _reserve_outline(source->n_points, source->n_contours);
+		if ( error )
+			return error;
+
+		memcpy(m_outline.points, source->points, source->n_points * sizeof(m_outline.points[0]));
+		memcpy(m_outline.tags, source->tags, source->n_points * sizeof(m_outline.tags[0]));
+		memcpy(m_outline.contours, source->contours, source->n_contours * sizeof(m_outline.contours[0]));
+		m_outline.n_points = source->n_points;
+		m_outline.n_contours = source->n_contours;
+		m_outline.flags = source->flags;
+		return error;
+	}
+
+	if ( !m_stroker )
 	{
-		FT_Stroker stroker;
-		error = FT_Stroker_New(m_glyph->library, &stroker);
+		error = FT_Stroker_New(m_library, &m_stroker);
 		if ( error )
 			return error;
 
-		FT_Stroker_Set(stroker,
+		FT_Stroker_Set(m_stroker,
 			stroke_radius(),
 			FT_STROKER_LINECAP_ROUND,
 			FT_STROKER_LINEJOIN_ROUND,
 			0);
+	}
 
-		error = FT_Glyph_StrokeBorder(&m_glyph, stroker, 0, 1);
-		if ( error )
-			return error;
+	// outside border as FT_Glyph_StrokeBorder, parsing rewinds the stroker
+	FT_StrokerBorder border = FT_Outline_GetOutsideBorder(source);
+	error = FT_Stroker_ParseOutline(m_stroker, source, 0);
+	if ( error )
+		return error;
 
-		FT_Stroker_Done(stroker);
+	FT_UInt num_points = 0;
+	FT_UInt num_contours = 0;
+	error = FT_Stroker_GetBorderCounts(m_stroker, border, &num_points, &num_contours);
+	if ( error )
+		return error;
 
-		FT_Pos stroke_pixel = round_26dot6(stroke_radius()) * 2;
-	}
+	error = _reserve_outline(num_points, num_contours);
+	if ( error )
+		return error;
+
+	FT_Stroker_ExportBorder(m_stroker, border, &m_outline);
 
 	return error;
 }
 
 FT_Error OutlineRenderPass::transform()
 {
-	FT_Outline* outline = &reinterpret_cast<FT_OutlineGlyph>(m_glyph)->outline;
-	FT_Outline_Translate(outline, m_translate.x << 6, m_translate.y << 6);
+	FT_Outline_Translate(&m_outline, (m_translate.x << 6) + m_offset_x, m_translate.y << 6);
 	return 0;
 }
 
@@ -335,6 +589,8 @@ FT_Error OutlineRenderPass::pre_render_impl()
 	if ( m_glyph->format != FT_GLYPH_FORMAT_OUTLINE )
 		return -1;
 
+	_bind_library(m_glyph->library);
+
 	error = decorate();
 	if ( error )
 		return error;
@@ -343,13 +599,66 @@ FT_Error OutlineRenderPass::pre_render_impl()
 	if ( error )
 		return error;
 
-	FT_Outline* outline =
-		&reinterpret_cast<FT_OutlineGlyph>(m_glyph)->outline;
-	FT_Outline_Get_CBox( outline, &m_cbox );
+	FT_Outline_Get_CBox( &m_outline, &m_cbox );
 
 	return error;
 }
 
+void OutlineRenderPass::_bind_library(FT_Library library)
+{
+	if ( m_library != library )
+	{
+		_done_scratch();
+		m_library = library;
+	}
+}
+
+FT_Error OutlineRenderPass::_reserve_outline(FT_UInt points, FT_UInt contours)
+{
+	if ( points > m_point_capacity || contours > m_contour_capacity )
+	{
+		// grow by half to settle after a few large glyphs
+		FT_UInt point_capacity = m_point_capacity > points ? m_point_capacity : points + points / 2;
+		FT_UInt contour_capacity = m_contour_capacity > contours ? m_contour_capacity : contours + contours / 2;
+
+		if ( m_point_capacity > 0 )
+		{
+			FT_Outline_Done(m_library, &m_outline);
+			memset(&m_outline, 0, sizeof(m_outline));
+			m_point_capacity = 0;
+			m_contour_capacity = 0;
+		}
+
+		FT_Error error = FT_Outline_New(m_library, point_capacity, contour_capacity, &m_outline);
+		if ( error )
+			return error;
+
+		m_point_capacity = point_capacity;
+		m_contour_capacity = contour_capacity;
+	}
+
+	m_outline.n_points = 0;
+	m_outline.n_contours = 0;
+	return 0;
+}
+
+void OutlineRenderPass::_done_scratch()
+{
+	if ( m_stroker )
+	{
+		FT_Stroker_Done(m_stroker);
+		m_stroker = NULL;
+	}
+
+	if ( m_point_capacity > 0 )
+	{
+		FT_Outline_Done(m_library, &m_outline);
+		memset(&m_outline, 0, sizeof(m_outline));
+		m_point_capacity = 0;
+		m_contour_capacity = 0;
+	}
+}
+
 FT_Error OutlineRenderPass::post_render_impl(IBitmap* buf, const FT_BBox& buf_cbox)
 {
 	FT_Error error = 0;
@@ -358,6 +667,8 @@ FT_Error OutlineRenderPass::post_render_impl(IBitmap* buf, const FT_BBox& buf_cb
 	ctx.pass = this;
 	ctx.buf = buf;
 	ctx.buf_cbox = &buf_cbox;
+	ctx.color = color();
+	ctx.blend_span = get_span_blender(m_blender_type, buf->numbits());
 
 	FT_Raster_Params params;
 	memset(&params, 0, sizeof(params));
@@ -365,10 +676,7 @@ FT_Error OutlineRenderPass::post_render_impl(IBitmap* buf, const FT_BBox& buf_cb
 	params.gray_spans = spans_callback;
 	params.user = &ctx;
 
-	FT_Outline* outline =
-		&reinterpret_cast<FT_OutlineGlyph>(m_glyph)->outline;
-
-	error = FT_Outline_Render(m_glyph->library, outline, &params);
+	error = FT_Outline_Render(m_library, &m_outline, &params);
 
 	return error;
 }
@@ -384,25 +692,171 @@ void OutlineRenderPass::spans_callback(const int y, const int count, const FT_Sp
 		for (int i = 0; i < count; ++i) 
 		{
 			int draw_x_start = spans[i].x - pen_pix_x;
-			for ( int j = 0; j < spans[i].len; j++ )
-			{
-				int draw_x = draw_x_start + j;
-				if ( draw_x < 0 )
-					continue;
-				if ( draw_x >= ctx->buf->width() )
-					break;
-
-				ColorRGBA color;
-				ColorRGBA src = ctx->pass->color();
-				src.a = FT_Byte((int)spans[i].coverage * src.a / 255);
-				ColorRGBA dst(ctx->buf->get_unit_at(draw_x, draw_y));
-				ctx->buf->set_unit_at(ctx->pass->blender()->blend(src, dst).to_uint32(), draw_x, draw_y);
-			}
+			int draw_x_end = draw_x_start + spans[i].len;
+			if ( draw_x_start < 0 )
+				draw_x_start = 0;
+			if ( draw_x_end > ctx->buf->width() )
+				draw_x_end = ctx->buf->width();
+			if ( draw_x_start >= draw_x_end )
+				continue;
+
+			ColorRGBA src = ctx->color;
+			src.a = FT_Byte((int)spans[i].coverage * src.a / 255);
+			ctx->blend_span(ctx->buf->get_unit_ptr(draw_x_start, draw_y), draw_x_end - draw_x_start, src);
+		}
+}
+
+SDFRenderPass::SDFRenderPass()
+	: m_spread(0)
+{
+}
+
+void SDFRenderPass::init(const RenderPassParam& param)
+{
+	OutlineRenderPass::init(param);
+	set_stroke(false);
+	m_spread = param.sdf_spread;
+}
+
+FT_Error SDFRenderPass::pre_render_impl()
+{
+	FT_Error error = OutlineRenderPass::pre_render_impl();
+	if ( error )
+		return error;
+
+	m_cbox.xMin -= m_spread << 6;
+	m_cbox.yMin -= m_spread << 6;
+	m_cbox.xMax += m_spread << 6;
+	m_cbox.yMax += m_spread << 6;
+
+	return error;
+}
+
+// squared distance transform of a sampled function, Felzenszwalb & Huttenlocher
+static void _edt_1d(const float* f, float* d, int n, int* v, float* z)
+{
+	int k = 0;
+	v[0] = 0;
+	z[0] = -FLT_MAX;
+	z[1] = FLT_MAX;
+	for ( int q = 1; q < n; q++ )
+	{
+		float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+		while ( s <= z[k] )
+		{
+			k--;
+			s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = FLT_MAX;
+	}
+
+	k = 0;
+	for ( int q = 0; q < n; q++ )
+	{
+		while ( z[k + 1] < q )
+			k++;
+		d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+	}
+}
+
+// large enough but sums of it are still finite
+static const float c_edt_inf = 1e20f;
+
+// grid holds 0 for seeds and c_edt_inf for others, replaced by squared distance to seeds
+static void _edt_2d(float* grid, int width, int height)
+{
+	int n = width > height ? width : height;
+	std::vector<float> f(n), d(n), z(n + 1);
+	std::vector<int> v(n);
+
+	for ( int x = 0; x < width; x++ )
+	{
+		for ( int y = 0; y < height; y++ )
+			f[y] = grid[y * width + x];
+		_edt_1d(&f[0], &d[0], height, &v[0], &z[0]);
+		for ( int y = 0; y < height; y++ )
+			grid[y * width + x] = d[y];
+	}
+
+	for ( int y = 0; y < height; y++ )
+	{
+		_edt_1d(&grid[y * width], &d[0], width, &v[0], &z[0]);
+		memcpy(&grid[y * width], &d[0], width * sizeof(float));
+	}
+}
+
+FT_Error SDFRenderPass::post_render_impl(IBitmap* buf, const FT_BBox& buf_cbox)
+{
+	int width = buf->width();
+	int height = buf->height();
+	if ( width <= 0 || height <= 0 )
+		return 0;
+
+	// coverage of the outline
+	Bitmap_8bits coverage(width, height);
+
+	RenderContext ctx;
+	ctx.pass = this;
+	ctx.buf = &coverage;
+	ctx.buf_cbox = &buf_cbox;
+	ctx.color = ColorRGBA(0xff, 0xff, 0xff, 0xff);
+	ctx.blend_span = get_span_blender(e_replace_blender, coverage.numbits());
+
+	FT_Raster_Params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = FT_RASTER_FLAG_AA | FT_RASTER_FLAG_DIRECT;
+	params.gray_spans = spans_callback;
+	params.user = &ctx;
+
+	FT_Error error = FT_Outline_Render(m_library, &m_outline, &params);
+	if ( error )
+		return error;
+
+	// squared distance to inside pixels and to outside pixels
+	const unsigned char* cov = (const unsigned char*)coverage.get_buffer();
+	int size = width * height;
+	std::vector<float> to_inside(size), to_outside(size);
+	for ( int i = 0; i < size; i++ )
+	{
+		bool inside = cov[i] >= 0x80;
+		to_inside[i] = inside ? 0.0f : c_edt_inf;
+		to_outside[i] = inside ? c_edt_inf : 0.0f;
+	}
+	_edt_2d(&to_inside[0], width, height);
+	_edt_2d(&to_outside[0], width, height);
+
+	for ( int y = 0; y < height; y++ )
+	{
+		for ( int x = 0; x < width; x++ )
+		{
+			int i = y * width + x;
+
+			// distance to edge in pixels, positive outside
+			float dist;
+			if ( cov[i] > 0 && cov[i] < 0xff )
+				dist = 0.5f - cov[i] / 255.0f;
+			else if ( cov[i] >= 0x80 )
+				dist = 0.5f - sqrtf(to_outside[i]);
+			else
+				dist = sqrtf(to_inside[i]) - 0.5f;
+
+			float alpha = 0.5f - dist / (2 * m_spread);
+			alpha = alpha < 0.0f ? 0.0f : (alpha > 1.0f ? 1.0f : alpha);
+
+			FT_UInt32 value = (FT_UInt32)(alpha * 255.0f + 0.5f);
+			buf->set_unit_at((value << 24) | 0x00ffffff, x, y);
 		}
+	}
+
+	return error;
 }
 
 
 GlyphRenderer::GlyphRenderer()
+	: m_pixel_format(e_pixel_rgba8888), m_bitmap_pool(NULL)
 {
 
 }
@@ -421,6 +875,7 @@ void GlyphRenderer::reset()
 	}
 	m_outline_passes.clear();
 	m_bitmap_passes.clear();
+	m_params.clear();
 }
 
 GlyphRenderer* GlyphRenderer::init_pass()
@@ -433,9 +888,14 @@ GlyphRenderer* GlyphRenderer::add_pass(const RenderPassParam& param)
 {
 	IRenderPass* pass = NULL;
 
+	m_params.push_back(param);
+
 	// add outline pass
 	{
-		pass = new OutlineRenderPass;
+		if ( param.sdf_spread > 0 )
+			pass = new SDFRenderPass;
+		else
+			pass = new OutlineRenderPass;
 		pass->init(param);
 		m_outline_passes.push_back(pass);
 	}
@@ -455,12 +915,72 @@ GlyphRenderer* GlyphRenderer::add_pass(const RenderPassParam& param)
 	return this;
 }
 
-FT_Error GlyphRenderer::render(FT_Glyph& glyph, GlyphBitmap* glyph_bitmap)
+bool GlyphRenderer::single_color(ColorRGBA* color)
 {
-	return render(glyph, &glyph_bitmap->bitmap, &glyph_bitmap->top_left_pixels, &glyph_bitmap->advance_pixels);
+	if ( m_outline_passes.empty() )
+		return false;
+
+	ColorRGBA c = m_outline_passes[0]->color();
+	for ( size_t i = 1; i < m_outline_passes.size(); i++ )
+	{
+		if ( m_outline_passes[i]->color().to_uint32() != c.to_uint32() )
+			return false;
+	}
+
+	if ( color )
+		*color = c;
+
+	return true;
+}
+
+void GlyphRenderer::set_pixel_format(EPixelFormat format)
+{
+	m_pixel_format = format;
+}
+
+EPixelFormat GlyphRenderer::pixel_format()
+{
+	return m_pixel_format;
+}
+
+GlyphRenderer* GlyphRenderer::clone()
+{
+	GlyphRenderer* renderer = new GlyphRenderer;
+	renderer->init_pass();
+	for ( size_t i = 0; i < m_params.size(); i++ )
+	{
+		renderer->add_pass(m_params[i]);
+	}
+	renderer->set_pixel_format(m_pixel_format);
+	return renderer;
+}
+
+const std::vector<RenderPassParam>& GlyphRenderer::params()
+{
+	return m_params;
+}
+
+void GlyphRenderer::set_bitmap_pool(BitmapPool* pool)
+{
+	m_bitmap_pool = pool;
+}
+
+FT_Error GlyphRenderer::render(FT_Glyph& glyph, GlyphBitmap* glyph_bitmap, FT_Pos offset_x /*= 0*/)
+{
+	FT_Error error = _render(glyph, &glyph_bitmap->bitmap, &glyph_bitmap->top_left_pixels, &glyph_bitmap->advance_pixels, offset_x);
+
+	// advance.x is 16.16, stroke correction is in whole pixels
+	FT_Pos correct = glyph_bitmap->advance_pixels.x - (glyph->advance.x >> 16);
+	glyph_bitmap->advance_x_26dot6 = (glyph->advance.x >> 10) + (correct << 6);
+	return error;
 }
 
 FT_Error GlyphRenderer::render(FT_Glyph& glyph, IBitmap** pbuf, FT_Vector* top_left_pixel, FT_Vector* advance_pixel)
+{
+	return _render(glyph, pbuf, top_left_pixel, advance_pixel, 0);
+}
+
+FT_Error GlyphRenderer::_render(FT_Glyph& glyph, IBitmap** pbuf, FT_Vector* top_left_pixel, FT_Vector* advance_pixel, FT_Pos offset_x)
 {
 	FT_Error error = 0;
 	FT_BBox bbox;
@@ -487,14 +1007,27 @@ FT_Error GlyphRenderer::render(FT_Glyph& glyph, IBitmap** pbuf, FT_Vector* top_l
 	for ( size_t i = 0; i < passes->size(); i++ )
 	{
 		stroke_radius = (*passes)[i]->stroke_radius() > stroke_radius ? (*passes)[i]->stroke_radius() : stroke_radius;
-		error = (*passes)[i]->pre_render(glyph);
+		error = (*passes)[i]->pre_render(glyph, offset_x);
 		bbox = intersect_bbox(bbox, (*passes)[i]->cbox());
 	}
 	align_bbox(bbox);
 
 	if ( buf == NULL )
 	{
-		buf = new Bitmap_32bits( ((bbox.xMax - bbox.xMin) >> 6) + 2*DFONT_BITMAP_PADDING, ((bbox.yMax - bbox.yMin) >> 6) + 2*DFONT_BITMAP_PADDING, DFONT_BITMAP_PADDING );
+		int buf_width = ((bbox.xMax - bbox.xMin) >> 6) + 2*DFONT_BITMAP_PADDING;
+		int buf_height = ((bbox.yMax - bbox.yMin) >> 6) + 2*DFONT_BITMAP_PADDING;
+		if ( m_bitmap_pool )
+		{
+			buf = m_bitmap_pool->alloc( m_pixel_format == e_pixel_a8 ? 8 : 32, buf_width, buf_height, DFONT_BITMAP_PADDING );
+		}
+		else if ( m_pixel_format == e_pixel_a8 )
+		{
+			buf = new Bitmap_8bits( buf_width, buf_height, DFONT_BITMAP_PADDING );
+		}
+		else
+		{
+			buf = new Bitmap_32bits( buf_width, buf_height, DFONT_BITMAP_PADDING );
+		}
 		*pbuf = buf;
 	}
 
@@ -521,6 +1054,41 @@ FT_Error GlyphRenderer::render(FT_Glyph& glyph, IBitmap** pbuf, FT_Vector* top_l
 	return error;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// KerningCache
+
+KerningCache::KerningCache()
+	: m_entries(NULL)
+{
+}
+
+KerningCache::~KerningCache()
+{
+	delete[] m_entries;
+}
+
+void KerningCache::insert(FT_ULong left_code, FT_ULong right_code, int pixels)
+{
+	if ( !m_entries )
+	{
+		m_entries = new Entry[DFONT_KERNING_CACHE_SIZE];
+		clear();
+	}
+
+	Entry& entry = m_entries[_index(left_code, right_code)];
+	entry.left_code = (FT_UInt32)left_code;
+	entry.right_code = (FT_UInt32)right_code;
+	entry.pixels = pixels;
+}
+
+void KerningCache::clear()
+{
+	if ( m_entries )
+	{
+		memset(m_entries, 0, sizeof(Entry) * DFONT_KERNING_CACHE_SIZE);
+	}
+}
+
 FontInfo* FontInfo::create_font(FT_Library library, const char* fontname, FT_UInt width_pt, FT_UInt height_pt, FT_UInt ppi/*=72*/)
 {
 	return create_font(library, fontname, 0, width_pt, height_pt, ppi);
@@ -536,7 +1104,7 @@ FontInfo* FontInfo::create_font(FT_Library library, const char* fontname, FT_Lon
 		}
 
 		delete f;
-		return false;
+		return NULL;
 	}
 
 	return NULL;
@@ -548,6 +1116,32 @@ void FontInfo::release()
 	delete this;
 }
 
+FontInfo* FontInfo::clone(FT_Library library)
+{
+	FontInfo* f = create_font(library, m_fontname.c_str(), m_face_idx, m_size_width_pt, m_size_height_pt, m_ppi);
+	if ( !f )
+	{
+		return NULL;
+	}
+
+	if ( renderer() )
+	{
+		f->m_private_renderer = renderer()->clone();
+		f->set_renderer(f->m_private_renderer);
+	}
+	f->m_shift_y = m_shift_y;
+	f->m_extend_pt = m_extend_pt;
+	f->m_available_charset = m_available_charset;
+
+	for ( size_t i = 0; i < m_hackfonts.size(); i++ )
+	{
+		FontInfo* hackfont = m_hackfonts[i];
+		f->add_hackfont(hackfont->m_fontname.c_str(), hackfont->m_face_idx, hackfont->m_available_charset, hackfont->m_shift_y);
+	}
+
+	return f;
+}
+
 FontInfo* FontInfo::add_pass(const RenderPassParam& param)
 {
 	if ( renderer() == NULL )
@@ -571,51 +1165,175 @@ FontInfo* FontInfo::add_pass(const RenderPassParam& param)
 	return this;
 }
 
-FT_UInt FontInfo::render_charcode(FT_ULong char_code, GlyphBitmap* bitmap, FT_UInt prev_idx)
+bool FontInfo::single_color(ColorRGBA* color)
 {
-	for ( size_t i = 0; i < m_hackfonts.size(); i++ )
+	return renderer() && renderer()->single_color(color);
+}
+
+void FontInfo::set_pixel_format(EPixelFormat format)
+{
+	if ( renderer() )
 	{
-		FT_UInt charidx = m_hackfonts[i]->get_char_index(char_code);
-		if ( charidx > 0 )
-		{
-			return m_hackfonts[i]->render_charidx(charidx, bitmap, prev_idx) ? charidx : 0;
-		}
+		renderer()->set_pixel_format(format);
+	}
+}
+
+EPixelFormat FontInfo::pixel_format()
+{
+	return renderer() ? renderer()->pixel_format() : e_pixel_rgba8888;
+}
+
+void FontInfo::set_bitmap_pool(BitmapPool* pool)
+{
+	if ( renderer() )
+	{
+		renderer()->set_bitmap_pool(pool);
 	}
+}
 
-	FT_UInt char_idx = get_char_index(char_code);
+FT_UInt FontInfo::render_charcode(FT_ULong char_code, GlyphBitmap* bitmap, FT_Pos offset_x /*= 0*/)
+{
+	FontInfo* font = NULL;
+	FT_UInt char_idx = _resolve_char(char_code, &font);
 	if ( char_idx == 0 ) 
 		return 0;
 
-	return render_charidx(char_idx, bitmap, prev_idx) ? char_idx : 0;
+	return font->render_charidx(char_idx, bitmap, offset_x) ? char_idx : 0;
 }
 
-// from char code to char index
-FT_UInt FontInfo::get_char_index(FT_ULong charcode)
+int FontInfo::kerning(FT_ULong left_code, FT_ULong right_code)
 {
-	// if set charset, only chars in charset can be rendered
-	if ( m_available_charset != NULL && m_available_charset->find(charcode) == m_available_charset->end() )
+	int pixels = 0;
+	if ( m_kerning_cache.find(left_code, right_code, &pixels) )
+	{
+		return pixels;
+	}
+
+	FontInfo* left_font = NULL;
+	FontInfo* right_font = NULL;
+	FT_UInt left_idx = _resolve_char(left_code, &left_font);
+	FT_UInt right_idx = _resolve_char(right_code, &right_font);
+	if ( left_idx && right_idx && left_font == right_font && left_font->has_kerning() )
+	{
+		pixels = (int)(left_font->get_kerning(left_idx, right_idx).x >> 6);
+	}
+
+	m_kerning_cache.insert(left_code, right_code, pixels);
+	return pixels;
+}
+
+FT_UInt FontInfo::_resolve_char(FT_ULong char_code, FontInfo** font)
+{
+	if ( m_char_ranges_dirty )
+	{
+		_build_char_ranges();
+	}
+
+	*font = this;
+
+	// the last range starting at or before the char
+	size_t lo = 0;
+	size_t hi = m_char_ranges.size();
+	while ( lo < hi )
+	{
+		size_t mid = (lo + hi) >> 1;
+		if ( m_char_ranges[mid].first <= char_code )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ( lo == 0 || m_char_ranges[lo - 1].last < char_code )
 	{
 		return 0;
 	}
-	return FT_Get_Char_Index(m_face, charcode);
+
+	int font_idx = m_char_ranges[lo - 1].font_idx;
+	if ( font_idx < (int)m_hackfonts.size() )
+	{
+		*font = m_hackfonts[font_idx];
+	}
+	return FT_Get_Char_Index((*font)->m_face, char_code);
 }
 
-bool FontInfo::render_charidx(FT_UInt char_idx, GlyphBitmap* bitmap, FT_UInt prev_idx)
+void FontInfo::_build_char_ranges()
 {
-	if ( load_glyph_from_index(char_idx)
-		&& 0 == _render_ready_char(bitmap) )
+	std::vector<std::pair<FT_ULong, int> > chars;
+	for ( size_t i = 0; i < m_hackfonts.size(); i++ )
+	{
+		m_hackfonts[i]->_collect_chars((int)i, &chars);
+	}
+	_collect_chars((int)m_hackfonts.size(), &chars);
+
+	// the first font of a char wins
+	std::sort(chars.begin(), chars.end());
+
+	m_char_ranges.clear();
+	for ( size_t i = 0; i < chars.size(); i++ )
 	{
-		if ( has_kerning() && prev_idx != 0 )
+		FT_ULong char_code = chars[i].first;
+		int font_idx = chars[i].second;
+		if ( i > 0 && chars[i - 1].first == char_code )
 		{
-			FT_Vector kern = get_kerning(prev_idx, char_idx);
-			bitmap->kerning_pixels.x = (kern.x >> 6);
-			bitmap->kerning_pixels.y = (kern.x >> 6);
+			continue;
 		}
 
-		return true;
+		if ( !m_char_ranges.empty() 
+			&& m_char_ranges.back().last + 1 == char_code 
+			&& m_char_ranges.back().font_idx == font_idx )
+		{
+			m_char_ranges.back().last = char_code;
+		}
+		else
+		{
+			CharRange range;
+			range.first = char_code;
+			range.last = char_code;
+			range.font_idx = font_idx;
+			m_char_ranges.push_back(range);
+		}
 	}
 
-	return false;
+	m_char_ranges_dirty = false;
+}
+
+void FontInfo::_collect_chars(int font_idx, std::vector<std::pair<FT_ULong, int> >* chars)
+{
+	if ( m_available_charset )
+	{
+		for ( std::set<FT_ULong>::iterator it = m_available_charset->begin(); it != m_available_charset->end(); it++ )
+		{
+			if ( FT_Get_Char_Index(m_face, *it) )
+			{
+				chars->push_back(std::make_pair(*it, font_idx));
+			}
+		}
+		return;
+	}
+
+	FT_UInt char_idx = 0;
+	FT_ULong char_code = FT_Get_First_Char(m_face, &char_idx);
+	while ( char_idx != 0 )
+	{
+		chars->push_back(std::make_pair(char_code, font_idx));
+		char_code = FT_Get_Next_Char(m_face, char_code, &char_idx);
+	}
+}
+
+// from char code to char index
+FT_UInt FontInfo::get_char_index(FT_ULong charcode)
+{
+	// if set charset, only chars in charset can be rendered
+	if ( m_available_charset != NULL && m_available_charset->find(charcode) == m_available_charset->end() )
+	{
+		return 0;
+	}
+	return FT_Get_Char_Index(m_face, charcode);
+}
+
+bool FontInfo::render_charidx(FT_UInt char_idx, GlyphBitmap* bitmap, FT_Pos offset_x /*= 0*/)
+{
+	return 0 == _render_ready_char(char_idx, bitmap, offset_x);
 }
 
 // has kerning info
@@ -630,6 +1348,7 @@ FT_Vector FontInfo::get_kerning(FT_UInt left_idx, FT_UInt right_idx)
 	delta.y = 0;
 	if ( m_has_kerning ) 
 	{ 
+		FT_Activate_Size(m_size);
 		FT_Get_Kerning( m_face, left_idx, right_idx, FT_KERNING_DEFAULT, &delta );  
 	} 
 
@@ -641,6 +1360,16 @@ const char* FontInfo::font_name()
 	return m_fontname.c_str();
 }
 
+FT_Long FontInfo::face_idx()
+{
+	return m_face_idx;
+}
+
+const std::vector<RenderPassParam>* FontInfo::pass_params()
+{
+	return renderer() ? &renderer()->params() : NULL;
+}
+
 FT_Library FontInfo::library()
 {
 	return m_library;
@@ -671,6 +1400,11 @@ void FontInfo::set_shift_y(FT_UInt sy)
 	m_shift_y = sy;
 }
 
+FT_UInt FontInfo::shift_y()
+{
+	return m_shift_y;
+}
+
 FT_UInt FontInfo::extend_pt()
 {
 	return m_extend_pt;
@@ -694,6 +1428,18 @@ FT_Face FontInfo::face()
 void FontInfo::set_available_charset(std::set<FT_ULong>* charset)
 {
 	m_available_charset = charset;
+	m_kerning_cache.clear();
+	m_char_ranges_dirty = true;
+}
+
+std::set<FT_ULong>* FontInfo::available_charset()
+{
+	return m_available_charset;
+}
+
+std::vector<FontInfo*>* FontInfo::hackfonts()
+{
+	return &m_hackfonts;
 }
 
 FontInfo* FontInfo::add_hackfont(const char* fontname, std::set<FT_ULong>* charset, FT_UInt shift_y /*= 0*/)
@@ -713,20 +1459,27 @@ FontInfo* FontInfo::add_hackfont(const char* fontname, FT_Long face_idx, std::se
 	hackfont->set_renderer(renderer());
 	hackfont->set_shift_y(shift_y);
 	m_hackfonts.push_back(hackfont);
+	m_kerning_cache.clear();
+	m_char_ranges_dirty = true;
 	return hackfont;
 }
 
 
-FT_Error FontInfo::_render_ready_char(GlyphBitmap* bitmap)
+FT_Error FontInfo::_render_ready_char(FT_UInt char_idx, GlyphBitmap* bitmap, FT_Pos offset_x)
 {
-	FT_Error error;
-	FT_Glyph glyph = NULL;
-	error = FT_Get_Glyph(current_glyph(), &glyph);
-	if ( error != 0 )
-		return error;
+	// owned by the face cache
+	FT_Fixed linear_advance = 0;
+	FT_Glyph glyph = m_shared_face->load_glyph(m_size, char_idx, &linear_advance);
+	if ( !glyph )
+		return -1;
 
-	error = renderer()->render(glyph, bitmap);
-	FT_Done_Glyph(glyph);
+	FT_Error error = renderer()->render(glyph, bitmap, offset_x);
+
+	// hinted advance is rounded, subpixel positions follow the linear one
+	if ( glyph->format == FT_GLYPH_FORMAT_OUTLINE )
+	{
+		bitmap->advance_x_26dot6 += (linear_advance >> 10) - (glyph->advance.x >> 10);
+	}
 
 	bitmap->top_left_pixels.y += m_shift_y;
 
@@ -740,7 +1493,7 @@ FT_GlyphSlot FontInfo::current_glyph()
 
 bool FontInfo::load_glyph_from_index(FT_UInt char_idx)
 {
-	return 0 == FT_Load_Glyph(m_face, char_idx, FT_LOAD_DEFAULT);
+	return 0 == FT_Activate_Size(m_size) && 0 == FT_Load_Glyph(m_face, char_idx, FT_LOAD_DEFAULT);
 }
 
 bool FontInfo::load_glyph_from_char(FT_ULong char_code)
@@ -768,9 +1521,20 @@ FT_Error FontInfo::init(FT_Library& lib, const char* fontname, FT_Long face_idx,
 	FT_Error error = 0;
 
 	m_fontname = fontname;
+	m_face_idx = face_idx;
 	
-	error = FT_New_Face(lib, m_fontname.c_str(), face_idx, &m_face);
-	if ( error ) return error;
+	// the face is shared with other fonts of the file, sizes are not
+	m_shared_face = FaceManager::instance()->acquire(lib, fontname, face_idx);
+	if ( !m_shared_face ) return FT_Err_Cannot_Open_Resource;
+	m_face = m_shared_face->face();
+
+	error = FT_New_Size(m_face, &m_size);
+	if ( !error ) error = FT_Activate_Size(m_size);
+	if ( error )
+	{
+		_done_face();
+		return error;
+	}
 
 	m_has_kerning = FT_HAS_KERNING(m_face) != 0; 
 
@@ -778,6 +1542,9 @@ FT_Error FontInfo::init(FT_Library& lib, const char* fontname, FT_Long face_idx,
 	if (height_pt == 0) height_pt = width_pt;
 	if (width_pt == 0) width_pt = height_pt;
 
+	m_size_width_pt = width_pt;
+	m_size_height_pt = height_pt;
+
 	m_ppi = ppi;
 
 	// fixed size
@@ -805,8 +1572,7 @@ FT_Error FontInfo::init(FT_Library& lib, const char* fontname, FT_Long face_idx,
 		error = FT_Select_Size(m_face, selected_idx);
 		if ( error )
 		{
-			FT_Done_Face(m_face);
-			m_face = NULL;
+			_done_face();
 			return error;
 		}
 		m_isbitmap = true;
@@ -817,8 +1583,7 @@ FT_Error FontInfo::init(FT_Library& lib, const char* fontname, FT_Long face_idx,
 		error = FT_Set_Pixel_Sizes(m_face, width_pt, height_pt);//FT_Set_Char_Size( m_face, width_pt << 6, height_pt << 6, ppi, ppi );
 		if ( error )
 		{
-			FT_Done_Face(m_face);
-			m_face = NULL;
+			_done_face();
 			return error;
 		}
 		m_char_width = width_pt;
@@ -841,13 +1606,15 @@ FT_Error FontInfo::init(FT_Library& lib, const char* fontname, FT_Long face_idx,
 }
 
 FontInfo::FontInfo(FT_Library lib) 
-	: m_library(lib), m_fontname(), m_isbitmap(false), 
+	: m_library(lib), m_fontname(), m_face_idx(0), 
+	m_size_width_pt(0), m_size_height_pt(0), m_isbitmap(false), 
 	m_char_width(0), m_char_height(0), m_ppi(0), 
 	m_shift_y(0), m_extend_pt(0),
 	m_underline_position(0), m_underline_thickness(0),
-	m_face(NULL), m_has_kerning(false),
+	m_shared_face(NULL), m_face(NULL), m_size(NULL), m_has_kerning(false),
 	m_ob_renderer(NULL), m_private_renderer(NULL),
-	m_available_charset(NULL)
+	m_available_charset(NULL),
+	m_char_ranges_dirty(true)
 {
 
 }
@@ -866,11 +1633,23 @@ FontInfo::~FontInfo()
 		m_private_renderer = NULL;
 	}
 
-	if (m_face)
+	_done_face();
+}
+
+void FontInfo::_done_face()
+{
+	if ( m_size )
+	{
+		FT_Done_Size(m_size);
+		m_size = NULL;
+	}
+
+	if ( m_shared_face )
 	{
-		FT_Done_Face(m_face);
-		m_face = NULL;
+		FaceManager::instance()->release(m_shared_face);
+		m_shared_face = NULL;
 	}
+	m_face = NULL;
 }
 
 	
@@ -92,6 +92,12 @@ struct ColorRGBA
 //////////////////////////////////////////////////////////////////////////
 // bitmap
 
+enum EPixelFormat
+{
+	e_pixel_rgba8888,
+	e_pixel_a8		// coverage only, color is applied at draw time
+};
+
 class IBitmap
 {
 public:
@@ -107,6 +113,7 @@ public:
 	virtual bool is_managed() = 0;
 	virtual unsigned int get_unit_at(int pos_x, int pos_y) = 0;
 	virtual void set_unit_at(unsigned int data, int pos_x, int pos_y) = 0;
+	virtual void* get_unit_ptr(int pos_x, int pos_y) = 0;
 	virtual bool check_contains(int pos_x, int pos_y) = 0;
 };
 
@@ -115,6 +122,7 @@ class Bitmap_32bits: public IBitmap
 public:
 	Bitmap_32bits(int real_width, int real_height, int padding=0);
 	Bitmap_32bits(unsigned int* buf, int real_width, int real_height, int padding=0);
+	Bitmap_32bits(class BitmapPool* pool, int capacity);
 	virtual ~Bitmap_32bits();
 	virtual void release();
 	
@@ -139,6 +147,12 @@ public:
 		m_buffer[pos_y*m_width + pos_x] = (unsigned int)(data & (unsigned int)-1);
 	}
 
+	virtual void* get_unit_ptr(int pos_x, int pos_y)
+	{
+		pos_x += m_padding; pos_y += m_padding;
+		return &m_buffer[pos_y*m_width + pos_x];
+	}
+
 	virtual bool check_contains(int pos_x, int pos_y)
 	{
 		pos_x += m_padding; pos_y += m_padding;
@@ -149,11 +163,130 @@ public:
 	}
 
 private:
+	friend class BitmapPool;
+
+	// reuse the buffer of a pooled bitmap, zero filled
+	void _reshape(int real_width, int real_height, int padding);
+
 	unsigned int* m_buffer;
 	int m_width;
 	int m_height;
 	int m_padding;
 	bool m_managed;
+
+	class BitmapPool* m_pool;	// recycled by release() if set
+	int m_capacity;				// units of the buffer
+};
+
+// a8 bitmap: units are read as white with alpha, only alpha is stored
+class Bitmap_8bits: public IBitmap
+{
+public:
+	Bitmap_8bits(int real_width, int real_height, int padding=0);
+	Bitmap_8bits(unsigned char* buf, int real_width, int real_height, int padding=0);
+	Bitmap_8bits(class BitmapPool* pool, int capacity);
+	virtual ~Bitmap_8bits();
+	virtual void release();
+	
+	virtual int width() { return m_width - m_padding*2; }
+	virtual int height() { return m_height - m_padding*2; }
+	virtual int padding() { return m_padding; }
+	virtual int real_width() { return m_width; }
+	virtual int real_height() { return m_height; }
+	virtual int numbits() { return sizeof(unsigned char) << 3; }
+	virtual bool is_managed() { return m_managed; }
+	virtual const void* get_buffer() { return m_buffer; }
+
+	virtual unsigned int get_unit_at(int pos_x, int pos_y)
+	{
+		pos_x += m_padding; pos_y += m_padding;
+		return ((unsigned int)m_buffer[pos_y*m_width + pos_x] << 24) | 0x00ffffff;
+	}
+
+	virtual void set_unit_at(unsigned int data, int pos_x, int pos_y)
+	{
+		pos_x += m_padding; pos_y += m_padding;
+		m_buffer[pos_y*m_width + pos_x] = (unsigned char)(data >> 24);
+	}
+
+	virtual void* get_unit_ptr(int pos_x, int pos_y)
+	{
+		pos_x += m_padding; pos_y += m_padding;
+		return &m_buffer[pos_y*m_width + pos_x];
+	}
+
+	virtual bool check_contains(int pos_x, int pos_y)
+	{
+		pos_x += m_padding; pos_y += m_padding;
+		if ( pos_x < 0 || pos_x >= m_width || pos_y < 0 || pos_y >= m_height )
+			return false;
+
+		return true;
+	}
+
+private:
+	friend class BitmapPool;
+
+	// reuse the buffer of a pooled bitmap, zero filled
+	void _reshape(int real_width, int real_height, int padding);
+
+	unsigned char* m_buffer;
+	int m_width;
+	int m_height;
+	int m_padding;
+	bool m_managed;
+
+	class BitmapPool* m_pool;	// recycled by release() if set
+	int m_capacity;				// units of the buffer
+};
+
+//
+// recycles glyph bitmaps in power of two size classes
+//	- a released bitmap goes back to the free list of its class
+//	- bitmaps must be released before the pool is deleted
+//	- not thread safe, used by the thread owning the font
+//
+class BitmapPool
+{
+	friend class Bitmap_32bits;
+	friend class Bitmap_8bits;
+public:
+	BitmapPool(size_t max_pooled_bytes = DFONT_BITMAP_POOL_SIZE);
+	~BitmapPool();
+
+	// zero filled bitmap of 8 or 32 bits, give back by release()
+	IBitmap* alloc(int numbits, int real_width, int real_height, int padding);
+
+	// bitmaps returned by alloc
+	size_t alloc_count();
+
+	// bitmaps created on heap by alloc, the rest were recycled
+	size_t heap_alloc_count();
+
+	// bytes of free bitmaps
+	size_t pooled_bytes();
+
+	void reset_counters();
+
+private:
+	enum
+	{
+		c_min_class_bits = 6,	// 64 units
+		c_max_class_bits = 18,	// 256K units, larger bitmaps are not pooled
+		c_class_num = c_max_class_bits - c_min_class_bits + 1
+	};
+
+	// -1 if too large
+	static int _size_class(int units);
+
+	void _recycle(IBitmap* bitmap, int numbits, int capacity);
+
+	std::vector<IBitmap*> m_free[2][c_class_num];	// a8, rgba8888
+	size_t m_max_pooled_bytes;
+	size_t m_pooled_bytes;
+
+	size_t m_alloc_count;
+	size_t m_heap_alloc_count;
 };
 
 struct GlyphBitmap
@@ -161,8 +294,8 @@ struct GlyphBitmap
 	IBitmap* bitmap;
 	FT_Vector top_left_pixels;
 	FT_Vector advance_pixels;
-	FT_Vector kerning_pixels;
-	GlyphBitmap() : bitmap(NULL), top_left_pixels(), advance_pixels(), kerning_pixels() {}
+	FT_Pos advance_x_26dot6;	// advance_pixels.x before rounding
+	GlyphBitmap() : bitmap(NULL), top_left_pixels(), advance_pixels(), advance_x_26dot6(0) {}
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -249,11 +382,12 @@ struct RenderPassParam
 	int				translate_y;
 	bool			stroke;
 	FT_F26Dot6		stroke_radius;	// 26.6 format
+	int				sdf_spread;		// pixels, render distance field if > 0
 
 	RenderPassParam(
 		ColorRGBA c, EBlenderType b, 
 		int tx, int ty, 
-		bool _stroke=false, FT_F26Dot6 _stroke_radius = 64);
+		bool _stroke=false, FT_F26Dot6 _stroke_radius = 64, int _sdf_spread = 0);
 };
 
 class IRenderPass
@@ -261,7 +395,9 @@ class IRenderPass
 public:
 	virtual ~IRenderPass(){}
 	virtual void init(const RenderPassParam& param) = 0;
-	virtual FT_Error pre_render(FT_Glyph& glyph) = 0;
+
+	// glyph is read until post_render, offset_x moves outlines in 26.6
+	virtual FT_Error pre_render(FT_Glyph& glyph, FT_Pos offset_x) = 0;
 
 	// buffer cbox is the max box of all passes, so may larger than current pass cbox
 	virtual FT_Error post_render(IBitmap* buf, const FT_BBox& buf_cbox) = 0;
@@ -297,7 +433,7 @@ public:
 	virtual const IPixelBlender* blender();
 	virtual void set_blender(EBlenderType bt);
 
-	virtual FT_Error pre_render(FT_Glyph& glyph);
+	virtual FT_Error pre_render(FT_Glyph& glyph, FT_Pos offset_x);
 	virtual FT_Error post_render(IBitmap* buf, const FT_BBox& buf_cbox);
 
 protected:
@@ -307,11 +443,13 @@ protected:
 protected:
 	ColorRGBA	m_color;	// render color
 	FT_BBox		m_cbox;		// the control box
-	FT_Glyph	m_glyph;	// the glyph to render
+	FT_Glyph	m_glyph;	// the glyph to render, not owned
+	FT_Pos		m_offset_x;	// subpixel offset: 26.6f
 	FT_Vector	m_translate;	// translate
 	bool		m_stroke;	// if stroke
 	FT_F26Dot6	m_stroke_radius;   // stroke thickness: 26.6f
 	const IPixelBlender* m_blender;// pixel blender for render
+	EBlenderType m_blender_type;
 };
 
 class BitmapRenderPass: public BaseRenderPass
@@ -324,6 +462,11 @@ private:
 	virtual void _render(IBitmap* buf,const FT_BBox& buf_cbox, FT_BitmapGlyph bitmap_glyph, bool border);
 };
 
+//
+// renders the glyph outline, stroked if set
+//	- the outline is copied or stroked into a scratch outline, its arrays grow and are kept between glyphs
+//	- the stroker is created with the first stroked glyph and reused
+//
 class OutlineRenderPass: public BaseRenderPass
 {
 public:
@@ -332,8 +475,15 @@ public:
 		OutlineRenderPass* pass;
 		IBitmap* buf;
 		const FT_BBox* buf_cbox;
+		ColorRGBA color;
+		void (*blend_span)(void* dst, int len, ColorRGBA src);
 	};
 
+	OutlineRenderPass();
+	virtual ~OutlineRenderPass();
+
+	virtual void set_stroke_radius(FT_F26Dot6 radius);
+
 protected:
 	virtual FT_Error decorate();
 	virtual FT_Error transform();
@@ -341,11 +491,49 @@ protected:
 	virtual FT_Error post_render_impl(IBitmap* buf, const FT_BBox& buf_cbox);
 
 	static void spans_callback(const int y, const int count, const FT_Span * const spans, void * const user);
+
+	// rendered outline of the current glyph
+	FT_Outline m_outline;
+	FT_Library m_library;
+
+private:
+	// scratch objects belong to the library of the glyph
+	void _bind_library(FT_Library library);
+
+	// room for points and contours, the outline is emptied
+	FT_Error _reserve_outline(FT_UInt points, FT_UInt contours);
+
+	void _done_scratch();
+
+	FT_UInt m_point_capacity;
+	FT_UInt m_contour_capacity;
+	FT_Stroker m_stroker;
+};
+
+//
+// signed distance field of the outline
+//	- 0.5 alpha on the edge, decreases to 0 at spread pixels outside
+//	- cbox grows spread pixels each side, stroke is ignored
+//
+class SDFRenderPass: public OutlineRenderPass
+{
+public:
+	SDFRenderPass();
+
+	virtual void init(const RenderPassParam& param);
+
+protected:
+	virtual FT_Error pre_render_impl();
+	virtual FT_Error post_render_impl(IBitmap* buf, const FT_BBox& buf_cbox);
+
+private:
+	int m_spread;
 };
 
 //////////////////////////////////////////////////////////////////////////
 // glyph renderer
 
+// passes keep FreeType objects of the glyph library, delete the renderer before FT_Done_FreeType
 class GlyphRenderer
 {
 public:
@@ -355,19 +543,89 @@ public:
 	GlyphRenderer* init_pass();
 	GlyphRenderer* add_pass(const RenderPassParam& param);
 
-	FT_Error render(FT_Glyph& glyph, GlyphBitmap* glyph_bitmap);
+	// true if all passes draw with the same color
+	bool single_color(ColorRGBA* color);
+
+	void set_pixel_format(EPixelFormat format);
+	EPixelFormat pixel_format();
+
+	// a renderer with the same passes
+	GlyphRenderer* clone();
+
+	const std::vector<RenderPassParam>& params();
+
+	// allocate bitmaps from the pool, NULL for heap
+	void set_bitmap_pool(BitmapPool* pool);
+
+	// outlines are moved right by offset_x in 26.6 for subpixel positioning
+	FT_Error render(FT_Glyph& glyph, GlyphBitmap* glyph_bitmap, FT_Pos offset_x = 0);
 	FT_Error render(FT_Glyph& glyph, IBitmap** pbuf, FT_Vector* top_left_pixel, FT_Vector* advance_pixel);
 
 private:
 	void reset();
 
+	// passes share the glyph, none of them copies it
+	FT_Error _render(FT_Glyph& glyph, IBitmap** pbuf, FT_Vector* top_left_pixel, FT_Vector* advance_pixel, FT_Pos offset_x);
+
 	std::vector<IRenderPass*> m_outline_passes; 
 	std::vector<IRenderPass*> m_bitmap_passes; 
+	std::vector<RenderPassParam> m_params;
+	EPixelFormat m_pixel_format;
+	BitmapPool* m_bitmap_pool;
 };
 
 //////////////////////////////////////////////////////////////////////////
 // font
 
+//
+// pair kerning in pixels, keyed by char codes
+//	- direct mapped, a pair replaces the one at its entry
+//	- entries are allocated at the first insert
+//
+class KerningCache
+{
+public:
+	KerningCache();
+	~KerningCache();
+
+	// return false if the pair is not cached
+	bool find(FT_ULong left_code, FT_ULong right_code, int* pixels)
+	{
+		if ( !m_entries )
+		{
+			return false;
+		}
+
+		const Entry& entry = m_entries[_index(left_code, right_code)];
+		if ( entry.left_code == left_code && entry.right_code == right_code )
+		{
+			*pixels = entry.pixels;
+			return true;
+		}
+		return false;
+	}
+
+	void insert(FT_ULong left_code, FT_ULong right_code, int pixels);
+
+	void clear();
+
+private:
+	struct Entry
+	{
+		FT_UInt32 left_code;	// 0 for an empty entry
+		FT_UInt32 right_code;
+		FT_Int32 pixels;
+	};
+
+	size_t _index(FT_ULong left_code, FT_ULong right_code)
+	{
+		FT_UInt32 h = (FT_UInt32)left_code * 0x9E3779B1u ^ (FT_UInt32)right_code * 0x85EBCA77u;
+		return (h >> 11) & (DFONT_KERNING_CACHE_SIZE - 1);
+	}
+
+	Entry* m_entries;
+};
+
 class FontInfo
 {
 public:
@@ -377,13 +635,35 @@ public:
 public:
 	void release();
 
+	// a copy with its own face on another library, for using in other thread
+	FontInfo* clone(FT_Library library);
+
 	FontInfo* add_pass(const RenderPassParam& param);
 
+	// true if all passes draw with the same color
+	bool single_color(ColorRGBA* color);
+
+	// pixel format of rendered bitmaps, shared with hackfonts
+	void set_pixel_format(EPixelFormat format);
+	EPixelFormat pixel_format();
+
+	// bitmaps of the font and hackfonts are allocated from the pool, NULL for heap
+	void set_bitmap_pool(BitmapPool* pool);
+
 	// return 0 if failed, charactor index if success
-	FT_UInt render_charcode(FT_ULong char_code, GlyphBitmap* bitmap, FT_UInt prev_idx = 0);
+	//	- offset_x in 26.6 moves outline glyphs right for subpixel variants
+	FT_UInt render_charcode(FT_ULong char_code, GlyphBitmap* bitmap, FT_Pos offset_x = 0);
+
+	// pen offset in pixels between two chars, 0 if they are from different faces
+	int kerning(FT_ULong left_code, FT_ULong right_code);
 
 	const char* font_name();
 
+	FT_Long face_idx();
+
+	// params of all passes, NULL if no renderer
+	const std::vector<RenderPassParam>* pass_params();
+
 	FT_Library library();
 
 	bool is_bitmap();
@@ -396,6 +676,8 @@ public:
 
 	void set_shift_y(FT_UInt sy);
 
+	FT_UInt shift_y();
+
 	FT_UInt extend_pt();
 
 	FT_Short underline_position();
@@ -404,8 +686,13 @@ public:
 
 	FT_Face face();
 
+	// charset should not change after set
 	void set_available_charset(std::set<FT_ULong>* charset);
 
+	std::set<FT_ULong>* available_charset();
+
+	std::vector<FontInfo*>* hackfonts();
+
 	FontInfo* add_hackfont(const char* fontname, std::set<FT_ULong>* charset, FT_UInt shift_y = 0);
 
 	FontInfo* add_hackfont(const char* fontname, FT_Long face_idx, std::set<FT_ULong>* charset, FT_UInt shift_y);
@@ -413,13 +700,25 @@ public:
 protected:
 	// from char code to char index
 	FT_UInt get_char_index(FT_ULong charcode);
-	bool render_charidx(FT_UInt char_idx, GlyphBitmap* bitmap, FT_UInt prev_idx = 0);
+	bool render_charidx(FT_UInt char_idx, GlyphBitmap* bitmap, FT_Pos offset_x = 0);
+
+	// font rendering the char, this or a hackfont, and the char index in it
+	FT_UInt _resolve_char(FT_ULong char_code, FontInfo** font);
+
+	// char ranges of this font and hackfonts, hackfonts first
+	void _build_char_ranges();
+
+	// chars in charset and cmap, paired with font_idx
+	void _collect_chars(int font_idx, std::vector<std::pair<FT_ULong, int> >* chars);
 
 	// has kerning info
 	bool has_kerning();
 	FT_Vector get_kerning(FT_UInt left_idx, FT_UInt right_idx);
 
-	FT_Error _render_ready_char(GlyphBitmap* bitmap);
+	FT_Error _render_ready_char(FT_UInt char_idx, GlyphBitmap* bitmap, FT_Pos offset_x);
+
+	// give back size and face
+	void _done_face();
 
 	FT_GlyphSlot current_glyph();
 
@@ -437,8 +736,19 @@ protected:
 	~FontInfo();
 
 private:
+	// chars [first, last] are rendered by hackfont font_idx, or this font if font_idx is the hackfont count
+	struct CharRange
+	{
+		FT_ULong first;
+		FT_ULong last;
+		int font_idx;
+	};
+
 	FT_Library m_library;
 	std::string m_fontname;
+	FT_Long m_face_idx;
+	FT_UInt m_size_width_pt;	// size requested
+	FT_UInt m_size_height_pt;
 
 	bool	m_isbitmap;
 	FT_UInt m_char_width;
@@ -450,14 +760,21 @@ private:
 	FT_Short m_underline_position;
 	FT_Short m_underline_thickness;
 
+	class SharedFace* m_shared_face;
 	FT_Face m_face;
+	FT_Size m_size;		// own size on the shared face
 	bool m_has_kerning;
+	KerningCache m_kerning_cache;
 
 	GlyphRenderer* m_ob_renderer;
 	GlyphRenderer* m_private_renderer;
 
 	std::set<FT_ULong>* m_available_charset;
 	std::vector<FontInfo*> m_hackfonts;
+
+	// sorted by first, rebuilt when charset or hackfonts change
+	std::vector<CharRange> m_char_ranges;
+	bool m_char_ranges_dirty;
 };
 
 
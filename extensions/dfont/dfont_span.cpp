@@ -0,0 +1,311 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#include "dfont_span.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DFONT_SPAN_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define DFONT_SPAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace dfont
+{
+
+//////////////////////////////////////////////////////////////////////////
+// scalar
+
+// x / 255 for x in [0, 255*255]
+static inline unsigned int _div255(unsigned int x)
+{
+	return (x + 1 + (x >> 8)) >> 8;
+}
+
+static inline unsigned int _additive_pixel(unsigned int d, ColorRGBA src)
+{
+	if ( d == 0 )
+	{
+		return src.to_uint32();
+	}
+
+	ColorRGBA dst(d);
+	ColorRGBA r;
+	r.r = (FT_Byte)(src.r >= dst.r ? dst.r + _div255((src.r - dst.r) * src.a) : dst.r - _div255((dst.r - src.r) * src.a));
+	r.g = (FT_Byte)(src.g >= dst.g ? dst.g + _div255((src.g - dst.g) * src.a) : dst.g - _div255((dst.g - src.g) * src.a));
+	r.b = (FT_Byte)(src.b >= dst.b ? dst.b + _div255((src.b - dst.b) * src.a) : dst.b - _div255((dst.b - src.b) * src.a));
+	r.a = (FT_Byte)(src.a + dst.a < 0xff ? src.a + dst.a : 0xff);
+	return r.to_uint32();
+}
+
+static inline unsigned int _alpha_pixel(unsigned int d, ColorRGBA src)
+{
+	ColorRGBA dst(d);
+	ColorRGBA r;
+	r.r = (FT_Byte)_div255(src.r * src.a + dst.r * (0xff - src.a));
+	r.g = (FT_Byte)_div255(src.g * src.a + dst.g * (0xff - src.a));
+	r.b = (FT_Byte)_div255(src.b * src.a + dst.b * (0xff - src.a));
+	r.a = src.a;
+	return r.to_uint32();
+}
+
+static void replace_span_32(void* dst, int len, ColorRGBA src)
+{
+	unsigned int* p = (unsigned int*)dst;
+	unsigned int c = src.to_uint32();
+	for ( int i = 0; i < len; i++ )
+	{
+		p[i] = c;
+	}
+}
+
+static void replace_span_8(void* dst, int len, ColorRGBA src)
+{
+	memset(dst, src.a, len);
+}
+
+static void additive_span_8(void* dst, int len, ColorRGBA src)
+{
+	unsigned char* p = (unsigned char*)dst;
+	int i = 0;
+
+#if DFONT_SPAN_SSE2
+	__m128i s = _mm_set1_epi8((char)src.a);
+	for ( ; i + 16 <= len; i += 16 )
+	{
+		__m128i d = _mm_loadu_si128((__m128i*)(p + i));
+		_mm_storeu_si128((__m128i*)(p + i), _mm_adds_epu8(d, s));
+	}
+#elif DFONT_SPAN_NEON
+	uint8x16_t s = vdupq_n_u8(src.a);
+	for ( ; i + 16 <= len; i += 16 )
+	{
+		vst1q_u8(p + i, vqaddq_u8(vld1q_u8(p + i), s));
+	}
+#endif
+
+	for ( ; i < len; i++ )
+	{
+		p[i] = (unsigned char)(p[i] + src.a < 0xff ? p[i] + src.a : 0xff);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// simd, 4 pixels each loop
+
+#if DFONT_SPAN_SSE2
+
+static inline __m128i _div255_epi16(__m128i x)
+{
+	__m128i one = _mm_set1_epi16(1);
+	return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8)), 8);
+}
+
+static void additive_span_32(void* dst, int len, ColorRGBA src)
+{
+	unsigned int* p = (unsigned int*)dst;
+	int i = 0;
+
+	__m128i zero = _mm_setzero_si128();
+	__m128i s = _mm_set1_epi32((int)src.to_uint32());
+	__m128i a = _mm_set1_epi16(src.a);
+	__m128i amask = _mm_set1_epi32((int)0xff000000);
+	for ( ; i + 4 <= len; i += 4 )
+	{
+		__m128i d = _mm_loadu_si128((__m128i*)(p + i));
+
+		// d + (s - d) * a / 255, as d + pos - neg
+		__m128i pos = _mm_subs_epu8(s, d);
+		__m128i neg = _mm_subs_epu8(d, s);
+		__m128i pos_lo = _div255_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pos, zero), a));
+		__m128i pos_hi = _div255_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pos, zero), a));
+		__m128i neg_lo = _div255_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(neg, zero), a));
+		__m128i neg_hi = _div255_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(neg, zero), a));
+		__m128i r = _mm_sub_epi8(_mm_add_epi8(d, _mm_packus_epi16(pos_lo, pos_hi)), _mm_packus_epi16(neg_lo, neg_hi));
+
+		// alpha is saturated add
+		r = _mm_or_si128(_mm_andnot_si128(amask, r), _mm_and_si128(amask, _mm_adds_epu8(s, d)));
+
+		// empty pixel takes src
+		__m128i empty = _mm_cmpeq_epi32(d, zero);
+		r = _mm_or_si128(_mm_and_si128(empty, s), _mm_andnot_si128(empty, r));
+
+		_mm_storeu_si128((__m128i*)(p + i), r);
+	}
+
+	for ( ; i < len; i++ )
+	{
+		p[i] = _additive_pixel(p[i], src);
+	}
+}
+
+static void alpha_span_32(void* dst, int len, ColorRGBA src)
+{
+	unsigned int* p = (unsigned int*)dst;
+	int i = 0;
+
+	__m128i zero = _mm_setzero_si128();
+	__m128i s = _mm_set1_epi32((int)src.to_uint32());
+	__m128i sa = _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), _mm_set1_epi16(src.a));
+	__m128i inv_a = _mm_set1_epi16(0xff - src.a);
+	__m128i amask = _mm_set1_epi32((int)0xff000000);
+	for ( ; i + 4 <= len; i += 4 )
+	{
+		__m128i d = _mm_loadu_si128((__m128i*)(p + i));
+
+		// (s * a + d * (255 - a)) / 255
+		__m128i lo = _div255_epi16(_mm_add_epi16(sa, _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inv_a)));
+		__m128i hi = _div255_epi16(_mm_add_epi16(sa, _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inv_a)));
+		__m128i r = _mm_packus_epi16(lo, hi);
+
+		// alpha is src alpha
+		r = _mm_or_si128(_mm_andnot_si128(amask, r), _mm_and_si128(amask, s));
+
+		_mm_storeu_si128((__m128i*)(p + i), r);
+	}
+
+	for ( ; i < len; i++ )
+	{
+		p[i] = _alpha_pixel(p[i], src);
+	}
+}
+
+#elif DFONT_SPAN_NEON
+
+static inline uint8x8_t _div255_u16(uint16x8_t x)
+{
+	return vmovn_u16(vshrq_n_u16(vaddq_u16(vaddq_u16(x, vdupq_n_u16(1)), vshrq_n_u16(x, 8)), 8));
+}
+
+static void additive_span_32(void* dst, int len, ColorRGBA src)
+{
+	unsigned int* p = (unsigned int*)dst;
+	int i = 0;
+
+	uint8x16_t s = vreinterpretq_u8_u32(vdupq_n_u32(src.to_uint32()));
+	uint8x8_t a = vdup_n_u8(src.a);
+	uint8x16_t amask = vreinterpretq_u8_u32(vdupq_n_u32(0xff000000));
+	for ( ; i + 4 <= len; i += 4 )
+	{
+		uint8x16_t d = vreinterpretq_u8_u32(vld1q_u32(p + i));
+
+		// d + (s - d) * a / 255, as d + pos - neg
+		uint8x16_t pos = vqsubq_u8(s, d);
+		uint8x16_t neg = vqsubq_u8(d, s);
+		uint8x16_t pos_a = vcombine_u8(_div255_u16(vmull_u8(vget_low_u8(pos), a)), _div255_u16(vmull_u8(vget_high_u8(pos), a)));
+		uint8x16_t neg_a = vcombine_u8(_div255_u16(vmull_u8(vget_low_u8(neg), a)), _div255_u16(vmull_u8(vget_high_u8(neg), a)));
+		uint8x16_t r = vsubq_u8(vaddq_u8(d, pos_a), neg_a);
+
+		// alpha is saturated add
+		r = vbslq_u8(amask, vqaddq_u8(s, d), r);
+
+		// empty pixel takes src
+		uint8x16_t empty = vreinterpretq_u8_u32(vceqq_u32(vreinterpretq_u32_u8(d), vdupq_n_u32(0)));
+		r = vbslq_u8(empty, s, r);
+
+		vst1q_u32(p + i, vreinterpretq_u32_u8(r));
+	}
+
+	for ( ; i < len; i++ )
+	{
+		p[i] = _additive_pixel(p[i], src);
+	}
+}
+
+static void alpha_span_32(void* dst, int len, ColorRGBA src)
+{
+	unsigned int* p = (unsigned int*)dst;
+	int i = 0;
+
+	uint8x16_t s = vreinterpretq_u8_u32(vdupq_n_u32(src.to_uint32()));
+	uint16x8_t sa = vmull_u8(vget_low_u8(s), vdup_n_u8(src.a));
+	uint8x8_t inv_a = vdup_n_u8(0xff - src.a);
+	uint8x16_t amask = vreinterpretq_u8_u32(vdupq_n_u32(0xff000000));
+	for ( ; i + 4 <= len; i += 4 )
+	{
+		uint8x16_t d = vreinterpretq_u8_u32(vld1q_u32(p + i));
+
+		// (s * a + d * (255 - a)) / 255
+		uint8x8_t lo = _div255_u16(vmlal_u8(sa, vget_low_u8(d), inv_a));
+		uint8x8_t hi = _div255_u16(vmlal_u8(sa, vget_high_u8(d), inv_a));
+		uint8x16_t r = vcombine_u8(lo, hi);
+
+		// alpha is src alpha
+		r = vbslq_u8(amask, s, r);
+
+		vst1q_u32(p + i, vreinterpretq_u32_u8(r));
+	}
+
+	for ( ; i < len; i++ )
+	{
+		p[i] = _alpha_pixel(p[i], src);
+	}
+}
+
+#else
+
+static void additive_span_32(void* dst, int len, ColorRGBA src)
+{
+	unsigned int* p = (unsigned int*)dst;
+	for ( int i = 0; i < len; i++ )
+	{
+		p[i] = _additive_pixel(p[i], src);
+	}
+}
+
+static void alpha_span_32(void* dst, int len, ColorRGBA src)
+{
+	unsigned int* p = (unsigned int*)dst;
+	for ( int i = 0; i < len; i++ )
+	{
+		p[i] = _alpha_pixel(p[i], src);
+	}
+}
+
+#endif
+
+span_blend_func_t get_span_blender(EBlenderType bt, int numbits)
+{
+	static const span_blend_func_t blenders_32[e_blender_num] =
+	{
+		replace_span_32,
+		additive_span_32,
+		alpha_span_32
+	};
+
+	// alpha blender keeps src alpha, same as replace
+	static const span_blend_func_t blenders_8[e_blender_num] =
+	{
+		replace_span_8,
+		additive_span_8,
+		replace_span_8
+	};
+
+	return numbits == 8 ? blenders_8[bt] : blenders_32[bt];
+}
+
+}//namespace dfont
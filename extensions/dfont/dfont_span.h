@@ -0,0 +1,46 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#ifndef __DFONT_SPAN_H__ 
+#define __DFONT_SPAN_H__
+
+#include "dfont_render.h"
+
+namespace dfont
+{
+
+//
+// span kernels for render passes
+//	- blend one src color into a run of pixels, without virtual calls
+//	- dst is ColorRGBA pixels for 32bits bitmap, alpha only for 8bits bitmap
+//	- src alpha should be coverage applied
+//
+typedef void (*span_blend_func_t)(void* dst, int len, ColorRGBA src);
+
+// same result as PixelBlenders[bt]
+span_blend_func_t get_span_blender(EBlenderType bt, int numbits);
+
+}
+
+#endif//__DFONT_SPAN_H__
@@ -0,0 +1,140 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#include "dfont_utf8.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DFONT_UTF8_SSE2 1
+#else
+#define DFONT_UTF8_SSE2 0
+#endif
+
+namespace dfont
+{
+
+size_t Utf8Decoder::decode(unsigned long* out, size_t max)
+{
+	size_t count = 0;
+	while ( count < max && m_pos < m_end )
+	{
+		size_t run = _ascii_run(max - count);
+		for ( size_t i = 0; i < run; i++ )
+		{
+			out[count + i] = m_pos[i];
+		}
+		count += run;
+		m_pos += run;
+
+		if ( count < max && m_pos < m_end && *m_pos >= 0x80 )
+		{
+			out[count++] = _decode_multibyte();
+		}
+	}
+	return count;
+}
+
+unsigned long Utf8Decoder::_decode_multibyte()
+{
+	unsigned char lead = *m_pos;
+
+	int follows = 0;
+	unsigned long code = 0;
+	unsigned long min_code = 0;
+	if ( lead >= 0xc2 && lead <= 0xdf )			{ follows = 1; code = lead & 0x1f; min_code = 0x80; }
+	else if ( lead >= 0xe0 && lead <= 0xef )	{ follows = 2; code = lead & 0x0f; min_code = 0x800; }
+	else if ( lead >= 0xf0 && lead <= 0xf4 )	{ follows = 3; code = lead & 0x07; min_code = 0x10000; }
+	else
+	{
+		// continuation byte or overlong lead
+		m_pos++;
+		return c_utf8_replacement;
+	}
+
+	if ( m_end - m_pos <= follows )
+	{
+		m_pos++;
+		return c_utf8_replacement;
+	}
+
+	for ( int i = 1; i <= follows; i++ )
+	{
+		unsigned char c = m_pos[i];
+		if ( (c & 0xc0) != 0x80 )
+		{
+			m_pos++;
+			return c_utf8_replacement;
+		}
+		code = (code << 6) | (c & 0x3f);
+	}
+
+	if ( code < min_code || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff) )
+	{
+		m_pos++;
+		return c_utf8_replacement;
+	}
+
+	m_pos += follows + 1;
+	return code;
+}
+
+size_t Utf8Decoder::_ascii_run(size_t limit)
+{
+	const unsigned char* p = m_pos;
+	const unsigned char* stop = (size_t)(m_end - m_pos) < limit ? m_end : m_pos + limit;
+
+#if DFONT_UTF8_SSE2
+	// high bits of 16 bytes in one mask
+	while ( stop - p >= 16 )
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*)p);
+		if ( _mm_movemask_epi8(bytes) != 0 )
+		{
+			break;
+		}
+		p += 16;
+	}
+#else
+	while ( stop - p >= 4 )
+	{
+		unsigned int word;
+		memcpy(&word, p, 4);
+		if ( word & 0x80808080u )
+		{
+			break;
+		}
+		p += 4;
+	}
+#endif
+
+	while ( p < stop && *p < 0x80 )
+	{
+		p++;
+	}
+	return p - m_pos;
+}
+
+}//namespace dfont
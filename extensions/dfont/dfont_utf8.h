@@ -0,0 +1,96 @@
+/****************************************************************************
+ Copyright (c) 2013 Kevin Sun and RenRen Games
+
+ email:happykevins@gmail.com
+ http://wan.renren.com
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+#ifndef __DFONT_UTF8_H__ 
+#define __DFONT_UTF8_H__
+
+#include "dfont_config.h"
+
+#include <stddef.h>
+
+namespace dfont
+{
+
+// decoded from an invalid or truncated sequence
+const unsigned long c_utf8_replacement = 0xfffd;
+
+//
+// utf-8 to utf-32 decoder over a byte range, nothing is copied or allocated
+//	- an invalid byte decodes to c_utf8_replacement, decoding goes on at the next byte
+//	- overlong forms, surrogates and codes above U+10FFFF are invalid
+//	- decode() copies runs of ascii bytes, 16 bytes a test with SSE2
+//
+class Utf8Decoder
+{
+public:
+	Utf8Decoder(const char* begin, const char* end)
+		: m_pos((const unsigned char*)begin), m_end((const unsigned char*)end)
+	{
+	}
+
+	// false at the end of range
+	bool next(unsigned long* code)
+	{
+		if ( m_pos >= m_end )
+		{
+			return false;
+		}
+
+		if ( *m_pos < 0x80 )
+		{
+			*code = *m_pos++;
+			return true;
+		}
+
+		*code = _decode_multibyte();
+		return true;
+	}
+
+	// decode up to max codes into out, return the count, 0 at the end of range
+	size_t decode(unsigned long* out, size_t max);
+
+	bool done()
+	{
+		return m_pos >= m_end;
+	}
+
+	// next byte to decode
+	const char* position()
+	{
+		return (const char*)m_pos;
+	}
+
+private:
+	unsigned long _decode_multibyte();
+
+	// count of ascii bytes from m_pos, no more than limit
+	size_t _ascii_run(size_t limit);
+
+	const unsigned char* m_pos;
+	const unsigned char* m_end;
+};
+
+}
+
+#endif//__DFONT_UTF8_H__
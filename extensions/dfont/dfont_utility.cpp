@@ -25,9 +25,18 @@
 #include "dfont_utility.h"
 #include "dfont_render.h"
 #include "dfont_manager.h"
+#include "dfont_utf8.h"
 
+#if DFONT_COCOS2D
 #include <cocos2d.h>
+#endif
 #include <fstream>
+#include <map>
+#include <algorithm>
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
 
 #if defined(_MSC_VER)
 
@@ -36,11 +45,15 @@
 
 #elif defined(__GNUC__)
 
+#include <time.h>
+
 #else
 #error  "dfont do not support this os!"
 #endif
 
+#if DFONT_COCOS2D
 using namespace cocos2d;
+#endif
 
 namespace dfont 
 {
@@ -54,7 +67,44 @@ unsigned int dfont_default_color = 0xffffffff;
 //
 // platform utilities
 //
-#if (CC_TARGET_PLATFORM == CC_PLATFORM_WIN32)
+#if !DFONT_COCOS2D
+
+const char* get_systemfont_path()
+{
+	return "/usr/share/fonts";
+}
+
+int get_system_default_ppi()
+{
+	return 0;
+}
+
+int get_prefered_default_fontsize()
+{
+	return 18;
+}
+
+const char* get_system_default_fontfile()
+{
+	return "truetype/wqy/wqy-microhei.ttc";
+}
+
+const char* get_system_fallback_fontfile()
+{
+	return "truetype/dejavu/DejaVuSans.ttf";
+}
+
+const char* get_system_default_hacklatin_fontfile()
+{
+	return NULL;
+}
+
+int get_system_default_hacklatin_fontshifty()
+{
+	return 0;
+}
+
+#elif (CC_TARGET_PLATFORM == CC_PLATFORM_WIN32)
 
 char default_fontpath_buf[256] = {0};
 const char* get_systemfont_path()
@@ -256,9 +306,11 @@ void dfont_default_initialize()
 	dfont_default_fontfile	= get_system_default_fontfile();
 	dfont_default_size		= get_prefered_default_fontsize();
 
-	CCAssert(dfont_default_fontpath, "");
-	CCAssert(dfont_default_fontfile, "");
+	assert(dfont_default_fontpath);
+	assert(dfont_default_fontfile);
+#if DFONT_COCOS2D
 	CCFileUtils::sharedFileUtils()->addSearchPath(dfont_default_fontpath);
+#endif
 
 	// add default font
 	FontCatalog* font_catalog = FontFactory::instance()->create_font(
@@ -284,8 +336,7 @@ void dfont_default_initialize()
 		// hack latin charset?
 		if ( get_system_default_hacklatin_fontfile() )
 		{
-			std::string fullpath = CCFileUtils::sharedFileUtils()
-				->fullPathForFilename(get_system_default_hacklatin_fontfile());
+			std::string fullpath = full_path(get_system_default_hacklatin_fontfile());
 
 			/*FontInfo* hackfont =*/ font_catalog->add_hackfont(
 				fullpath.c_str(), latin_charset(), 
@@ -306,6 +357,299 @@ std::set<unsigned long>* latin_charset()
 	return &latinset;
 }
 
+static bool greater_count(const std::pair<size_t, unsigned long>& a, const std::pair<size_t, unsigned long>& b)
+{
+	return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+bool frequent_chars(const char* corpus_file, size_t max_chars, std::vector<unsigned long>* chars)
+{
+	std::string fullpath = full_path(corpus_file);
+	unsigned long size = 0;
+	unsigned char* data = read_file(fullpath.c_str(), &size);
+	if ( !data )
+	{
+		return false;
+	}
+
+	// count chars, invalid sequences are skipped
+	std::vector<size_t> bmp_counts(0x10000, 0);
+	std::map<unsigned long, size_t> counts;
+	Utf8Decoder decoder((const char*)data, (const char*)data + size);
+	unsigned long code;
+	while ( decoder.next(&code) )
+	{
+		if ( code > 0x20 && code != 0xfeff && code != c_utf8_replacement && !isspace_unicode(code) )
+		{
+			if ( code < 0x10000 )
+				bmp_counts[code]++;
+			else
+				counts[code]++;
+		}
+	}
+	delete[] data;
+
+	std::vector<std::pair<size_t, unsigned long> > sorted;
+	for ( unsigned long code = 0; code < 0x10000; code++ )
+	{
+		if ( bmp_counts[code] )
+		{
+			sorted.push_back(std::make_pair(bmp_counts[code], code));
+		}
+	}
+	for ( std::map<unsigned long, size_t>::iterator it = counts.begin(); it != counts.end(); it++ )
+	{
+		sorted.push_back(std::make_pair(it->second, it->first));
+	}
+	std::sort(sorted.begin(), sorted.end(), greater_count);
+
+	for ( size_t i = 0; i < sorted.size() && i < max_chars; i++ )
+	{
+		chars->push_back(sorted[i].second);
+	}
+	return true;
+}
+
+unsigned long long hash_bytes(const void* data, size_t len, unsigned long long h)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	for ( size_t i = 0; i < len; i++ )
+	{
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//
+// engine glue
+//
+#if DFONT_COCOS2D
+
+// pages are CCTexture2D, dirty rows go to glTexSubImage2D
+class CocosTextureBackend : public ITextureBackend
+{
+public:
+	virtual void* create_texture(WTexture2D* texture, const unsigned char* data)
+	{
+		CCTexture2DPixelFormat format = kCCTexture2DPixelFormat_RGBA8888;
+		if ( texture->bytes_per_pixel() == 1 )
+		{
+			format = kCCTexture2DPixelFormat_A8;
+		}
+
+		CCTexture2D* tex = new CCTexture2D;
+		tex->initWithData(data, format, texture->width(), texture->height(), CCSize(texture->width(), texture->height()));
+
+		if ( texture->smooth() )
+		{
+			tex->setAntiAliasTexParameters();
+		}
+		else
+		{
+			tex->setAliasTexParameters();
+		}
+
+		return tex;
+	}
+
+	virtual void destroy_texture(WTexture2D* texture, void* user_texture)
+	{
+		if ( user_texture )
+		{
+			((CCTexture2D*)user_texture)->release();
+		}
+	}
+
+	virtual void upload_rows(WTexture2D* texture, int y, int rows, const unsigned char* data)
+	{
+		//box@hulijun.cn: fix skewed bug
+		//http://www.opengl.org/archives/resources/features/KilgardTechniques/oglpitfall/
+		//GL_UNPACK_ALIGNMENT
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		ccGLBindTexture2D(texture->user_texture<CCTexture2D>()->getName());
+
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 
+			0, y, texture->width(), rows,
+			texture->bytes_per_pixel() == 1 ? GL_ALPHA : GL_RGBA, GL_UNSIGNED_BYTE, data
+			);
+	}
+};
+
+// drive FontFactory::update by cocos2d scheduler
+class AsyncTicker : public CCObject
+{
+public:
+	AsyncTicker(FontFactory* factory) : m_factory(factory) {}
+
+	virtual void update(float dt)
+	{
+		m_factory->update(dt);
+	}
+
+private:
+	FontFactory* m_factory;
+};
+
+static AsyncTicker* s_ticker = NULL;
+
+ITextureBackend* default_texture_backend()
+{
+	static CocosTextureBackend backend;
+	return &backend;
+}
+
+void schedule_update(FontFactory* factory)
+{
+	if ( s_ticker )
+	{
+		return;
+	}
+
+	s_ticker = new AsyncTicker(factory);
+	CCDirector::sharedDirector()->getScheduler()->scheduleUpdateForTarget(s_ticker, 0, false);
+}
+
+void unschedule_update(FontFactory* factory)
+{
+	if ( s_ticker )
+	{
+		CCDirector::sharedDirector()->getScheduler()->unscheduleUpdateForTarget(s_ticker);
+		s_ticker->release();
+		s_ticker = NULL;
+	}
+}
+
+std::string full_path(const char* filename)
+{
+	return CCFileUtils::sharedFileUtils()->fullPathForFilename(filename);
+}
+
+std::string writable_path()
+{
+	return CCFileUtils::sharedFileUtils()->getWritablePath();
+}
+
+unsigned char* read_file(const char* fullpath, unsigned long* size)
+{
+	return CCFileUtils::sharedFileUtils()->getFileData(fullpath, "rb", size);
+}
+
+double now_ms()
+{
+	struct cc_timeval now;
+	CCTime::gettimeofdayCocos2d(&now, NULL);
+	return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+
+void dfont_log(const char* format, ...)
+{
+	char buffer[1024];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	CCLog("%s", buffer);
+}
+
+#else
+
+ITextureBackend* default_texture_backend()
+{
+	static RecordingTextureBackend backend;
+	return &backend;
+}
+
+void schedule_update(FontFactory* factory)
+{
+}
+
+void unschedule_update(FontFactory* factory)
+{
+}
+
+static bool file_exists(const std::string& path)
+{
+	FILE* fp = fopen(path.c_str(), "rb");
+	if ( fp )
+	{
+		fclose(fp);
+	}
+	return fp != NULL;
+}
+
+std::string full_path(const char* filename)
+{
+	if ( file_exists(filename) || !dfont_default_fontpath )
+	{
+		return filename;
+	}
+
+	std::string path = std::string(dfont_default_fontpath) + "/" + filename;
+	return file_exists(path) ? path : filename;
+}
+
+std::string writable_path()
+{
+	return "./";
+}
+
+unsigned char* read_file(const char* fullpath, unsigned long* size)
+{
+	FILE* fp = fopen(fullpath, "rb");
+	if ( !fp )
+	{
+		return NULL;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	long length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	unsigned char* data = new unsigned char[length > 0 ? length : 1];
+	*size = (unsigned long)fread(data, 1, length > 0 ? length : 0, fp);
+	fclose(fp);
+	return data;
+}
+
+double now_ms()
+{
+#if defined(_MSC_VER)
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart * 1000.0 / frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+#endif
+}
+
+void dfont_log(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vfprintf(stdout, format, args);
+	va_end(args);
+
+	fputc('\n', stdout);
+}
+
+#endif//DFONT_COCOS2D
+
+// same set as cocos2d::isspace_unicode, for all planes
+bool isspace_unicode(unsigned long code)
+{
+	return (code >= 0x0009 && code <= 0x000d) || code == 0x0020 || code == 0x0085 || code == 0x00a0 || code == 0x1680
+		|| (code >= 0x2000 && code <= 0x200a) || code == 0x2028 || code == 0x2029 || code == 0x202f
+		|| code == 0x205f || code == 0x3000;
+}
+
 
 //////////////////////////////////////////////////////////////////////////
 // write to TGA file, for dump textures
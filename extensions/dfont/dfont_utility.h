@@ -27,10 +27,44 @@
 
 #include "dfont_config.h"
 
+#include <stddef.h>
 #include <set>
+#include <vector>
+#include <string>
 
 namespace dfont
 {
+	//
+	// engine glue, cocos2d-x unless DFONT_COCOS2D is 0
+	//	- without cocos2d-x pages have no engine textures, and the app calls FontFactory::update itself
+	//
+
+	// textures of atlas pages, CCTexture2D with cocos2d-x, a RecordingTextureBackend without
+	extern class ITextureBackend* default_texture_backend();
+
+	// call factory->update every frame
+	extern void schedule_update(class FontFactory* factory);
+	extern void unschedule_update(class FontFactory* factory);
+
+	// full path of a font or corpus file, searched in the font path
+	extern std::string full_path(const char* filename);
+
+	// directory of dumps and disk caches, ends with '/'
+	extern std::string writable_path();
+
+	// file content or NULL, delete[] by caller
+	extern unsigned char* read_file(const char* fullpath, unsigned long* size);
+
+	// FNV-1a 64 of the data, chained by h
+	extern unsigned long long hash_bytes(const void* data, size_t len, unsigned long long h = 14695981039346656037ULL);
+
+	// milliseconds of a monotonic clock
+	extern double now_ms();
+
+	extern void dfont_log(const char* format, ...);
+
+	extern bool isspace_unicode(unsigned long code);
+
 	// get system font directory
 	extern const char* get_systemfont_path();
 
@@ -43,6 +77,9 @@ namespace dfont
 	// get system_default font
 	extern const char* get_system_default_fontfile();
 
+	// get system fallback font, used if the default font is missing
+	extern const char* get_system_fallback_fontfile();
+
 	// get system default latin font
 	extern const char* get_system_default_hacklatin_fontfile();
 
@@ -52,6 +89,9 @@ namespace dfont
 	// latin charactor set
 	extern std::set<unsigned long>* latin_charset();
 
+	// the max_chars most frequent non-space chars of an utf-8 file, most frequent first
+	extern bool frequent_chars(const char* corpus_file, size_t max_chars, std::vector<unsigned long>* chars);
+
 	// dump to tga file
 #if _DFONT_DEBUG
 	typedef unsigned char uint8;